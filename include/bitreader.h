@@ -0,0 +1,178 @@
+#ifndef BITREADER_H
+#define BITREADER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * BitReader - Bitstream reader for parsing H.264 RBSP
+ *
+ * Header-only so every parser inlines it. Bits are consumed from a
+ * 64-bit cache that is refilled a word at a time; Exp-Golomb codes are
+ * decoded with a count-leading-zeros step instead of a bit loop.
+ *
+ * Reads past the end of the buffer return 0 bits, matching the old
+ * bit-at-a-time readers.
+ */
+
+typedef struct {
+    const uint8_t *buffer;  /* Input buffer */
+    size_t size;            /* Buffer size in bytes */
+    size_t byte_pos;        /* Next byte to load into the cache */
+    uint64_t cache;         /* Unconsumed bits, MSB first */
+    int cache_bits;         /* Valid bits in cache (0-64) */
+} BitReader;
+
+/* Load a 64-bit big-endian word */
+static inline uint64_t bitreader_load_be64(const uint8_t *p) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return __builtin_bswap64(v);
+#else
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+#endif
+}
+
+/* Count leading zeros of a non-zero 64-bit value */
+static inline int bitreader_clz64(uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_clzll(v);
+#else
+    int n = 0;
+    while (!(v & 0x8000000000000000ull)) {
+        v <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* Initialize a bitreader with given buffer */
+static inline void bitreader_init(BitReader *br, const uint8_t *buffer, size_t size) {
+    br->buffer = buffer;
+    br->size = size;
+    br->byte_pos = 0;
+    br->cache = 0;
+    br->cache_bits = 0;
+}
+
+/* Top up the cache to at least 57 valid bits */
+static inline void bitreader_refill(BitReader *br) {
+    if (br->cache_bits > 56) {
+        return;
+    }
+
+    if (br->byte_pos + 8 <= br->size) {
+        /* Whole-word load; bits past the last whole byte are re-read later */
+        br->cache |= bitreader_load_be64(br->buffer + br->byte_pos) >> br->cache_bits;
+        int nbytes = (64 - br->cache_bits) >> 3;
+        br->byte_pos += nbytes;
+        br->cache_bits += nbytes * 8;
+        return;
+    }
+
+    /* Tail of the buffer: one byte at a time, zeros past the end */
+    while (br->cache_bits <= 56) {
+        uint64_t byte = br->byte_pos < br->size ? br->buffer[br->byte_pos] : 0;
+        br->cache |= byte << (56 - br->cache_bits);
+        br->byte_pos++;
+        br->cache_bits += 8;
+    }
+}
+
+/* Return the next n bits (1-32) without consuming them */
+static inline uint32_t bitreader_peek_bits(BitReader *br, int n) {
+    bitreader_refill(br);
+    return (uint32_t)(br->cache >> (64 - n));
+}
+
+/* Consume n bits (0-32) */
+static inline void bitreader_skip_bits(BitReader *br, int n) {
+    bitreader_refill(br);
+    br->cache <<= n;
+    br->cache_bits -= n;
+}
+
+/* Read n bits (0-32), MSB first */
+static inline uint32_t bitreader_read_bits(BitReader *br, int n) {
+    if (n == 0) {
+        return 0;
+    }
+    uint32_t value = bitreader_peek_bits(br, n);
+    br->cache <<= n;
+    br->cache_bits -= n;
+    return value;
+}
+
+/* Read a single bit */
+static inline int bitreader_read_bit(BitReader *br) {
+    return (int)bitreader_read_bits(br, 1);
+}
+
+/*
+ * Read unsigned Exp-Golomb coded value: ue(v)
+ *
+ * Codewords up to 55 bits (value < 2^27 - 1) are decoded straight from
+ * the cache. Longer or malformed codes fall back to the bitwise path,
+ * which caps the prefix at 32 zeros.
+ */
+static inline uint32_t bitreader_read_ue(BitReader *br) {
+    bitreader_refill(br);
+
+    int leading_zeros = br->cache ? bitreader_clz64(br->cache) : 64;
+    if (leading_zeros < 28) {
+        int len = 2 * leading_zeros + 1;
+        uint32_t code = (uint32_t)(br->cache >> (64 - len));
+        br->cache <<= len;
+        br->cache_bits -= len;
+        return code - 1;
+    }
+
+    leading_zeros = 0;
+    while (bitreader_read_bit(br) == 0 && leading_zeros < 32) {
+        leading_zeros++;
+    }
+    return (uint32_t)((1ull << leading_zeros) - 1 + bitreader_read_bits(br, leading_zeros));
+}
+
+/* Read signed Exp-Golomb coded value: se(v) */
+static inline int32_t bitreader_read_se(BitReader *br) {
+    uint32_t ue_val = bitreader_read_ue(br);
+
+    /* Decode: odd values are positive, even are negative */
+    if (ue_val & 1) {
+        return (int32_t)((ue_val + 1) / 2);
+    }
+    return -(int32_t)(ue_val / 2);
+}
+
+/* Get current bit position in stream */
+static inline size_t bitreader_get_bit_position(BitReader *br) {
+    size_t pos = br->byte_pos * 8 - br->cache_bits;
+    return pos < br->size * 8 ? pos : br->size * 8;  /* Stops at EOF */
+}
+
+/* Check if reader is byte-aligned */
+static inline int bitreader_is_byte_aligned(BitReader *br) {
+    return (br->cache_bits & 7) == 0;
+}
+
+/* Get remaining bytes (for extracting MB data) */
+static inline size_t bitreader_get_remaining_bytes(BitReader *br) {
+    size_t pos = bitreader_get_bit_position(br);
+    size_t byte = (pos + 7) / 8;   /* Skip a partially consumed byte */
+    return byte < br->size ? br->size - byte : 0;
+}
+
+/* Get pointer to current position (must be byte-aligned) */
+static inline const uint8_t *bitreader_get_pointer(BitReader *br) {
+    return br->buffer + bitreader_get_bit_position(br) / 8;
+}
+
+#endif /* BITREADER_H */
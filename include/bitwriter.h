@@ -8,23 +8,38 @@
  * BitWriter - Fast bitstream writer for H.264 NAL unit generation
  *
  * Supports:
- * - Arbitrary bit-aligned writes
+ * - Arbitrary bit-aligned writes, accumulated in a 64-bit cache and
+ *   stored to the buffer one big-endian word at a time
  * - Exp-Golomb coding (ue(v), se(v))
  * - RBSP trailing bits
+ * - Optional EBSP output: emulation prevention bytes inserted as bytes
+ *   are stored, so a NAL payload can be written straight to its
+ *   Annex-B destination
  * - Automatic buffer management
  */
 
 typedef struct {
     uint8_t *buffer;        /* Output buffer */
     size_t capacity;        /* Buffer capacity in bytes */
-    size_t byte_pos;        /* Current byte position */
-    int bit_pos;            /* Bits used in current byte (0-7, 0 = empty) */
-    uint8_t current_byte;   /* Byte being assembled */
+    size_t byte_pos;        /* Bytes stored to buffer */
+    uint64_t cache;         /* Pending bits, right-aligned */
+    int bits_left;          /* Free bits in cache (1-64, 64 = empty) */
+    int ebsp;               /* Insert emulation prevention bytes on store */
+    int zero_run;           /* Trailing 0x00 bytes stored (EBSP mode) */
+    size_t epb_count;       /* Emulation prevention bytes inserted */
 } BitWriter;
 
 /* Initialize a bitwriter with given buffer */
 void bitwriter_init(BitWriter *bw, uint8_t *buffer, size_t capacity);
 
+/*
+ * Initialize a bitwriter that stores EBSP: whenever 00 00 would be
+ * followed by a byte <= 0x03, a 0x03 is inserted first. Sizes returned
+ * by bitwriter_get_size() include the inserted bytes; bit positions
+ * still count RBSP bits only.
+ */
+void bitwriter_init_ebsp(BitWriter *bw, uint8_t *buffer, size_t capacity);
+
 /* Write n bits (1-32) from value (MSB first) */
 void bitwriter_write_bits(BitWriter *bw, uint32_t value, int n);
 
@@ -37,6 +52,14 @@ void bitwriter_write_ue(BitWriter *bw, uint32_t value);
 /* Write signed Exp-Golomb coded value: se(v) */
 void bitwriter_write_se(BitWriter *bw, int32_t value);
 
+/*
+ * Copy num_bits bits starting at bit offset start_bit of src (src_size
+ * bytes) to the stream. Works at any source and destination alignment;
+ * moves 64 bits per step, or uses memcpy when both sides are byte-aligned.
+ */
+void bitwriter_copy_bits(BitWriter *bw, const uint8_t *src, size_t src_size,
+                         size_t start_bit, size_t num_bits);
+
 /* Write RBSP trailing bits (1 bit '1' followed by '0's to byte-align) */
 void bitwriter_write_trailing_bits(BitWriter *bw);
 
@@ -52,42 +75,4 @@ size_t bitwriter_get_bit_position(BitWriter *bw);
 /* Check if writer is byte-aligned */
 int bitwriter_is_byte_aligned(BitWriter *bw);
 
-/*
- * BitReader - Bitstream reader for parsing H.264 slice headers
- */
-
-typedef struct {
-    const uint8_t *buffer;  /* Input buffer */
-    size_t size;            /* Buffer size in bytes */
-    size_t byte_pos;        /* Current byte position */
-    int bit_pos;            /* Bits consumed in current byte (0-7) */
-} BitReader;
-
-/* Initialize a bitreader with given buffer */
-void bitreader_init(BitReader *br, const uint8_t *buffer, size_t size);
-
-/* Read n bits (1-32), MSB first */
-uint32_t bitreader_read_bits(BitReader *br, int n);
-
-/* Read a single bit */
-int bitreader_read_bit(BitReader *br);
-
-/* Read unsigned Exp-Golomb coded value: ue(v) */
-uint32_t bitreader_read_ue(BitReader *br);
-
-/* Read signed Exp-Golomb coded value: se(v) */
-int32_t bitreader_read_se(BitReader *br);
-
-/* Get current bit position in stream */
-size_t bitreader_get_bit_position(BitReader *br);
-
-/* Check if reader is byte-aligned */
-int bitreader_is_byte_aligned(BitReader *br);
-
-/* Get remaining bytes (for extracting MB data) */
-size_t bitreader_get_remaining_bytes(BitReader *br);
-
-/* Get pointer to current position (must be byte-aligned) */
-const uint8_t *bitreader_get_pointer(BitReader *br);
-
 #endif /* BITWRITER_H */
@@ -0,0 +1,91 @@
+#ifndef CLIP_LIBRARY_H
+#define CLIP_LIBRARY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "frame_cache.h"
+
+/*
+ * Pre-rendered Scroll Clip Library
+ *
+ * For a fixed atlas the MB layer of every scroll offset can be generated
+ * once, offline, and stored in an indexed file. At runtime the file is
+ * mapped read-only (so many composers share one copy) and a frame costs
+ * a slice header plus a copy of the stored payload.
+ *
+ * Entries use the payload cache key, so a lookup only hits when the
+ * offset, reference list and motion field all match what the frame
+ * would have generated.
+ *
+ * File layout (host byte order, checked through byte_order):
+ *   ClipLibraryHeader
+ *   ClipLibraryEntry[num_entries], sorted by key
+ *   payload bits, each entry byte-padded
+ */
+
+#define CLIP_LIBRARY_MAGIC      "H264CLIB"
+#define CLIP_LIBRARY_VERSION    2   /* 2: offsets in quarter pixels */
+#define CLIP_LIBRARY_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t width;         /* Frame size the payloads were built for */
+    uint32_t height;
+    uint32_t num_entries;
+    uint32_t reserved;
+} ClipLibraryHeader;
+
+typedef struct {
+    int32_t offset_qpel;
+    uint32_t reserved;
+    uint64_t ref_set;
+    uint64_t mv_hash;
+    uint64_t data_offset;   /* From start of payload area */
+    uint64_t num_bits;
+} ClipLibraryEntry;
+
+typedef struct {
+    const uint8_t *map;
+    size_t map_size;
+    const ClipLibraryHeader *header;
+    const ClipLibraryEntry *entries;
+    const uint8_t *payload;
+    size_t payload_size;
+
+    /* Statistics */
+    uint64_t lookups;
+    uint64_t hits;
+} ClipLibrary;
+
+/*
+ * Write a library file
+ *
+ * entries need not be sorted; data_offset refers into data.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int clip_library_write(const char *path, int width, int height,
+                       ClipLibraryEntry *entries, uint32_t num_entries,
+                       const uint8_t *data, size_t data_size);
+
+/*
+ * Map a library file and validate it against the frame size
+ *
+ * Returns 0 on success, -1 on error
+ */
+int clip_library_open(ClipLibrary *lib, const char *path, int width, int height);
+
+/* Unmap library */
+void clip_library_close(ClipLibrary *lib);
+
+/*
+ * Find the payload for a key
+ *
+ * Returns pointer to the payload bits (num_bits set), or NULL if absent
+ */
+const uint8_t *clip_library_find(ClipLibrary *lib, const FrameCacheKey *key,
+                                 size_t *num_bits);
+
+#endif /* CLIP_LIBRARY_H */
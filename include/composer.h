@@ -5,6 +5,8 @@
 #include <stddef.h>
 #include "h264_writer.h"
 #include "nal.h"
+#include "region_hints.h"
+#include "splicer.h"
 
 /*
  * Composer v0.1 - UI-Aware Hybrid H.264 Encoder
@@ -18,6 +20,10 @@
  *   2. Call composer_write_header() to output SPS + PPS + I-frames
  *   3. Call composer_write_scroll_frame() for each P-frame
  *   4. Call composer_finish() to clean up
+ *
+ * Output is kept in memory for composer_write_to_file() unless
+ * composer_open_output() is called after init, which streams each
+ * access unit to a file as soon as it is complete.
  */
 
 typedef struct {
@@ -25,6 +31,9 @@ typedef struct {
     ComposerConfig cfg;         /* H.264 encoding config */
     ComposerConfig parse_cfg;   /* Config for parsing external encoder's headers */
 
+    /* Reference RBSP buffer; the pointers below all point into it */
+    uint8_t *ref_rbsp;
+
     /* Parsed reference frames */
     uint8_t *ref_a_rbsp;        /* RefA IDR RBSP data */
     size_t ref_a_size;
@@ -44,8 +53,34 @@ typedef struct {
     uint8_t *rbsp_temp;
     size_t rbsp_capacity;
 
+    /* Streaming output (composer_open_output), -1 when buffering */
+    int output_fd;
+    const char *output_path;
+    int output_error;
+
+    /* Generated P-slice payloads, reused when motion repeats */
+    FrameCache frame_cache;
+
+    /* Optional pre-rendered payloads (mapped file) */
+    ClipLibrary clip_library;
+
+    /* Threads encoding the slices of a P-frame (when cfg.slice_pool is set) */
+    WorkerPool slice_pool;
+
+    /* Per-frame working memory, sized for the frame and slice layout */
+    uint8_t *scratch_buffer;
+    ScratchArena scratch;
+
+    /* MB classification and row bits of the last hinted frame */
+    MBMap mb_map;
+    RowCache row_cache;
+
+    /* Dynamic encoder's pictures for spliced frames */
+    Splicer splicer;
+
     /* Frame tracking */
     int frames_written;
+    int warned_scroll_range;
 } Composer;
 
 /*
@@ -54,6 +89,9 @@ typedef struct {
  * ref_a_path: Path to first reference I-frame (H.264 file with single IDR)
  * ref_b_path: Path to second reference I-frame
  *
+ * Either path may be a pipe or FIFO (e.g. /dev/stdin). A pipe is read only
+ * until its first SPS, PPS and IDR slice are complete.
+ *
  * Returns 0 on success, -1 on error
  */
 int composer_init(Composer *c, const char *ref_a_path, const char *ref_b_path);
@@ -67,9 +105,12 @@ int composer_get_height(Composer *c);
 /*
  * Write stream header (SPS + PPS + rewritten I-frames)
  *
- * Must be called before any P-frames
+ * Must be called before any P-frames. Unless composer_open_output() was
+ * called, this allocates the buffer holding the whole output.
+ *
+ * Returns 0 on success, -1 on allocation failure
  */
-void composer_write_header(Composer *c);
+int composer_write_header(Composer *c);
 
 /*
  * Write a scroll P-frame at the given offset
@@ -79,7 +120,93 @@ void composer_write_header(Composer *c);
 void composer_write_scroll_frame(Composer *c, int offset_px);
 
 /*
- * Get current output size in bytes
+ * Write a scroll P-frame at a sub-pixel offset
+ *
+ * offset_qpel: Scroll offset in quarter pixels (0 = full A, 4 * height =
+ *              full B). The frame uses quarter-pel motion vectors, so slow
+ *              or decelerating scrolls move smoothly without new I-frames.
+ *
+ * Any waypoint frames the offset needs are written first. Once no
+ * waypoint is left, offsets more than MV_LIMIT_PX past the last one are
+ * clamped to MV_LIMIT_PX past it, with a warning.
+ */
+void composer_write_scroll_frame_qpel(Composer *c, int offset_qpel);
+
+/*
+ * Write a P-frame from a per-MB motion field (see h264_write_motion_p_frame())
+ *
+ * field: (width / 16) * (height / 16) entries in raster order
+ * marking: FRAME_MARK_LONG_TERM keeps the frame as the next long-term
+ *          reference, the waypoint for offset_qpel
+ *
+ * Returns 0 on success, -1 if a ref_idx or MV is out of range, or a
+ * long-term frame's offset_qpel is outside 0..height * 4 or no long-term
+ * reference is left
+ */
+int composer_write_motion_frame(Composer *c, const MBMotion *field,
+                                FrameMarking marking, int offset_qpel);
+
+/*
+ * Write a P-frame composed from region hints
+ *
+ * c->mb_map is updated from the previous hinted frame's hints, so only
+ * the MB rows that changed regions touch are re-derived, and only those
+ * rows (and the rows below them) are re-encoded. Dynamic MBs are coded
+ * static (A unmoved) here; their content is up to the dynamic encoder.
+ *
+ * Returns 0 on success, -1 if a region's ref_idx or MV is out of range
+ */
+int composer_write_hinted_frame(Composer *c, const RegionHints *hints);
+
+/*
+ * Write a hinted frame whose dynamic MBs show the dynamic encoder's
+ * picture (see splicer.h)
+ *
+ * au: Annex-B access unit of the dynamic encoder: the slices of one
+ *     picture coding exactly the dynamic MB rectangle, preceded by its
+ *     SPS and PPS when they are new
+ *
+ * The frame is written either way. If the picture cannot be spliced its
+ * rectangle is coded static, and P pictures are refused until the
+ * dynamic encoder sends an I picture.
+ *
+ * Returns 0 on success, -1 if a region is out of range or the picture
+ * was not spliced
+ */
+int composer_write_spliced_frame(Composer *c, const RegionHints *hints,
+                                 const uint8_t *au, size_t au_size);
+
+/*
+ * Write a P-frame in which bands of MB rows scroll horizontally over a
+ * page scrolled to offset_qpel (see h264_write_carousel_p_frame())
+ *
+ * Each band shows its rows of A moving left by offset_x_qpel, with the
+ * same rows of B coming in from the right, so carousel animations need
+ * no conventional encode.
+ *
+ * Returns 0 on success, -1 if a band is outside the frame or its MVs
+ * exceed the hardware limits
+ */
+int composer_write_carousel_frame(Composer *c, int offset_qpel,
+                                  const ScrollBand *bands, int num_bands);
+
+/*
+ * Write scroll P-frames for a run of offsets using num_threads workers
+ *
+ * Waypoints are decided up front in offset order, then frames are
+ * encoded concurrently and appended in order; the output is identical
+ * to calling composer_write_scroll_frame_qpel() for each offset. Workers
+ * do not use the payload cache. num_threads <= 1 writes serially.
+ *
+ * offsets_qpel: Scroll offsets in quarter pixels
+ *
+ * Returns 0 on success, -1 on error
+ */
+int composer_write_scroll_frames(Composer *c, const int *offsets_qpel, int count,
+                                 int num_threads);
+
+/*
+ * Get current output size in bytes (when streaming: bytes not yet written)
  */
 size_t composer_get_output_size(Composer *c);
 
@@ -89,12 +216,77 @@ size_t composer_get_output_size(Composer *c);
 uint8_t *composer_get_output(Composer *c);
 
 /*
- * Write output to file
+ * Write buffered output to file (not available when streaming)
  *
  * Returns 0 on success, -1 on error
  */
 int composer_write_to_file(Composer *c, const char *path);
 
+/*
+ * Stream output to path (a regular file or a FIFO) instead of buffering
+ *
+ * Call after composer_init() and before composer_write_header(). Every
+ * access unit is written as soon as it is complete from the buffer
+ * composer_init() sized for one frame, so memory use does not grow with
+ * the stream length.
+ * Write errors are reported once and returned by composer_close_output().
+ *
+ * Returns 0 on success, -1 on error
+ */
+int composer_open_output(Composer *c, const char *path);
+
+/*
+ * Write any remaining output and close the stream
+ *
+ * Returns 0 on success, -1 if any write failed
+ */
+int composer_close_output(Composer *c);
+
+/*
+ * Pre-render the scroll payload of every whole-pixel offset 0..height and
+ * write them to a clip library file
+ *
+ * Each offset is rendered against every reference set a scroll can have
+ * there: A and B plus the first k waypoints, for each k that reaches the
+ * offset without another waypoint. Waypoint frames are included too, so
+ * scrolls at whole-pixel offsets are served entirely from the library.
+ * Waypoints made by composer_write_motion_frame() are not covered.
+ *
+ * Call right after composer_init(), before any frames are written.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int composer_build_clip_library(Composer *c, const char *path);
+
+/*
+ * Map a clip library and serve matching frames from it
+ *
+ * Returns 0 on success, -1 on error
+ */
+int composer_load_clip_library(Composer *c, const char *path);
+
+/*
+ * Split every P-frame into num_slices slices on MB-row boundaries and
+ * encode them concurrently, one per thread (including the caller)
+ *
+ * Call before writing P-frames. Clip libraries hold whole-frame payloads,
+ * so they only serve single-slice output.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int composer_set_slices(Composer *c, int num_slices);
+
+/*
+ * Print clip library, payload cache and scratch arena counters
+ */
+void composer_print_stats(Composer *c);
+
+/*
+ * Heap allocations made while writing P-frames: scratch arena fallbacks
+ * plus payload cache buffers. Stays flat once the cache is warm.
+ */
+uint64_t composer_get_frame_allocations(Composer *c);
+
 /*
  * Clean up resources
  */
@@ -0,0 +1,87 @@
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * P-slice Payload Cache
+ *
+ * Scrolling keeps returning to the same offsets (the bounce animation in
+ * main.c does so every cycle). The macroblock layer of a P-slice depends
+ * only on the motion field and the reference list it indexes, so it can
+ * be generated once and replayed after a freshly written slice header.
+ *
+ * Entries hold the MB layer as raw RBSP bits. The cache is bounded; the
+ * least recently used entry is replaced when it is full. A replaced
+ * entry's buffer is reused when the new payload fits, so a warm cache
+ * stops allocating.
+ */
+
+/* Default number of cached payloads */
+#define FRAME_CACHE_DEFAULT_ENTRIES 256
+
+typedef struct {
+    int offset_qpel;        /* Scroll offset the payload was built for (1/4 px) */
+    uint64_t ref_set;       /* Hash of the active reference list */
+    uint64_t mv_hash;       /* Hash of the motion field */
+} FrameCacheKey;
+
+typedef struct {
+    FrameCacheKey key;
+    uint8_t *bits;          /* MB layer bits, MSB first */
+    size_t capacity;        /* Bytes allocated at bits */
+    size_t num_bits;
+    uint64_t last_used;
+    int valid;
+} FrameCacheEntry;
+
+typedef struct {
+    FrameCacheEntry *entries;
+    int num_entries;
+    uint64_t clock;         /* Lookup counter for LRU */
+
+    /* Statistics */
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t evictions;
+    uint64_t mbs_reused;    /* Macroblocks served from cache */
+    uint64_t allocations;   /* Payload buffers allocated */
+} FrameCache;
+
+/*
+ * Initialize cache with room for num_entries payloads
+ *
+ * Returns 0 on success, -1 on allocation failure
+ */
+int frame_cache_init(FrameCache *fc, int num_entries);
+
+/* Free all cached payloads */
+void frame_cache_free(FrameCache *fc);
+
+/*
+ * 64-bit FNV-1a hash, chainable: pass FRAME_CACHE_HASH_INIT or the
+ * previous result as seed
+ */
+#define FRAME_CACHE_HASH_INIT 0xcbf29ce484222325ULL
+uint64_t frame_cache_hash(uint64_t seed, const void *data, size_t size);
+
+/*
+ * Look up a payload
+ *
+ * Returns the entry on a hit (valid until the next insert), NULL on a miss
+ */
+const FrameCacheEntry *frame_cache_lookup(FrameCache *fc, const FrameCacheKey *key);
+
+/*
+ * Store a payload of num_bits bits from bits (copied)
+ *
+ * Returns 0 on success, -1 on allocation failure (cache unchanged)
+ */
+int frame_cache_insert(FrameCache *fc, const FrameCacheKey *key,
+                       const uint8_t *bits, size_t num_bits);
+
+/* Print hit-rate counters */
+void frame_cache_print_stats(const FrameCache *fc);
+
+#endif /* FRAME_CACHE_H */
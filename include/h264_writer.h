@@ -5,6 +5,10 @@
 #include <stddef.h>
 #include "bitwriter.h"
 #include "nal.h"
+#include "frame_cache.h"
+#include "clip_library.h"
+#include "worker_pool.h"
+#include "scratch_arena.h"
 
 /*
  * H.264 Writer Module for Composer v0.1
@@ -13,6 +17,8 @@
  * - SPS/PPS generation (minimal Baseline profile)
  * - I-frame rewriting with long-term reference marking
  * - P-frame generation with motion vectors for scrolling
+ * - P-frame generation from an arbitrary per-MB motion field
+ * - P-frames carrying a dynamic encoder's pictures (splicer.h)
  */
 
 /* Slice types (H.264 Table 7-6) */
@@ -23,16 +29,84 @@
 /* Hardware MV limit: 496 pixels (safely under 512 for NVDEC) */
 #define MV_LIMIT_PX 496
 
+/* Horizontal MV limit: [-2048, 2047.75] pixels at every level (Table A-1) */
+#define MV_LIMIT_X_PX 2048
+
 /* Maximum number of waypoint references (for extended scroll range) */
 #define MAX_WAYPOINTS 8
 
+/* Long-term index of the dynamic encoder's reference picture */
+#define DYNAMIC_LONG_TERM_IDX (2 + MAX_WAYPOINTS)
+
+/* PPS of spliced frames: the dynamic encoder's intra and chroma QP settings */
+#define SPLICED_PPS_ID 1
+
 /* Waypoint info for intermediate reference frames */
 typedef struct {
-    int offset_px;          /* Scroll offset in pixels where created */
+    int offset_qpel;        /* Scroll offset where created (quarter pixels) */
     int long_term_idx;      /* Long-term frame index (2, 3, ...) */
     int valid;              /* Whether this waypoint is active */
 } WaypointInfo;
 
+/* Writer internals a RowCache holds */
+typedef struct MVInfo MVInfo;
+typedef struct RowTemplate RowTemplate;
+typedef struct Splicer Splicer;
+
+/*
+ * MB layer bits of the last incremental frame, one slot per MB row
+ *
+ * A row's bits depend only on its motion, the motion of the row above
+ * and the reference list, so a row whose motion and whose upper
+ * neighbour are unchanged is copied instead of encoded.
+ */
+typedef struct {
+    int mb_width;
+    int mb_height;
+    int valid;              /* Slots hold a frame with the layout below */
+    int num_refs;
+    int num_slices;
+    int splice_y0;          /* Rows of the dynamic picture, when splice_y1 > 0 */
+    int splice_y1;
+    RowTemplate *rows;      /* Bits of each MB row */
+    uint8_t *storage;
+    MVInfo *resolved;       /* Motion of every MB, P_Skip inference included */
+    MVInfo *row_motion;     /* Motion of the row being encoded */
+
+    /* Statistics */
+    uint64_t rows_encoded;
+    uint64_t rows_reused;
+} RowCache;
+
+/* Motion of one macroblock (quarter-pel MVs) */
+typedef struct {
+    int ref_idx;            /* 0 = A, 1 = B, 2.. = long-term refs in marking
+                               order (waypoints), or MB_REF_SKIP */
+    int mv_x, mv_y;
+} MBMotion;
+
+/* ref_idx of an MB that takes whatever P_Skip infers from its neighbours */
+#define MB_REF_SKIP (-1)
+
+/* An MB showing A unmoved; coded as P_Skip wherever the neighbours allow */
+#define MB_MOTION_STATIC ((MBMotion){0, 0, 0})
+
+/* Reference marking of a P-frame written from a motion field */
+typedef enum {
+    FRAME_MARK_NONE = 0,    /* Shown only (nal_ref_idc 0) */
+    FRAME_MARK_LONG_TERM    /* Kept as the next long-term reference, at
+                               ref_idx 2 + num_waypoints of later frames */
+} FrameMarking;
+
+/* Band of MB rows scrolling horizontally, e.g. a carousel of thumbnails */
+typedef struct {
+    int first_row;          /* First MB row of the band */
+    int num_rows;           /* MB rows in the band */
+    int offset_x_qpel;      /* Horizontal scroll in quarter pixels (0 = band as
+                               in A, 4 * width = band as in B) */
+    int offset_y_qpel;      /* Vertical displacement of the band in A and B */
+} ScrollBand;
+
 /* Encoder configuration */
 typedef struct {
     int width;              /* Frame width in pixels (multiple of 16) */
@@ -56,6 +130,25 @@ typedef struct {
     /* Waypoint support */
     WaypointInfo waypoints[MAX_WAYPOINTS];
     int num_waypoints;
+
+    /* Optional P-slice payload cache (NULL = always generate) */
+    FrameCache *frame_cache;
+
+    /* Optional pre-rendered payloads, consulted before the cache */
+    ClipLibrary *clip_library;
+
+    /* Slices per P-frame, split on MB-row boundaries (default 1) */
+    int num_slices;
+
+    /* Optional threads to encode a frame's slices on (NULL = serial) */
+    WorkerPool *slice_pool;
+
+    /* Optional per-frame working memory, reset after every frame
+     * (NULL = allocate from the heap on each call) */
+    ScratchArena *scratch;
+
+    /* A spliced frame holds DYNAMIC_LONG_TERM_IDX */
+    int dynamic_ref;
 } ComposerConfig;
 
 /*
@@ -90,6 +183,14 @@ size_t h264_generate_sps(uint8_t *rbsp, size_t capacity, int width, int height);
  */
 size_t h264_generate_pps(uint8_t *rbsp, size_t capacity);
 
+/*
+ * Generate PPS SPLICED_PPS_ID for spliced frames, with the dynamic
+ * encoder's constrained_intra_pred_flag and chroma_qp_index_offset
+ * Returns RBSP size
+ */
+size_t h264_generate_spliced_pps(uint8_t *rbsp, size_t capacity,
+                                 int constrained_intra_pred_flag, int chroma_qp_index_offset);
+
 /*
  * Rewrite externally-encoded IDR frame with long-term reference flag
  *
@@ -111,27 +212,162 @@ size_t h264_rewrite_as_non_idr_i_frame(NALWriter *nw, ComposerConfig *write_cfg,
                                         const uint8_t *rbsp, size_t rbsp_size,
                                         int frame_num);
 
+/*
+ * Scratch bytes one frame takes, so that a cfg->scratch arena of this
+ * size serves every frame without heap allocations. Depends on the frame
+ * size and cfg->num_slices.
+ */
+size_t h264_frame_scratch_size(const ComposerConfig *cfg);
+
 /*
  * Write a P-frame with scroll motion vectors
  *
- * offset_px: Scroll offset in pixels (0 = show all of A, height = show all of B)
+ * offset_qpel: Scroll offset in quarter pixels (0 = show all of A,
+ *              4 * height = show all of B)
+ *
+ * Composition (MVs in quarter pixels, so fractional offsets scroll
+ * smoothly through the decoder's sub-pixel interpolation):
+ *   - A region (mb_y < boundary): ref=0, mv_y = offset_qpel
+ *   - B region (mb_y >= boundary): ref=1, mv_y = offset_qpel - 4 * height
+ *   - boundary = (4 * height - offset_qpel) / 64
+ *
+ * With cfg->num_slices > 1 the frame is written as that many slice NAL
+ * units covering equal bands of MB rows. Prediction restarts at each
+ * slice, so slices are encoded independently (on cfg->slice_pool if set).
+ */
+size_t h264_write_scroll_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_qpel);
+
+/*
+ * Write a P-frame from a per-MB motion field
+ *
+ * field: mb_width * mb_height entries in raster order. Every ref_idx is
+ *        MB_REF_SKIP or below 2 + cfg->num_waypoints, and MVs are within
+ *        MV_LIMIT_X_PX / MV_LIMIT_PX.
+ * marking: FRAME_MARK_LONG_TERM needs cfg->num_waypoints < MAX_WAYPOINTS
+ * offset_qpel: Scroll offset the frame shows. A long-term frame is
+ *              registered as the waypoint for it, quarter pixels kept, so
+ *              later scroll frames predict from it; otherwise it only
+ *              labels the frame.
+ *
+ * MV prediction, P_Skip and skip runs, slices and entropy coding are
+ * handled as for the scroll frames.
+ */
+size_t h264_write_motion_p_frame(NALWriter *nw, ComposerConfig *cfg, const MBMotion *field,
+                                 FrameMarking marking, int offset_qpel);
+
+/*
+ * Allocate a row cache for frames of mb_width x mb_height MBs
+ *
+ * Returns 0 on success, -1 on allocation failure
+ */
+int row_cache_init(RowCache *rc, int mb_width, int mb_height);
+
+void row_cache_free(RowCache *rc);
+
+/*
+ * h264_write_motion_p_frame() for a field that changed only in some rows
+ *
+ * rc: Rows of the last frame written through it
+ * dirty_rows: Nonzero for each MB row whose motion may differ from that
+ *             frame (NULL: every row)
+ *
+ * Rows are re-encoded when they or the row above are dirty, or when the
+ * reference list or slice layout changed; the rest are copied from rc.
+ * Slices are written serially and bypass the payload cache.
+ */
+size_t h264_write_incremental_p_frame(NALWriter *nw, ComposerConfig *cfg, RowCache *rc,
+                                      const MBMotion *field, const uint8_t *dirty_rows,
+                                      FrameMarking marking, int offset_qpel);
+
+/*
+ * h264_write_incremental_p_frame() with the dynamic picture loaded into sp
+ * in place of its MB rows sp->y0..
+ *
+ * The composer's rows above and below form one slice each. The dynamic
+ * rows are the picture's own slices when sp->passthrough, otherwise one
+ * slice merging them with the composer's MBs beside the rectangle. Every
+ * slice refers to PPS SPLICED_PPS_ID, which must have been sent.
+ *
+ * A reference picture is marked DYNAMIC_LONG_TERM_IDX, and P pictures
+ * predict from that, so cfg->dynamic_ref must be set for them.
+ */
+size_t h264_write_spliced_p_frame(NALWriter *nw, ComposerConfig *cfg, RowCache *rc,
+                                  const MBMotion *field, const uint8_t *dirty_rows,
+                                  Splicer *sp);
+
+/*
+ * Write a P-frame with horizontally scrolling row bands over a page
+ *
+ * offset_qpel: Vertical scroll of the page, as for h264_write_scroll_p_frame
+ *              (0 for a still page); rows outside every band follow it
+ *
+ * Band rows compose A and B side by side, as the scroll frame does top
+ * to bottom (MVs in quarter pixels):
+ *   - A columns (mb_x < boundary): ref=0, mv = (offset_x_qpel, offset_y_qpel)
+ *   - B columns (mb_x >= boundary): ref=1,
+ *                                   mv = (offset_x_qpel - 4 * width, offset_y_qpel)
+ *   - boundary = (4 * width - offset_x_qpel) / 64
  *
- * Composition:
- *   - A region (mb_y < boundary): ref=0, mv_y = offset_px
- *   - B region (mb_y >= boundary): ref=1, mv_y = offset_px - height
- *   - boundary = (height - offset_px) / 16
+ * Later bands win where bands overlap. The caller keeps band MVs within
+ * MV_LIMIT_X_PX horizontally and MV_LIMIT_PX vertically.
  */
-size_t h264_write_scroll_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_px);
+size_t h264_write_carousel_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_qpel,
+                                   const ScrollBand *bands, int num_bands);
 
 /*
- * Check if a waypoint is needed at the given scroll offset
+ * Bytes needed by h264_render_scroll_payload
+ */
+size_t h264_scroll_payload_capacity(const ComposerConfig *cfg);
+
+/*
+ * Render the MB layer h264_write_scroll_p_frame would write for offset_qpel
+ * with the current reference set, without a slice header, as one slice
+ *
+ * key: Set to the payload's cache / clip library key
+ *
+ * Returns payload size in bits (buf is byte-padded)
+ */
+size_t h264_render_scroll_payload(const ComposerConfig *cfg, int offset_qpel,
+                                  uint8_t *buf, size_t capacity, FrameCacheKey *key);
+
+/*
+ * Check if a waypoint is needed before a frame at offset_qpel (quarter
+ * pixels)
+ *
+ * A scroll frame predicts its A region from the closest reference at or
+ * above its offset, A or a waypoint. Once that is MV_LIMIT_PX away, the
+ * next waypoint goes MV_LIMIT_PX past it, moved back to where the A/B
+ * boundary falls on an MB edge. At other offsets the boundary MB row
+ * holds samples predicted from outside B, which every frame predicting
+ * from the waypoint would copy. A jump may need several waypoints; call
+ * again after writing each.
+ *
+ * waypoint_qpel: Set to the waypoint's offset when one is needed
+ *
  * Returns 1 if waypoint needed, 0 otherwise
  */
-int h264_needs_waypoint(ComposerConfig *cfg, int offset_px);
+int h264_needs_waypoint(const ComposerConfig *cfg, int offset_qpel, int *waypoint_qpel);
+
+/*
+ * Limit offset_qpel to the offsets the current references reach within
+ * MV_LIMIT_PX, for when no waypoint is left to make
+ *
+ * Returns the offset to write (quarter pixels)
+ */
+int h264_clamp_scroll_offset(const ComposerConfig *cfg, int offset_qpel);
 
 /*
  * Write a waypoint P-frame (intermediate reference for extended scroll)
  */
-size_t h264_write_waypoint_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_px);
+size_t h264_write_waypoint_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_qpel);
+
+/*
+ * Apply the state change of writing a frame without writing it:
+ * frame_num advances, and a waypoint frame registers its waypoint.
+ *
+ * Lets a caller plan a run of frames up front and encode them from
+ * per-frame copies of cfg.
+ */
+void h264_advance_frame_state(ComposerConfig *cfg, int offset_qpel, int is_waypoint);
 
 #endif /* H264_WRITER_H */
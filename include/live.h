@@ -0,0 +1,78 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <stdint.h>
+#include "composer.h"
+
+/*
+ * Live Mode
+ *
+ * Drives the composer from a stream of per-frame commands instead of a
+ * canned animation, e.g. from the UI renderer. Each command is one text
+ * line; the frame it describes is written to the output sink as soon as
+ * the line has been read.
+ *
+ * Command format (pixel values may be fractional, e.g. 12.25, and are
+ * rounded to the nearest quarter pixel):
+ *   <offset_px>     Scroll P-frame at this offset (clamped to 0..height)
+ *   region X Y W H REF DX DY [Z]
+ *                   Motion region for the next hinted frame: rectangle
+ *                   X Y W H shows reference REF displaced by DX DY
+ *                   (the MV, pixels), stacked by Z (default 0)
+ *   dynamic X Y W H [MARGIN]
+ *                   Dynamic rectangle for the next hinted frame
+ *   splice N        The N bytes after this line's newline are the dynamic
+ *                   encoder's Annex-B access unit for the next hinted
+ *                   frame, which then shows it in the dynamic rectangle
+ *                   (composer_write_spliced_frame())
+ *   frame           Hinted P-frame from the regions given since the last
+ *                   frame command
+ *   # ...           Comment, ignored
+ *
+ * Latency is measured per frame from the read that returned the line
+ * (for hinted frames, the frame line) to the frame's NAL units being
+ * handed to the output sink.
+ */
+
+/* Longest accepted command line */
+#define LIVE_LINE_MAX 4096
+
+/* Most tokens in a command line */
+#define LIVE_MAX_TOKENS 9
+
+/* Largest dynamic access unit a splice command carries */
+#define LIVE_SPLICE_MAX (4 * 1024 * 1024)
+
+typedef struct {
+    uint64_t frames;
+    uint64_t rejected;      /* Malformed command lines */
+    uint64_t latency_min_ns;
+    uint64_t latency_max_ns;
+    uint64_t latency_sum_ns;
+    uint64_t latency_last_ns;
+} LiveStats;
+
+/*
+ * Listen on a Unix stream socket at path and wait for one client
+ *
+ * Any existing file at path is replaced; the socket file is removed
+ * again once the client is connected.
+ *
+ * Returns the connected descriptor, or -1 on error
+ */
+int live_accept_socket(const char *path);
+
+/*
+ * Write a frame for every command read from fd until end of input
+ *
+ * The composer's header must already be written. Progress and latency
+ * are printed every 50 frames.
+ *
+ * Returns 0 on success, -1 on read error
+ */
+int live_run(Composer *c, int fd, LiveStats *stats);
+
+/* Print frame count and latency summary */
+void live_print_stats(const LiveStats *stats);
+
+#endif /* LIVE_H */
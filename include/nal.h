@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "bitwriter.h"
 
 /*
  * NAL Unit Types (H.264 Table 7-1)
@@ -22,6 +23,13 @@
 #define NAL_REF_IDC_HIGH        2   /* High importance reference */
 #define NAL_REF_IDC_HIGHEST     3   /* Highest importance (IDR, SPS, PPS) */
 
+/*
+ * Output sink: receives completed Annex-B data in stream order
+ *
+ * Returns 0 on success, -1 on error
+ */
+typedef int (*NALSinkFn)(void *opaque, const uint8_t *data, size_t size);
+
 /*
  * NAL Writer context for building Annex-B NAL units
  */
@@ -32,12 +40,37 @@ typedef struct {
 
     uint8_t *rbsp;          /* Temporary buffer for RBSP */
     size_t rbsp_capacity;
+
+    size_t unit_start;      /* Start of the NAL unit opened by nal_begin_unit */
+
+    /* Optional sink the output buffer is drained to (NULL = keep all output) */
+    NALSinkFn sink;
+    void *sink_opaque;
+    size_t flushed;         /* Bytes handed to the sink so far */
 } NALWriter;
 
 /* Initialize NAL writer with output buffer and temp RBSP buffer */
 void nal_writer_init(NALWriter *nw, uint8_t *output, size_t output_capacity,
                      uint8_t *rbsp_temp, size_t rbsp_capacity);
 
+/*
+ * Drain output to sink on every nal_writer_flush()
+ *
+ * The output buffer then only has to hold the data written between two
+ * flushes, e.g. one access unit.
+ */
+void nal_writer_set_sink(NALWriter *nw, NALSinkFn sink, void *opaque);
+
+/*
+ * Hand buffered output to the sink and reuse the buffer
+ *
+ * No-op without a sink. Must not be called while a unit opened by
+ * nal_begin_unit() is in progress.
+ *
+ * Returns 0 on success, -1 if the sink failed (the data is dropped)
+ */
+int nal_writer_flush(NALWriter *nw);
+
 /*
  * Write a complete NAL unit to output in Annex-B format:
  * [start code][nal header][EBSP payload]
@@ -57,9 +90,37 @@ size_t nal_write_unit(NALWriter *nw, int nal_ref_idc, int nal_type,
                       const uint8_t *rbsp, size_t rbsp_size,
                       int use_long_startcode);
 
-/* Get current output position */
+/*
+ * Start a NAL unit whose payload is written straight into the output as
+ * EBSP, with no intermediate RBSP buffer or second conversion pass.
+ *
+ * Writes the start code and NAL header, then initializes bw to write
+ * the payload after them with emulation prevention enabled. Write the
+ * payload (including trailing bits) through bw, then call
+ * nal_end_unit(). No other NALWriter call may be made in between.
+ */
+void nal_begin_unit(NALWriter *nw, BitWriter *bw, int nal_ref_idc, int nal_type,
+                    int use_long_startcode);
+
+/*
+ * Finish the NAL unit opened by nal_begin_unit()
+ *
+ * Returns: Number of bytes written to output for the whole unit
+ */
+size_t nal_end_unit(NALWriter *nw, BitWriter *bw);
+
+/* Get current output position (bytes not yet flushed to a sink) */
 size_t nal_writer_get_size(NALWriter *nw);
 
+/* Get total bytes written, including those already flushed */
+size_t nal_writer_get_total(NALWriter *nw);
+
+/*
+ * Append already encoded Annex-B data (e.g. a frame built with its own
+ * NALWriter) to the output
+ */
+void nal_writer_append(NALWriter *nw, const uint8_t *data, size_t size);
+
 /* Get pointer to output buffer */
 uint8_t *nal_writer_get_output(NALWriter *nw);
 
@@ -0,0 +1,88 @@
+#ifndef NAL_INDEX_H
+#define NAL_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "nal_parser.h"
+
+/*
+ * NAL Index for Annex-B streams
+ *
+ * Built in a single pass over the stream. Records where every NAL unit
+ * is and groups slice NALs into pictures, so callers can jump straight
+ * to the Nth IDR or to all slices of one picture (e.g. one page of a
+ * multi-page atlas file) without rescanning.
+ *
+ * The index points into the stream it was built from; the stream must
+ * outlive it.
+ */
+
+/* nal_unit_type is 5 bits */
+#define NAL_INDEX_TYPES 32
+
+typedef struct {
+    size_t offset;          /* Offset of NAL header byte in stream */
+    size_t size;            /* Payload size after header (EBSP) */
+    size_t rbsp_size;       /* Payload size without emulation prevention */
+    int nal_unit_type;
+    int nal_ref_idc;
+    int picture;            /* Picture number for slice NALs, -1 otherwise */
+} NALIndexEntry;
+
+typedef struct {
+    size_t first_entry;     /* Entry index of the picture's first slice */
+    int num_slices;         /* Consecutive slice entries in the picture */
+    int is_idr;             /* Picture is coded as IDR slices */
+} NALIndexPicture;
+
+typedef struct {
+    const uint8_t *data;    /* Indexed stream */
+    size_t size;
+
+    NALIndexEntry *entries;
+    size_t num_entries;
+    size_t entries_capacity;
+
+    NALIndexPicture *pictures;
+    size_t num_pictures;
+    size_t pictures_capacity;
+
+    /* Direct lookups */
+    size_t *idr_pictures;   /* Picture index of each IDR picture, in order */
+    size_t num_idr_pictures;
+    size_t idr_pictures_capacity;
+    size_t *by_type;        /* Entry indices grouped by nal_unit_type, in order */
+    size_t type_start[NAL_INDEX_TYPES + 1]; /* Type t holds by_type[type_start[t]..type_start[t + 1]) */
+} NALIndex;
+
+/*
+ * Build index over an Annex-B stream
+ *
+ * A slice with first_mb_in_slice == 0 starts a new picture; other
+ * slices belong to the picture before them.
+ *
+ * Returns 0 on success, -1 on allocation failure
+ */
+int nal_index_build(NALIndex *index, const uint8_t *data, size_t size);
+
+/* Free index storage */
+void nal_index_free(NALIndex *index);
+
+/*
+ * Find the nth (0-based) NAL unit of the given type, in O(1)
+ *
+ * Returns entry index, or -1 if there are fewer than n + 1 such NALs
+ */
+long nal_index_find(const NALIndex *index, int nal_unit_type, int nth);
+
+/*
+ * Find the nth (0-based) IDR picture, in O(1)
+ *
+ * Returns picture index, or -1 if not found
+ */
+long nal_index_find_idr_picture(const NALIndex *index, int nth);
+
+/* Fill a NALUnit view of an entry (same fields as nal_parser_next) */
+void nal_index_get_unit(const NALIndex *index, size_t entry, NALUnit *unit);
+
+#endif /* NAL_INDEX_H */
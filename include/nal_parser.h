@@ -8,6 +8,8 @@
  * NAL Unit Parser for Annex-B streams
  *
  * Finds NAL units in an Annex-B byte stream and extracts RBSP.
+ * Start codes and emulation prevention bytes are located with the
+ * vectorized zero-pair scanner (zeroscan.h).
  */
 
 typedef struct {
@@ -15,13 +17,15 @@ typedef struct {
     int nal_unit_type;
     const uint8_t *data;    /* Pointer to NAL unit data (after header) */
     size_t size;            /* Size of NAL unit data */
-    size_t rbsp_size;       /* Size after removing emulation prevention bytes */
+    size_t rbsp_size;       /* Size after removing emulation prevention bytes
+                               (counted during the start code scan) */
 } NALUnit;
 
 typedef struct {
     const uint8_t *data;
     size_t size;
     size_t pos;
+    size_t next_start;      /* Start of next NAL found by the last scan (0 = unknown) */
 } NALParser;
 
 /* Initialize parser with Annex-B data */
@@ -30,6 +34,61 @@ void nal_parser_init(NALParser *parser, const uint8_t *data, size_t size);
 /* Find next NAL unit. Returns 1 if found, 0 if end of stream */
 int nal_parser_next(NALParser *parser, NALUnit *unit);
 
+/*
+ * Incremental Annex-B parser for piped input
+ *
+ * Data is pushed in arbitrary chunks. A NAL unit is returned as soon as
+ * the start code that ends it arrives. NALs that begin and end inside
+ * one chunk point straight into that chunk. Only the unfinished NAL at
+ * the end of a chunk is copied, into the caller's carry buffer.
+ *
+ * Usage:
+ *   nal_stream_init(&sp, carry, sizeof(carry));
+ *   while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+ *       nal_stream_push(&sp, chunk, n);
+ *       while ((r = nal_stream_next(&sp, &unit)) != 0) { ... }
+ *   }
+ *   if (nal_stream_finish(&sp, &unit)) { ... }
+ *
+ * A returned unit stays valid until the next call on the parser. A
+ * pushed chunk must stay valid until nal_stream_next returns 0.
+ */
+typedef struct {
+    uint8_t *carry;         /* Unfinished NAL (header onwards) from earlier chunks */
+    size_t carry_size;
+    size_t carry_capacity;
+
+    const uint8_t *chunk;   /* Current chunk */
+    size_t chunk_size;
+    size_t chunk_pos;       /* Start of unconsumed chunk data */
+
+    int in_nal;             /* A start code has been seen */
+    int zeros;              /* Zero bytes just before chunk_pos (capped at 2) */
+} NALStreamParser;
+
+/* Initialize stream parser with a carry buffer for NALs split across chunks */
+void nal_stream_init(NALStreamParser *sp, uint8_t *carry, size_t carry_capacity);
+
+/* Hand the parser the next chunk of stream data */
+void nal_stream_push(NALStreamParser *sp, const uint8_t *data, size_t size);
+
+/*
+ * Get next complete NAL unit from the pushed data
+ *
+ * Returns 1 if found, 0 if more data is needed, -1 if a NAL did not fit
+ * in the carry buffer (that NAL is dropped; parsing resumes at the next
+ * start code)
+ */
+int nal_stream_next(NALStreamParser *sp, NALUnit *unit);
+
+/*
+ * End of stream: get the final NAL unit, which has no start code after it.
+ * Call once nal_stream_next has returned 0 for the last chunk.
+ *
+ * Returns 1 if found, 0 if nothing was pending
+ */
+int nal_stream_finish(NALStreamParser *sp, NALUnit *unit);
+
 /* Convert EBSP to RBSP (remove emulation prevention bytes) */
 size_t ebsp_to_rbsp(uint8_t *rbsp, const uint8_t *ebsp, size_t ebsp_size);
 
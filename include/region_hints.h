@@ -0,0 +1,126 @@
+#ifndef REGION_HINTS_H
+#define REGION_HINTS_H
+
+#include <stdint.h>
+#include "h264_writer.h"
+
+/*
+ * Region Hints
+ *
+ * Per-frame hints from the UI renderer (MASTER_DESIGN.md §5): which
+ * rectangles only move, by how much and from which reference, and where
+ * the dynamic region is. Rasterizing them classifies every MB of the
+ * frame (§6) and gives the motion field the P-frame is written from.
+ *
+ * Motion regions are stacked by z, higher covering lower; regions of
+ * equal z stack in the order they were added. The dynamic region covers
+ * every motion region. MBs no region covers are static: A unmoved.
+ *
+ * Rasterization fills one span per region per MB row, so its cost
+ * follows the covered area, not regions x MBs. region_hints_update()
+ * goes further and re-derives only the MB rows a region added, removed
+ * or changed since the previous frame touches, marking them dirty.
+ */
+
+/* Most motion regions in one frame's hints */
+#define MAX_MOTION_REGIONS 64
+
+/* Default margin around the dynamic rectangle (pixels) */
+#define DYNAMIC_MARGIN_DEFAULT 16
+
+/* MB classification */
+typedef enum {
+    MB_CLASS_STATIC = 0,    /* Shows A unmoved */
+    MB_CLASS_MOTION,        /* Shows a reference displaced */
+    MB_CLASS_DYNAMIC        /* Content from the dynamic encoder */
+} MBClass;
+
+/* Rectangle in pixels */
+typedef struct {
+    int x, y;
+    int w, h;
+} HintRect;
+
+/* Rectangle whose content only moves */
+typedef struct {
+    HintRect rect;          /* Where the content is in this frame */
+    int ref_idx;            /* Reference it comes from (0 = A, 1 = B, 2.. = waypoints) */
+    int mv_x, mv_y;         /* Where it is in the reference, relative to rect
+                               (quarter pixels) */
+    int z;                  /* Stacking order, higher covers lower */
+} MotionRegion;
+
+typedef struct {
+    MotionRegion motion_regions[MAX_MOTION_REGIONS];
+    int num_motion_regions;
+
+    int has_dynamic;
+    HintRect dynamic_rect;
+    int dynamic_margin;     /* Pixels added on each side before MB alignment */
+} RegionHints;
+
+/* Classification and motion of every MB of a frame */
+typedef struct {
+    int mb_width;
+    int mb_height;
+    uint8_t *cls;           /* MBClass per MB, raster order */
+    MBMotion *motion;       /* Motion field; MB_MOTION_STATIC outside motion MBs */
+
+    /* Dynamic region in MBs (when has_dynamic) */
+    int has_dynamic;
+    int dyn_x0, dyn_y0;     /* First MB column / row */
+    int dyn_x1, dyn_y1;     /* One past the last */
+
+    /* Rows re-derived by the last rasterize / update */
+    uint8_t *dirty;         /* Nonzero per re-derived MB row */
+    int num_dirty;
+
+    /* Hints the map was derived from (when has_hints) */
+    int has_hints;
+    RegionHints hints;
+} MBMap;
+
+/* Initialize hints with no regions */
+void region_hints_init(RegionHints *hints);
+
+/*
+ * Add a motion region
+ *
+ * Returns 0 on success, -1 if MAX_MOTION_REGIONS are already set
+ */
+int region_hints_add_motion(RegionHints *hints, const MotionRegion *region);
+
+/* Set the dynamic rectangle and its margin */
+void region_hints_set_dynamic(RegionHints *hints, const HintRect *rect, int margin);
+
+/*
+ * Allocate a map of mb_width x mb_height MBs
+ *
+ * Returns 0 on success, -1 on allocation failure
+ */
+int mb_map_init(MBMap *map, int mb_width, int mb_height);
+
+void mb_map_free(MBMap *map);
+
+/*
+ * Classify every MB of map from hints
+ *
+ * A motion region takes the MBs whose centres it covers. The dynamic
+ * rectangle is grown by its margin and then to whole MBs (§7.1), so it
+ * takes every MB it touches. Rectangles are clipped to the frame.
+ */
+void region_hints_rasterize(const RegionHints *hints, MBMap *map);
+
+/*
+ * Bring map from the hints it was last derived from to hints
+ *
+ * Regions are compared by position in the list. Only the MB rows that a
+ * region which differs (in either frame) or the dynamic rectangle
+ * covers are re-derived; they are marked in map->dirty. The first call
+ * rasterizes every row.
+ *
+ * Returns the number of dirty rows
+ */
+int region_hints_update(const RegionHints *hints, MBMap *map);
+
+#endif /* REGION_HINTS_H */
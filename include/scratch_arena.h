@@ -0,0 +1,53 @@
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Scratch Arena
+ *
+ * Bump allocator over a caller-provided buffer, for working memory that
+ * lives for one frame. Allocations are released together by
+ * scratch_arena_reset(), so a buffer sized for the largest frame serves
+ * every frame without allocator calls.
+ *
+ * A request that does not fit falls back to the heap. Fallback blocks
+ * are freed on reset and counted in allocations, which stays at zero
+ * while the buffer is big enough.
+ */
+
+#define SCRATCH_ARENA_ALIGN 16
+
+typedef struct ScratchBlock ScratchBlock;
+
+typedef struct {
+    uint8_t *buffer;
+    size_t capacity;
+    size_t used;
+
+    ScratchBlock *overflow; /* Heap fallback blocks, freed on reset */
+
+    /* Statistics */
+    uint64_t allocations;   /* Heap fallbacks since init */
+    size_t high_water;      /* Most buffer bytes used at once */
+} ScratchArena;
+
+/* Initialize arena over buffer (may be NULL with capacity 0: heap only) */
+void scratch_arena_init(ScratchArena *a, uint8_t *buffer, size_t capacity);
+
+/*
+ * Allocate size bytes, SCRATCH_ARENA_ALIGN aligned (not zeroed)
+ *
+ * Returns NULL only if the heap fallback fails
+ */
+void *scratch_arena_alloc(ScratchArena *a, size_t size);
+
+/* Release everything allocated since init or the last reset */
+void scratch_arena_reset(ScratchArena *a);
+
+/* Arena bytes taken by an allocation of size bytes */
+#define SCRATCH_ARENA_SIZE(size) \
+    (((size_t)(size) + SCRATCH_ARENA_ALIGN - 1) & ~(size_t)(SCRATCH_ARENA_ALIGN - 1))
+
+#endif /* SCRATCH_ARENA_H */
@@ -0,0 +1,182 @@
+#ifndef SPLICER_H
+#define SPLICER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "bitwriter.h"
+#include "nal_parser.h"
+#include "h264_writer.h"
+
+/*
+ * Dynamic Region Splicer
+ *
+ * Puts a conventional encoder's output for the dynamic rectangle
+ * (MASTER_DESIGN.md §4.2, §6.2) into composed frames. The dynamic
+ * encoder codes the MB rectangle as a picture of its own: progressive
+ * 4:2:0 CAVLC without 8x8 transforms, slice groups or weighted
+ * prediction (Baseline), with P slices predicting from one reference,
+ * its previous reference picture.
+ *
+ * A dynamic picture is spliced in one of two ways:
+ *
+ * - Passthrough: a rectangle as wide as the frame covers whole MB rows,
+ *   so every MB keeps its neighbours. Each slice is copied bit for bit
+ *   behind a new slice header that moves first_mb_in_slice. Pictures with
+ *   I_PCM MBs are merged instead, as the copy would break their byte
+ *   alignment.
+ * - Merge: otherwise the rectangle's MB rows become one slice holding
+ *   the composer's MBs and the dynamic MBs side by side. The dynamic MBs
+ *   are parsed in their own picture and re-coded for their new
+ *   neighbours: skip runs, MV predictions, intra mode predictions, QP
+ *   deltas, and each residual block's coeff_token, whose table follows
+ *   the neighbours' coefficient counts. The rest of every residual block
+ *   is copied as is.
+ *
+ * The decoded MBs match the dynamic encoder's only while nothing outside
+ * its picture enters their prediction, so pictures are refused where
+ * something would:
+ *
+ * - P pictures with MVs reaching out of the picture, interpolation taps
+ *   included: the output would predict from the composer's pixels around
+ *   the reference rectangle, not the edge extension. Sides where that
+ *   rectangle meets the frame's edge extend alike and are allowed.
+ * - Merged pictures with intra MBs that would predict from the composer's
+ *   MBs beside them, unless the dynamic encoder uses constrained intra
+ *   prediction, which the output then uses too.
+ *
+ * Deblocking still differs: merged MBs are not deblocked, since the
+ * composer's MBs must not be, and passthrough slices are not filtered
+ * across their boundaries. Dynamic encoders should disable the filter.
+ *
+ * The output keeps each dynamic reference picture as long-term reference
+ * DYNAMIC_LONG_TERM_IDX. Spliced frames refer to PPS SPLICED_PPS_ID,
+ * which carries the dynamic encoder's intra and chroma QP settings.
+ */
+
+/* Most slices in one dynamic picture */
+#define SPLICE_MAX_SLICES 32
+
+/* Most bytes of one MB: the macroblock_layer() limit of 128 + 3072 bits (A.3.1) */
+#define SPLICE_MAX_MB_BYTES 400
+
+/* Dynamic encoder's stream parameters, from its SPS and PPS */
+typedef struct {
+    int mb_width;
+    int mb_height;
+    int log2_max_frame_num;
+    int pic_order_cnt_type;
+    int log2_max_pic_order_cnt_lsb;
+
+    int bottom_field_pic_order_in_frame_present_flag;
+    int num_ref_idx_l0_default_minus1;
+    int pic_init_qp;
+    int chroma_qp_index_offset;
+    int deblocking_filter_control_present_flag;
+    int constrained_intra_pred_flag;
+} SpliceParams;
+
+/* Slice of the current dynamic picture */
+typedef struct {
+    const uint8_t *rbsp;    /* In the splicer's RBSP buffer */
+    size_t rbsp_size;
+    size_t data_bit;        /* First bit of slice_data() */
+    size_t end_bit;         /* rbsp_stop_one_bit */
+    int first_mb;           /* In the dynamic picture */
+    int slice_type;         /* SLICE_TYPE_P or SLICE_TYPE_I */
+    int qp;                 /* SliceQP_Y */
+    int disable_deblocking_filter_idc;
+    int slice_alpha_c0_offset_div2;
+    int slice_beta_offset_div2;
+} SpliceSlice;
+
+/* Splicer internals */
+typedef struct SpliceMB SpliceMB;
+typedef struct SpliceBlock SpliceBlock;
+
+struct Splicer {
+    int mb_width;           /* Output frame, in MBs */
+    int mb_height;
+
+    /* Dynamic encoder's parameter sets */
+    int has_sps;
+    int has_pps;
+    SpliceParams params;
+    int pps_changed;        /* SPLICED_PPS_ID is to be (re)written */
+
+    /* Current picture, placed at MB (x0, y0) of the output */
+    SpliceSlice slices[SPLICE_MAX_SLICES];
+    int num_slices;
+    int x0, y0;
+    int is_reference;       /* Becomes the dynamic reference */
+    int passthrough;
+    int mv_dx, mv_dy;       /* Added to dynamic MVs: how far the rectangle
+                               moved since the reference (quarter pels) */
+
+    /* Where the reference picture was placed */
+    int ref_x0, ref_y0;
+
+    /* Working memory, sized for the output frame */
+    uint8_t *rbsp;          /* RBSP of every slice of the picture */
+    size_t rbsp_capacity;
+    SpliceMB *mbs;          /* MBs of the dynamic picture */
+    SpliceMB *out;          /* MBs of the merged slice */
+    SpliceBlock *blocks;    /* Residual blocks of the dynamic picture */
+    size_t num_blocks;
+    int warned_deblocking;
+
+    /* Statistics */
+    uint64_t frames_passthrough;
+    uint64_t frames_merged;
+    uint64_t mbs_spliced;
+};
+
+/*
+ * Allocate a splicer for output frames of mb_width x mb_height MBs
+ *
+ * Returns 0 on success, -1 on allocation failure
+ */
+int splicer_init(Splicer *sp, int mb_width, int mb_height);
+
+void splicer_free(Splicer *sp);
+
+/*
+ * Take one of the dynamic encoder's SPS or PPS NAL units
+ *
+ * Returns 0 on success, -1 with an error printed if the stream uses
+ * features the splicer cannot re-code
+ */
+int splicer_set_parameter_set(Splicer *sp, const NALUnit *unit);
+
+/*
+ * Take the slice NAL units of one dynamic picture for MB rectangle
+ * [x0, x1) x [y0, y1) of the next frame
+ *
+ * have_ref: The output still holds the dynamic reference picture; P
+ *           pictures are refused without it
+ *
+ * Parses every MB and decides between passthrough and merge. The units
+ * may be released once this returns.
+ *
+ * Returns 0 on success, -1 with an error printed if the picture does not
+ * fit the rectangle, cannot be re-coded, or would not decode as the
+ * dynamic encoder's picture (see above)
+ */
+int splicer_load_picture(Splicer *sp, const NALUnit *units, int num_units,
+                         int x0, int y0, int x1, int y1, int have_ref);
+
+/* Copy slice_data() of slice s of a passthrough picture */
+void splicer_write_slice_data(const Splicer *sp, BitWriter *bw, int s);
+
+/*
+ * Write the MB layer of the merged slice: MB rows y0.. of the output,
+ * as many as the dynamic picture has, ending with any pending skip run
+ *
+ * field: Motion of the composer's MBs in those rows, mb_width per row
+ * num_refs: Active references of the slice
+ * dynamic_ref_idx: ref_idx of the dynamic reference in the slice
+ * qp: SliceQP_Y of the slice
+ */
+void splicer_write_merged(Splicer *sp, BitWriter *bw, const MBMotion *field,
+                          int num_refs, int dynamic_ref_idx, int qp);
+
+#endif /* SPLICER_H */
@@ -0,0 +1,53 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+
+/*
+ * Worker Pool
+ *
+ * A fixed set of threads that runs batches of independent tasks, e.g.
+ * the slices of one frame. The threads live as long as the pool, so a
+ * batch costs a wakeup rather than a thread start. The calling thread
+ * works on the batch too, and worker_pool_run() returns once every task
+ * has finished.
+ */
+
+/* Task callback: runs task number task (0 .. num_tasks - 1) of a batch */
+typedef void (*WorkerTaskFn)(void *arg, int task);
+
+typedef struct {
+    pthread_t *threads;
+    int num_threads;
+
+    /* Current batch */
+    WorkerTaskFn fn;
+    void *arg;
+    int num_tasks;
+    int next_task;          /* Next task to hand out */
+    int tasks_done;
+
+    int shutdown;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+} WorkerPool;
+
+/*
+ * Start num_threads worker threads (0 runs every batch on the caller)
+ *
+ * Returns 0 on success, -1 on error
+ */
+int worker_pool_init(WorkerPool *pool, int num_threads);
+
+/* Stop and join the worker threads */
+void worker_pool_free(WorkerPool *pool);
+
+/*
+ * Run fn(arg, 0) .. fn(arg, num_tasks - 1) across the pool and the
+ * calling thread; returns when all have finished
+ */
+void worker_pool_run(WorkerPool *pool, WorkerTaskFn fn, void *arg, int num_tasks);
+
+#endif /* WORKER_POOL_H */
@@ -0,0 +1,27 @@
+#ifndef ZEROSCAN_H
+#define ZEROSCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Zero-pair scanner for Annex-B / EBSP processing
+ *
+ * Start codes (00 00 01) and emulation prevention (00 00 03) both begin
+ * with two zero bytes, which are rare in coded slice data. Scanning for
+ * that pair 16 or 32 bytes at a time lets callers memcpy the runs in
+ * between instead of testing every byte.
+ *
+ * The SIMD variant (SSE2 or AVX2 on x86) is picked at runtime on first
+ * use; other targets use the scalar loop.
+ */
+
+/*
+ * Find the first position i in [start, end - 1) where
+ * data[i] == 0 && data[i + 1] == 0.
+ *
+ * Returns: i, or end if there is no such pair
+ */
+size_t zeroscan_find_pair(const uint8_t *data, size_t start, size_t end);
+
+#endif /* ZEROSCAN_H */
@@ -2,33 +2,177 @@
 #include <string.h>
 #include <assert.h>
 
+/* Store a 64-bit word MSB first */
+static inline void store_be64(uint8_t *p, uint64_t v) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+    memcpy(p, &v, sizeof(v));
+#else
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(v >> (56 - 8 * i));
+    }
+#endif
+}
+
+/* Nonzero if any byte of v is 0x00 */
+static inline uint64_t has_zero_byte(uint64_t v) {
+    return (v - 0x0101010101010101ull) & ~v & 0x8080808080808080ull;
+}
+
+/* Store one byte in EBSP mode, escaping 00 00 0x (x <= 3) */
+static inline void bitwriter_emit_byte_ebsp(BitWriter *bw, uint8_t byte) {
+    if (bw->zero_run >= 2 && byte <= 0x03) {
+        assert(bw->byte_pos < bw->capacity);
+        bw->buffer[bw->byte_pos++] = 0x03;
+        bw->epb_count++;
+        bw->zero_run = 0;
+    }
+
+    assert(bw->byte_pos < bw->capacity);
+    bw->buffer[bw->byte_pos++] = byte;
+    bw->zero_run = byte == 0x00 ? bw->zero_run + 1 : 0;
+}
+
+/*
+ * Store a full 64-bit word. In EBSP mode a word with no zero bytes that
+ * cannot complete a pending 00 00 prefix is still stored in one go.
+ */
+static inline void bitwriter_store_word(BitWriter *bw, uint64_t word) {
+    if (bw->ebsp && (has_zero_byte(word) ||
+                     (bw->zero_run >= 2 && (word >> 56) <= 0x03))) {
+        for (int i = 0; i < 8; i++) {
+            bitwriter_emit_byte_ebsp(bw, (uint8_t)(word >> (56 - 8 * i)));
+        }
+        return;
+    }
+
+    assert(bw->byte_pos + 8 <= bw->capacity);
+    store_be64(bw->buffer + bw->byte_pos, word);
+    bw->byte_pos += 8;
+    bw->zero_run = 0;
+}
+
+/*
+ * Append n bits (1-32) to the cache. Once the cache holds 64 bits it is
+ * stored as one word and the bits that did not fit start the next word.
+ */
+static inline void bitwriter_put(BitWriter *bw, uint32_t value, int n) {
+    uint64_t v = value & (0xFFFFFFFFu >> (32 - n));
+
+    if (n < bw->bits_left) {
+        bw->cache = (bw->cache << n) | v;
+        bw->bits_left -= n;
+        return;
+    }
+
+    int spill = n - bw->bits_left;
+    bitwriter_store_word(bw, (bw->cache << bw->bits_left) | (v >> spill));
+    bw->cache = v & ((1ull << spill) - 1);
+    bw->bits_left = 64 - spill;
+}
+
+/* Number of bits held in the cache and not yet stored */
+static inline int bitwriter_pending_bits(const BitWriter *bw) {
+    return 64 - bw->bits_left;
+}
+
+/*
+ * Copy pending cache bits to the buffer at byte_pos, zero-padding the
+ * last partial byte. Does not change writer state. Returns bytes written.
+ */
+static size_t bitwriter_spill_cache(BitWriter *bw) {
+    int pending = bitwriter_pending_bits(bw);
+    size_t nbytes = (pending + 7) / 8;
+    /* An empty cache has bits_left == 64, which cannot be shifted by */
+    uint64_t word = pending ? bw->cache << bw->bits_left : 0;
+
+    if (!bw->ebsp) {
+        assert(bw->byte_pos + nbytes <= bw->capacity);
+        for (size_t i = 0; i < nbytes; i++) {
+            bw->buffer[bw->byte_pos + i] = (uint8_t)(word >> (56 - 8 * i));
+        }
+        return nbytes;
+    }
+
+    /* Same escaping as bitwriter_emit_byte_ebsp() on a copy of the state */
+    size_t pos = bw->byte_pos;
+    int zero_run = bw->zero_run;
+    for (size_t i = 0; i < nbytes; i++) {
+        uint8_t byte = (uint8_t)(word >> (56 - 8 * i));
+        if (zero_run >= 2 && byte <= 0x03) {
+            assert(pos < bw->capacity);
+            bw->buffer[pos++] = 0x03;
+            zero_run = 0;
+        }
+        assert(pos < bw->capacity);
+        bw->buffer[pos++] = byte;
+        zero_run = byte == 0x00 ? zero_run + 1 : 0;
+    }
+    return pos - bw->byte_pos;
+}
+
 void bitwriter_init(BitWriter *bw, uint8_t *buffer, size_t capacity) {
     bw->buffer = buffer;
     bw->capacity = capacity;
     bw->byte_pos = 0;
-    bw->bit_pos = 0;
-    bw->current_byte = 0;
+    bw->cache = 0;
+    bw->bits_left = 64;
+    bw->ebsp = 0;
+    bw->zero_run = 0;
+    bw->epb_count = 0;
 }
 
-void bitwriter_write_bit(BitWriter *bw, int bit) {
-    bw->current_byte = (bw->current_byte << 1) | (bit & 1);
-    bw->bit_pos++;
+void bitwriter_init_ebsp(BitWriter *bw, uint8_t *buffer, size_t capacity) {
+    bitwriter_init(bw, buffer, capacity);
+    bw->ebsp = 1;
+}
 
-    if (bw->bit_pos == 8) {
-        assert(bw->byte_pos < bw->capacity);
-        bw->buffer[bw->byte_pos++] = bw->current_byte;
-        bw->current_byte = 0;
-        bw->bit_pos = 0;
-    }
+void bitwriter_write_bit(BitWriter *bw, int bit) {
+    bitwriter_put(bw, bit & 1, 1);
 }
 
 void bitwriter_write_bits(BitWriter *bw, uint32_t value, int n) {
     assert(n >= 1 && n <= 32);
+    bitwriter_put(bw, value, n);
+}
 
-    /* Write bits from MSB to LSB */
-    for (int i = n - 1; i >= 0; i--) {
-        bitwriter_write_bit(bw, (value >> i) & 1);
-    }
+/*
+ * ue(v) codeword lengths for small values. The codeword itself is always
+ * value + 1 written in this many bits (the leading zeros are implicit),
+ * so only the length needs a table. Covers skip runs, ref_idx, mb_type,
+ * coded_block_pattern and typical mvd magnitudes.
+ */
+#define UE_TABLE_SIZE 256
+
+#define R2(x)   x, x
+#define R4(x)   R2(x), R2(x)
+#define R8(x)   R4(x), R4(x)
+#define R16(x)  R8(x), R8(x)
+#define R32(x)  R16(x), R16(x)
+#define R64(x)  R32(x), R32(x)
+#define R128(x) R64(x), R64(x)
+
+static const uint8_t ue_len_table[UE_TABLE_SIZE] = {
+    1, R2(3), R4(5), R8(7), R16(9), R32(11), R64(13), R128(15), 17
+};
+
+#undef R2
+#undef R4
+#undef R8
+#undef R16
+#undef R32
+#undef R64
+#undef R128
+
+/* floor(log2(v)) for v > 0 */
+static inline int bitwriter_log2(uint64_t v) {
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int n = 0;
+    while (v >>= 1) n++;
+    return n;
+#endif
 }
 
 /*
@@ -46,31 +190,34 @@ void bitwriter_write_bits(BitWriter *bw, uint32_t value, int n) {
  * Format: [M zeros][1][INFO bits]
  * where M = floor(log2(value + 1))
  * and INFO = value + 1 - 2^M (M bits)
+ *
+ * The whole codeword is emitted as a single write of value + 1 in 2M + 1
+ * bits. Only codewords longer than 32 bits (value >= 65535) need a
+ * separate write for the leading zeros.
  */
 void bitwriter_write_ue(BitWriter *bw, uint32_t value) {
-    /* Special case for 0 */
-    if (value == 0) {
-        bitwriter_write_bit(bw, 1);
+    if (value < UE_TABLE_SIZE) {
+        bitwriter_put(bw, value + 1, ue_len_table[value]);
         return;
     }
 
-    /* Calculate number of leading zeros needed */
-    uint32_t v = value + 1;
-    int leading_zeros = 0;
-    uint32_t temp = v;
+    uint64_t v = (uint64_t)value + 1;
+    int leading_zeros = bitwriter_log2(v);
 
-    while (temp > 1) {
-        temp >>= 1;
-        leading_zeros++;
+    if (2 * leading_zeros + 1 <= 32) {
+        bitwriter_put(bw, (uint32_t)v, 2 * leading_zeros + 1);
+        return;
     }
 
-    /* Write leading zeros */
-    for (int i = 0; i < leading_zeros; i++) {
-        bitwriter_write_bit(bw, 0);
+    /* Long codeword: zero prefix, then value + 1 in M + 1 bits */
+    bitwriter_put(bw, 0, leading_zeros);
+    if (leading_zeros == 32) {
+        /* value == UINT32_MAX: value + 1 = 2^32 needs 33 bits */
+        bitwriter_put(bw, 1, 1);
+        bitwriter_put(bw, 0, 32);
+    } else {
+        bitwriter_put(bw, (uint32_t)v, leading_zeros + 1);
     }
-
-    /* Write the value + 1 in (leading_zeros + 1) bits */
-    bitwriter_write_bits(bw, v, leading_zeros + 1);
 }
 
 /*
@@ -92,132 +239,128 @@ void bitwriter_write_se(BitWriter *bw, int32_t value) {
     uint32_t mapped;
 
     if (value > 0) {
-        mapped = 2 * value - 1;
+        mapped = 2 * (uint32_t)value - 1;
     } else {
-        mapped = -2 * value;
+        mapped = -2 * (uint32_t)value;
     }
 
     bitwriter_write_ue(bw, mapped);
 }
 
-void bitwriter_write_trailing_bits(BitWriter *bw) {
-    /* Write rbsp_stop_one_bit (always 1) */
-    bitwriter_write_bit(bw, 1);
-
-    /* Write rbsp_alignment_zero_bits until byte-aligned */
-    while (bw->bit_pos != 0) {
-        bitwriter_write_bit(bw, 0);
-    }
-}
-
-void bitwriter_flush(BitWriter *bw) {
-    if (bw->bit_pos > 0) {
-        /* Pad remaining bits with zeros and write */
-        bw->current_byte <<= (8 - bw->bit_pos);
-        assert(bw->byte_pos < bw->capacity);
-        bw->buffer[bw->byte_pos++] = bw->current_byte;
-        bw->current_byte = 0;
-        bw->bit_pos = 0;
-    }
-}
-
-size_t bitwriter_get_size(BitWriter *bw) {
-    /* Flush partial byte to buffer if there are remaining bits */
-    if (bw->bit_pos > 0) {
-        /* Shift remaining bits to MSB positions and pad with zeros */
-        bw->buffer[bw->byte_pos] = bw->current_byte << (8 - bw->bit_pos);
-    }
-    return bw->byte_pos + (bw->bit_pos > 0 ? 1 : 0);
-}
-
-size_t bitwriter_get_bit_position(BitWriter *bw) {
-    return bw->byte_pos * 8 + bw->bit_pos;
-}
-
-int bitwriter_is_byte_aligned(BitWriter *bw) {
-    return bw->bit_pos == 0;
-}
-
 /*
- * BitReader implementation
+ * Append a full 64-bit word. The number of pending bits is unchanged:
+ * the top of the word completes the cached partial word and the rest
+ * becomes the new cache.
  */
+static inline void bitwriter_put64(BitWriter *bw, uint64_t v) {
+    int pending = bitwriter_pending_bits(bw);
 
-void bitreader_init(BitReader *br, const uint8_t *buffer, size_t size) {
-    br->buffer = buffer;
-    br->size = size;
-    br->byte_pos = 0;
-    br->bit_pos = 0;
+    if (pending == 0) {
+        bitwriter_store_word(bw, v);
+    } else {
+        bitwriter_store_word(bw, (bw->cache << bw->bits_left) | (v >> pending));
+        bw->cache = v & ((1ull << pending) - 1);
+    }
 }
 
-int bitreader_read_bit(BitReader *br) {
-    if (br->byte_pos >= br->size) {
-        return 0;  /* EOF - return 0 */
+/* Load 64 bits of src starting at bit offset pos, zero-padded past the end */
+static inline uint64_t load_bits64(const uint8_t *src, size_t src_size, size_t pos) {
+    size_t byte = pos >> 3;
+    int shift = pos & 7;
+    uint64_t v;
+
+    if (byte + 9 <= src_size) {
+        memcpy(&v, src + byte, sizeof(v));
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        v = __builtin_bswap64(v);
+#else
+        v = 0;
+        for (int i = 0; i < 8; i++) {
+            v = (v << 8) | src[byte + i];
+        }
+#endif
+        if (shift) {
+            v = (v << shift) | (src[byte + 8] >> (8 - shift));
+        }
+        return v;
     }
 
-    int bit = (br->buffer[br->byte_pos] >> (7 - br->bit_pos)) & 1;
-    br->bit_pos++;
-
-    if (br->bit_pos == 8) {
-        br->byte_pos++;
-        br->bit_pos = 0;
+    /* Near the end of src: assemble byte by byte */
+    v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | (byte + i < src_size ? src[byte + i] : 0);
     }
-
-    return bit;
-}
-
-uint32_t bitreader_read_bits(BitReader *br, int n) {
-    uint32_t value = 0;
-
-    for (int i = 0; i < n; i++) {
-        value = (value << 1) | bitreader_read_bit(br);
+    if (shift) {
+        v = (v << shift) | (byte + 8 < src_size ? src[byte + 8] >> (8 - shift) : 0);
     }
-
-    return value;
+    return v;
 }
 
-uint32_t bitreader_read_ue(BitReader *br) {
-    /* Count leading zeros */
-    int leading_zeros = 0;
-    while (bitreader_read_bit(br) == 0 && leading_zeros < 32) {
-        leading_zeros++;
+void bitwriter_copy_bits(BitWriter *bw, const uint8_t *src, size_t src_size,
+                         size_t start_bit, size_t num_bits) {
+    assert(start_bit + num_bits <= src_size * 8);
+
+    /* Both sides byte-aligned: store pending bytes, then plain memcpy */
+    if (!bw->ebsp && (start_bit & 7) == 0 && bitwriter_is_byte_aligned(bw) &&
+        num_bits >= 64) {
+        bitwriter_flush(bw);
+
+        size_t nbytes = num_bits >> 3;
+        assert(bw->byte_pos + nbytes <= bw->capacity);
+        memcpy(bw->buffer + bw->byte_pos, src + (start_bit >> 3), nbytes);
+        bw->byte_pos += nbytes;
+        start_bit += nbytes * 8;
+        num_bits -= nbytes * 8;
     }
 
-    if (leading_zeros == 0) {
-        return 0;
+    /* Shift-and-merge one 64-bit word at a time */
+    while (num_bits >= 64) {
+        bitwriter_put64(bw, load_bits64(src, src_size, start_bit));
+        start_bit += 64;
+        num_bits -= 64;
     }
 
-    /* Read the suffix bits */
-    uint32_t suffix = bitreader_read_bits(br, leading_zeros);
-    return (1 << leading_zeros) - 1 + suffix;
+    if (num_bits > 0) {
+        uint64_t v = load_bits64(src, src_size, start_bit) >> (64 - num_bits);
+        if (num_bits > 32) {
+            bitwriter_put(bw, (uint32_t)(v >> 32), (int)num_bits - 32);
+            bitwriter_put(bw, (uint32_t)v, 32);
+        } else {
+            bitwriter_put(bw, (uint32_t)v, (int)num_bits);
+        }
+    }
 }
 
-int32_t bitreader_read_se(BitReader *br) {
-    uint32_t ue_val = bitreader_read_ue(br);
+void bitwriter_write_trailing_bits(BitWriter *bw) {
+    /* rbsp_stop_one_bit (always 1) followed by rbsp_alignment_zero_bits */
+    int pad = (8 - ((bitwriter_pending_bits(bw) + 1) & 7)) & 7;
+    bitwriter_put(bw, 1u << pad, pad + 1);
+}
 
-    /* Decode: odd values are positive, even are negative */
-    if (ue_val & 1) {
-        return (int32_t)((ue_val + 1) / 2);
+void bitwriter_flush(BitWriter *bw) {
+    /* Store pending bits, padding the last byte with zeros */
+    if (bw->ebsp) {
+        int nbytes = (bitwriter_pending_bits(bw) + 7) / 8;
+        uint64_t word = nbytes ? bw->cache << bw->bits_left : 0;
+        for (int i = 0; i < nbytes; i++) {
+            bitwriter_emit_byte_ebsp(bw, (uint8_t)(word >> (56 - 8 * i)));
+        }
     } else {
-        return -(int32_t)(ue_val / 2);
+        bw->byte_pos += bitwriter_spill_cache(bw);
     }
+    bw->cache = 0;
+    bw->bits_left = 64;
 }
 
-size_t bitreader_get_bit_position(BitReader *br) {
-    return br->byte_pos * 8 + br->bit_pos;
-}
-
-int bitreader_is_byte_aligned(BitReader *br) {
-    return br->bit_pos == 0;
+size_t bitwriter_get_size(BitWriter *bw) {
+    /* Make pending bits visible in the buffer without consuming them */
+    return bw->byte_pos + bitwriter_spill_cache(bw);
 }
 
-size_t bitreader_get_remaining_bytes(BitReader *br) {
-    if (br->bit_pos != 0) {
-        /* Not byte-aligned, remaining bytes after current partial byte */
-        return br->size - br->byte_pos - 1;
-    }
-    return br->size - br->byte_pos;
+size_t bitwriter_get_bit_position(BitWriter *bw) {
+    return (bw->byte_pos - bw->epb_count) * 8 + bitwriter_pending_bits(bw);
 }
 
-const uint8_t *bitreader_get_pointer(BitReader *br) {
-    return br->buffer + br->byte_pos;
+int bitwriter_is_byte_aligned(BitWriter *bw) {
+    return (bitwriter_pending_bits(bw) & 7) == 0;
 }
@@ -0,0 +1,153 @@
+#include "clip_library.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Order entries by (offset_qpel, ref_set, mv_hash) */
+static int entry_compare_key(const ClipLibraryEntry *e, const FrameCacheKey *key) {
+    if (e->offset_qpel != key->offset_qpel) return e->offset_qpel < key->offset_qpel ? -1 : 1;
+    if (e->ref_set != key->ref_set) return e->ref_set < key->ref_set ? -1 : 1;
+    if (e->mv_hash != key->mv_hash) return e->mv_hash < key->mv_hash ? -1 : 1;
+    return 0;
+}
+
+static int entry_compare(const void *a, const void *b) {
+    const ClipLibraryEntry *eb = b;
+    FrameCacheKey key = { eb->offset_qpel, eb->ref_set, eb->mv_hash };
+    return entry_compare_key(a, &key);
+}
+
+int clip_library_write(const char *path, int width, int height,
+                       ClipLibraryEntry *entries, uint32_t num_entries,
+                       const uint8_t *data, size_t data_size) {
+    qsort(entries, num_entries, sizeof(ClipLibraryEntry), entry_compare);
+
+    ClipLibraryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CLIP_LIBRARY_MAGIC, sizeof(header.magic));
+    header.version = CLIP_LIBRARY_VERSION;
+    header.byte_order = CLIP_LIBRARY_BYTE_ORDER;
+    header.width = (uint32_t)width;
+    header.height = (uint32_t)height;
+    header.num_entries = num_entries;
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot create %s\n", path);
+        return -1;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+        fwrite(entries, sizeof(ClipLibraryEntry), num_entries, f) != num_entries ||
+        fwrite(data, 1, data_size, f) != data_size) {
+        fprintf(stderr, "Error: Failed to write %s\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Error: Failed to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int clip_library_open(ClipLibrary *lib, const char *path, int width, int height) {
+    memset(lib, 0, sizeof(*lib));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open %s\n", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ClipLibraryHeader)) {
+        fprintf(stderr, "Error: %s is not a clip library\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map %s\n", path);
+        return -1;
+    }
+
+    lib->map = p;
+    lib->map_size = (size_t)st.st_size;
+    lib->header = p;
+
+    const ClipLibraryHeader *h = lib->header;
+    size_t table_end = sizeof(*h) + (size_t)h->num_entries * sizeof(ClipLibraryEntry);
+
+    if (memcmp(h->magic, CLIP_LIBRARY_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != CLIP_LIBRARY_VERSION ||
+        h->byte_order != CLIP_LIBRARY_BYTE_ORDER ||
+        table_end > lib->map_size) {
+        fprintf(stderr, "Error: %s is not a clip library\n", path);
+        clip_library_close(lib);
+        return -1;
+    }
+
+    if ((int)h->width != width || (int)h->height != height) {
+        fprintf(stderr, "Error: Clip library is %ux%u, stream is %dx%d\n",
+                h->width, h->height, width, height);
+        clip_library_close(lib);
+        return -1;
+    }
+
+    lib->entries = (const ClipLibraryEntry *)(lib->map + sizeof(*h));
+    lib->payload = lib->map + table_end;
+    lib->payload_size = lib->map_size - table_end;
+
+    /* Reject entries pointing past the end of the file */
+    for (uint32_t i = 0; i < h->num_entries; i++) {
+        const ClipLibraryEntry *e = &lib->entries[i];
+        if (e->data_offset > lib->payload_size ||
+            (e->num_bits + 7) / 8 > lib->payload_size - e->data_offset) {
+            fprintf(stderr, "Error: Clip library %s is truncated\n", path);
+            clip_library_close(lib);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void clip_library_close(ClipLibrary *lib) {
+    if (lib->map) {
+        munmap((void *)lib->map, lib->map_size);
+    }
+    memset(lib, 0, sizeof(*lib));
+}
+
+const uint8_t *clip_library_find(ClipLibrary *lib, const FrameCacheKey *key,
+                                 size_t *num_bits) {
+    size_t lo = 0;
+    size_t hi = lib->header->num_entries;
+
+    /* Composers may serve frames from several threads */
+    __atomic_fetch_add(&lib->lookups, 1, __ATOMIC_RELAXED);
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = entry_compare_key(&lib->entries[mid], key);
+        if (c == 0) {
+            __atomic_fetch_add(&lib->hits, 1, __ATOMIC_RELAXED);
+            *num_bits = (size_t)lib->entries[mid].num_bits;
+            return lib->payload + lib->entries[mid].data_offset;
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
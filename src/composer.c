@@ -1,48 +1,242 @@
 #include "composer.h"
 #include "nal_parser.h"
+#include "nal_index.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <pthread.h>
 
 /* Default buffer sizes */
 #define OUTPUT_BUFFER_SIZE (64 * 1024 * 1024)  /* 64 MB */
 #define RBSP_BUFFER_SIZE   (4 * 1024 * 1024)   /* 4 MB */
 
+/* Piped reference input */
+#define STREAM_CHUNK_SIZE  (64 * 1024)             /* 64 KB */
+#define STREAM_CARRY_SIZE  (8 * 1024 * 1024)       /* 8 MB, largest NAL */
+
 /*
- * Load a file into memory
+ * Reference input file
+ *
+ * Regular files are mapped read-only and indexed in place; the only copy
+ * made is the EBSP-to-RBSP conversion into the composer's ref_rbsp
+ * buffer. Pipes are parsed as they arrive and only the NALs we use are
+ * kept.
  */
-static uint8_t *load_file(const char *path, size_t *size) {
-    FILE *f = fopen(path, "rb");
-    if (!f) {
+typedef struct {
+    const uint8_t *data;    /* Mapped file, or NALs kept from a pipe */
+    size_t size;
+    int mapped;
+    NALIndex index;
+    long sps, pps, idr;     /* Entry indices of the NALs we use */
+} ReferenceFile;
+
+/* Append a NAL with a 3-byte start code to a growing Annex-B buffer */
+static int append_nal(uint8_t **buf, size_t *size, const NALUnit *unit) {
+    size_t nal_size = 3 + 1 + unit->size;
+    uint8_t *p = realloc(*buf, *size + nal_size);
+    if (!p) {
+        return -1;
+    }
+
+    p[*size] = 0x00;
+    p[*size + 1] = 0x00;
+    p[*size + 2] = 0x01;
+    memcpy(p + *size + 3, unit->data - 1, 1 + unit->size);    /* Header + payload */
+
+    *buf = p;
+    *size += nal_size;
+    return 0;
+}
+
+/*
+ * Read a reference from a pipe with the incremental parser
+ *
+ * Keeps the first SPS, PPS and IDR slice as a small Annex-B stream and
+ * stops reading once all three are complete.
+ */
+static int reference_read_stream(ReferenceFile *ref, int fd, const char *path) {
+    uint8_t *chunk = malloc(STREAM_CHUNK_SIZE);
+    uint8_t *carry = malloc(STREAM_CARRY_SIZE);
+    uint8_t *kept = NULL;
+    size_t kept_size = 0;
+    int have_sps = 0, have_pps = 0, have_idr = 0;
+    int err = !chunk || !carry;
+
+    NALStreamParser sp;
+    NALUnit unit;
+    nal_stream_init(&sp, carry, STREAM_CARRY_SIZE);
+
+    while (!err && !(have_sps && have_pps && have_idr)) {
+        ssize_t n = read(fd, chunk, STREAM_CHUNK_SIZE);
+        int r;
+
+        if (n < 0) {
+            err = 1;
+            break;
+        }
+
+        if (n == 0) {
+            r = nal_stream_finish(&sp, &unit);
+        } else {
+            nal_stream_push(&sp, chunk, (size_t)n);
+            r = nal_stream_next(&sp, &unit);
+        }
+
+        while (r != 0 && !err) {
+            if (r < 0) {
+                fprintf(stderr, "Error: NAL larger than %d bytes in %s\n",
+                        STREAM_CARRY_SIZE, path);
+                err = 1;
+                break;
+            }
+
+            int *have = unit.nal_unit_type == NAL_TYPE_SPS ? &have_sps :
+                        unit.nal_unit_type == NAL_TYPE_PPS ? &have_pps :
+                        unit.nal_unit_type == NAL_TYPE_IDR ? &have_idr : NULL;
+            if (have && !*have) {
+                *have = 1;
+                err = append_nal(&kept, &kept_size, &unit) < 0;
+            }
+
+            r = n == 0 ? 0 : nal_stream_next(&sp, &unit);
+        }
+
+        if (n == 0) {
+            break;
+        }
+    }
+
+    free(chunk);
+    free(carry);
+
+    if (err || kept_size == 0) {
+        if (err) {
+            fprintf(stderr, "Error: Failed to read %s\n", path);
+        }
+        free(kept);
+        return err ? -1 : 0;
+    }
+
+    ref->data = kept;
+    ref->size = kept_size;
+    ref->mapped = 0;
+    return 0;
+}
+
+static void reference_release_data(ReferenceFile *ref) {
+    if (ref->mapped) {
+        munmap((void *)ref->data, ref->size);
+    } else {
+        free((void *)ref->data);
+    }
+    ref->data = NULL;
+}
+
+/*
+ * Load a reference file and locate its first SPS, PPS and IDR slice
+ */
+static int reference_open(ReferenceFile *ref, const char *path) {
+    memset(ref, 0, sizeof(*ref));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
         fprintf(stderr, "Error: Cannot open %s\n", path);
-        return NULL;
+        return -1;
     }
 
-    fseek(f, 0, SEEK_END);
-    *size = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        fprintf(stderr, "Error: Cannot read %s\n", path);
+        close(fd);
+        return -1;
+    }
 
-    uint8_t *data = malloc(*size);
-    if (!data) {
-        fclose(f);
-        return NULL;
+    if (!S_ISREG(st.st_mode)) {
+        int r = reference_read_stream(ref, fd, path);
+        close(fd);
+        if (r < 0) {
+            return -1;
+        }
+    } else if (st.st_size > 0) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            fprintf(stderr, "Error: Cannot map %s\n", path);
+            return -1;
+        }
+        madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+        ref->data = p;
+        ref->size = (size_t)st.st_size;
+        ref->mapped = 1;
+    } else {
+        close(fd);
     }
 
-    if (fread(data, 1, *size, f) != *size) {
-        fprintf(stderr, "Error: Failed to read %s\n", path);
-        free(data);
-        fclose(f);
-        return NULL;
+    if (!ref->data) {
+        fprintf(stderr, "Error: Reference file %s is empty\n", path);
+        return -1;
     }
 
-    fclose(f);
-    return data;
+    if (nal_index_build(&ref->index, ref->data, ref->size) < 0) {
+        fprintf(stderr, "Error: Failed to index %s\n", path);
+        reference_release_data(ref);
+        return -1;
+    }
+
+    /* First SPS, first PPS and the first slice of the first IDR picture */
+    long idr_pic = nal_index_find_idr_picture(&ref->index, 0);
+    ref->sps = nal_index_find(&ref->index, NAL_TYPE_SPS, 0);
+    ref->pps = nal_index_find(&ref->index, NAL_TYPE_PPS, 0);
+    ref->idr = idr_pic < 0 ? -1 : (long)ref->index.pictures[idr_pic].first_entry;
+
+    if (ref->sps < 0 || ref->pps < 0 || ref->idr < 0) {
+        fprintf(stderr, "Error: Reference file %s missing SPS/PPS/IDR\n", path);
+        nal_index_free(&ref->index);
+        reference_release_data(ref);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void reference_close(ReferenceFile *ref) {
+    if (ref->data) {
+        nal_index_free(&ref->index);
+        reference_release_data(ref);
+    }
+    memset(ref, 0, sizeof(*ref));
+}
+
+/* RBSP bytes needed for the NALs reference_open located */
+static size_t reference_rbsp_size(const ReferenceFile *ref) {
+    return ref->index.entries[ref->sps].rbsp_size +
+           ref->index.entries[ref->pps].rbsp_size +
+           ref->index.entries[ref->idr].rbsp_size;
+}
+
+/* Convert an indexed NAL to RBSP at *cursor and advance the cursor */
+static uint8_t *reference_take_rbsp(const ReferenceFile *ref, long entry,
+                                    uint8_t **cursor, size_t *rbsp_size) {
+    NALUnit unit;
+    nal_index_get_unit(&ref->index, (size_t)entry, &unit);
+
+    uint8_t *rbsp = *cursor;
+    *rbsp_size = ebsp_to_rbsp(rbsp, unit.data, unit.size);
+    *cursor += *rbsp_size;
+    return rbsp;
 }
 
 /*
- * Parse reference file to extract SPS, PPS, and IDR RBSP
+ * Convert SPS, PPS and IDR of a reference file to RBSP and parse the
+ * parameter sets
  */
-static int parse_reference_file(const uint8_t *data, size_t size,
+static int parse_reference_file(const ReferenceFile *ref, uint8_t **cursor,
                                  uint8_t **sps_out, size_t *sps_size,
                                  uint8_t **pps_out, size_t *pps_size,
                                  uint8_t **idr_rbsp_out, size_t *idr_size,
@@ -52,143 +246,127 @@ static int parse_reference_file(const uint8_t *data, size_t size,
                                  int *log2_max_pic_order_cnt_lsb,
                                  int *num_ref_idx_l0_default_minus1,
                                  int *deblocking_filter_control_present_flag) {
-    NALParser parser;
-    NALUnit unit;
-    uint8_t *rbsp_temp = malloc(size);
-    int found_sps = 0, found_pps = 0, found_idr = 0;
-
-    nal_parser_init(&parser, data, size);
-
-    while (nal_parser_next(&parser, &unit)) {
-        switch (unit.nal_unit_type) {
-            case NAL_TYPE_SPS:
-                if (!found_sps) {
-                    /* Convert to RBSP */
-                    size_t rbsp_size = ebsp_to_rbsp(rbsp_temp, unit.data, unit.size);
-
-                    /* Parse SPS */
-                    if (parse_sps(rbsp_temp, rbsp_size, width, height,
-                                  log2_max_frame_num, pic_order_cnt_type,
-                                  log2_max_pic_order_cnt_lsb) < 0) {
-                        fprintf(stderr, "Error: Failed to parse SPS\n");
-                        free(rbsp_temp);
-                        return -1;
-                    }
-
-                    /* Store original SPS RBSP */
-                    *sps_out = malloc(rbsp_size);
-                    memcpy(*sps_out, rbsp_temp, rbsp_size);
-                    *sps_size = rbsp_size;
-                    found_sps = 1;
-                }
-                break;
+    *sps_out = reference_take_rbsp(ref, ref->sps, cursor, sps_size);
+    *pps_out = reference_take_rbsp(ref, ref->pps, cursor, pps_size);
+    *idr_rbsp_out = reference_take_rbsp(ref, ref->idr, cursor, idr_size);
 
-            case NAL_TYPE_PPS:
-                if (!found_pps) {
-                    size_t rbsp_size = ebsp_to_rbsp(rbsp_temp, unit.data, unit.size);
-
-                    if (parse_pps(rbsp_temp, rbsp_size,
-                                  num_ref_idx_l0_default_minus1,
-                                  deblocking_filter_control_present_flag) < 0) {
-                        fprintf(stderr, "Error: Failed to parse PPS\n");
-                        free(rbsp_temp);
-                        return -1;
-                    }
-
-                    *pps_out = malloc(rbsp_size);
-                    memcpy(*pps_out, rbsp_temp, rbsp_size);
-                    *pps_size = rbsp_size;
-                    found_pps = 1;
-                }
-                break;
+    if (parse_sps(*sps_out, *sps_size, width, height,
+                  log2_max_frame_num, pic_order_cnt_type,
+                  log2_max_pic_order_cnt_lsb) < 0) {
+        fprintf(stderr, "Error: Failed to parse SPS\n");
+        return -1;
+    }
 
-            case NAL_TYPE_IDR:
-                if (!found_idr) {
-                    size_t rbsp_size = ebsp_to_rbsp(rbsp_temp, unit.data, unit.size);
-                    *idr_rbsp_out = malloc(rbsp_size);
-                    memcpy(*idr_rbsp_out, rbsp_temp, rbsp_size);
-                    *idr_size = rbsp_size;
-                    found_idr = 1;
-                }
-                break;
-        }
+    if (parse_pps(*pps_out, *pps_size,
+                  num_ref_idx_l0_default_minus1,
+                  deblocking_filter_control_present_flag) < 0) {
+        fprintf(stderr, "Error: Failed to parse PPS\n");
+        return -1;
     }
 
-    free(rbsp_temp);
+    return 0;
+}
 
-    if (!found_sps || !found_pps || !found_idr) {
-        fprintf(stderr, "Error: Reference file missing SPS/PPS/IDR\n");
+/* (Re)size the frame scratch arena for the current config */
+static int composer_alloc_scratch(Composer *c) {
+    size_t size = h264_frame_scratch_size(&c->cfg);
+    uint8_t *buffer = malloc(size);
+    if (!buffer) {
+        fprintf(stderr, "Error: Failed to allocate frame scratch\n");
         return -1;
     }
 
+    uint64_t allocations = c->scratch.allocations;
+    scratch_arena_reset(&c->scratch);
+    free(c->scratch_buffer);
+
+    c->scratch_buffer = buffer;
+    scratch_arena_init(&c->scratch, buffer, size);
+    c->scratch.allocations = allocations;
+    c->cfg.scratch = &c->scratch;
     return 0;
 }
 
+/*
+ * Output buffer for streaming: the largest access unit batch written
+ * between flushes, which is the header (both reference frames with
+ * emulation prevention), or a waypoint plus a scroll frame with
+ * per-slice header room, or a frame carrying a dynamic picture
+ */
+static size_t composer_stream_capacity(const Composer *c) {
+    size_t header_size = (c->ref_a_size + c->ref_b_size) * 3 / 2 + 4096;
+    size_t frame_size = h264_scroll_payload_capacity(&c->cfg) * 3 / 2 +
+                        1024 * (size_t)c->cfg.mb_height;
+    size_t splice_size = c->splicer.rbsp_capacity * 3 / 2 + 1024 * SPLICE_MAX_SLICES;
+    size_t capacity = 2 * frame_size + splice_size;
+    if (header_size > capacity) {
+        capacity = header_size;
+    }
+    return capacity;
+}
+
 int composer_init(Composer *c, const char *ref_a_path, const char *ref_b_path) {
     memset(c, 0, sizeof(*c));
 
-    /* Load reference files */
-    size_t ref_a_file_size, ref_b_file_size;
-    uint8_t *ref_a_data = load_file(ref_a_path, &ref_a_file_size);
-    uint8_t *ref_b_data = load_file(ref_b_path, &ref_b_file_size);
+    /* Map and index reference files */
+    ReferenceFile ref_a, ref_b;
 
-    if (!ref_a_data || !ref_b_data) {
-        free(ref_a_data);
-        free(ref_b_data);
+    if (reference_open(&ref_a, ref_a_path) < 0) {
         return -1;
     }
+    if (reference_open(&ref_b, ref_b_path) < 0) {
+        reference_close(&ref_a);
+        return -1;
+    }
+
+    /* One buffer holds the RBSP of both references */
+    size_t rbsp_total = reference_rbsp_size(&ref_a) + reference_rbsp_size(&ref_b);
+    c->ref_rbsp = malloc(rbsp_total);
+    uint8_t *cursor = c->ref_rbsp;
 
-    /* Parse reference A */
+    /* Parse reference A, then reference B (only need IDR RBSP, SPS/PPS
+     * should match) */
     int width, height;
     int log2_max_frame_num, pic_order_cnt_type, log2_max_pic_order_cnt_lsb;
     int num_ref_idx_l0, deblock_flag;
-
-    if (parse_reference_file(ref_a_data, ref_a_file_size,
-                             &c->orig_sps, &c->orig_sps_size,
-                             &c->orig_pps, &c->orig_pps_size,
-                             &c->ref_a_rbsp, &c->ref_a_size,
-                             &width, &height,
-                             &log2_max_frame_num, &pic_order_cnt_type,
-                             &log2_max_pic_order_cnt_lsb,
-                             &num_ref_idx_l0, &deblock_flag) < 0) {
-        free(ref_a_data);
-        free(ref_b_data);
-        return -1;
-    }
-
-    /* Parse reference B (only need IDR RBSP, SPS/PPS should match) */
     uint8_t *temp_sps, *temp_pps;
     size_t temp_sps_size, temp_pps_size;
     int width_b, height_b;
     int l2mfn, poct, l2mpoclsb, nridx, dbf;
+    int parsed = 0;
 
-    if (parse_reference_file(ref_b_data, ref_b_file_size,
-                             &temp_sps, &temp_sps_size,
-                             &temp_pps, &temp_pps_size,
-                             &c->ref_b_rbsp, &c->ref_b_size,
-                             &width_b, &height_b,
-                             &l2mfn, &poct, &l2mpoclsb, &nridx, &dbf) < 0) {
-        free(ref_a_data);
-        free(ref_b_data);
-        return -1;
+    if (!c->ref_rbsp) {
+        fprintf(stderr, "Error: Failed to allocate reference buffer\n");
+    } else if (parse_reference_file(&ref_a, &cursor,
+                                    &c->orig_sps, &c->orig_sps_size,
+                                    &c->orig_pps, &c->orig_pps_size,
+                                    &c->ref_a_rbsp, &c->ref_a_size,
+                                    &width, &height,
+                                    &log2_max_frame_num, &pic_order_cnt_type,
+                                    &log2_max_pic_order_cnt_lsb,
+                                    &num_ref_idx_l0, &deblock_flag) == 0 &&
+               parse_reference_file(&ref_b, &cursor,
+                                    &temp_sps, &temp_sps_size,
+                                    &temp_pps, &temp_pps_size,
+                                    &c->ref_b_rbsp, &c->ref_b_size,
+                                    &width_b, &height_b,
+                                    &l2mfn, &poct, &l2mpoclsb, &nridx, &dbf) == 0) {
+        parsed = 1;
+    }
+
+    reference_close(&ref_a);
+    reference_close(&ref_b);
+    if (!parsed) {
+        goto fail;
     }
 
     /* Verify dimensions match */
     if (width != width_b || height != height_b) {
         fprintf(stderr, "Error: Reference frame dimensions don't match\n");
         fprintf(stderr, "  RefA: %dx%d, RefB: %dx%d\n", width, height, width_b, height_b);
-        free(temp_sps);
-        free(temp_pps);
-        free(ref_a_data);
-        free(ref_b_data);
-        return -1;
+        goto fail;
     }
 
-    free(temp_sps);
-    free(temp_pps);
-    free(ref_a_data);
-    free(ref_b_data);
-
     /* Initialize parse config (external encoder's params) */
     composer_config_init(&c->parse_cfg, width, height);
     composer_config_set_sps_params(&c->parse_cfg, log2_max_frame_num,
@@ -202,23 +380,59 @@ int composer_init(Composer *c, const char *ref_a_path, const char *ref_b_path) {
     /* Preserve deblocking flag from input */
     composer_config_set_pps_params(&c->cfg, 1, deblock_flag);
 
-    /* Allocate output buffers */
-    c->output_capacity = OUTPUT_BUFFER_SIZE;
+    /* P-slice payload cache */
+    if (frame_cache_init(&c->frame_cache, FRAME_CACHE_DEFAULT_ENTRIES) < 0) {
+        fprintf(stderr, "Error: Failed to allocate payload cache\n");
+        goto fail;
+    }
+    c->cfg.frame_cache = &c->frame_cache;
+
+    /* Per-frame working memory */
+    if (composer_alloc_scratch(c) < 0) {
+        goto fail;
+    }
+
+    if (mb_map_init(&c->mb_map, c->cfg.mb_width, c->cfg.mb_height) < 0 ||
+        row_cache_init(&c->row_cache, c->cfg.mb_width, c->cfg.mb_height) < 0 ||
+        splicer_init(&c->splicer, c->cfg.mb_width, c->cfg.mb_height) < 0) {
+        fprintf(stderr, "Error: Failed to allocate MB map\n");
+        goto fail;
+    }
+
+    /* Allocate output buffers: one frame's worth for streaming, which
+     * composer_write_header() replaces if the output is buffered */
+    c->output_capacity = composer_stream_capacity(c);
     c->output_buffer = malloc(c->output_capacity);
     c->rbsp_capacity = RBSP_BUFFER_SIZE;
     c->rbsp_temp = malloc(c->rbsp_capacity);
 
     if (!c->output_buffer || !c->rbsp_temp) {
         fprintf(stderr, "Error: Failed to allocate output buffers\n");
-        return -1;
+        goto fail;
     }
 
     /* Initialize NAL writer */
     nal_writer_init(&c->nw, c->output_buffer, c->output_capacity,
                     c->rbsp_temp, c->rbsp_capacity);
+    c->output_fd = -1;
 
     printf("Composer initialized: %dx%d\n", width, height);
     return 0;
+
+fail:
+    /* Release in reverse order; the rest of *c is still zeroed */
+    free(c->rbsp_temp);
+    free(c->output_buffer);
+    splicer_free(&c->splicer);
+    row_cache_free(&c->row_cache);
+    mb_map_free(&c->mb_map);
+    scratch_arena_reset(&c->scratch);
+    free(c->scratch_buffer);
+    frame_cache_free(&c->frame_cache);
+    free(c->ref_rbsp);
+    memset(c, 0, sizeof(*c));
+    c->output_fd = -1;
+    return -1;
 }
 
 int composer_get_width(Composer *c) {
@@ -229,7 +443,45 @@ int composer_get_height(Composer *c) {
     return c->cfg.height;
 }
 
-void composer_write_header(Composer *c) {
+/* NALSinkFn writing to the output file descriptor */
+static int fd_sink(void *opaque, const uint8_t *data, size_t size) {
+    int fd = *(const int *)opaque;
+
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Hand a completed access unit to the output sink, if streaming */
+static void composer_flush_output(Composer *c) {
+    if (nal_writer_flush(&c->nw) < 0 && !c->output_error) {
+        fprintf(stderr, "Error: Failed to write %s\n", c->output_path);
+        c->output_error = 1;
+    }
+}
+
+int composer_write_header(Composer *c) {
+    /* Without a stream the whole output stays in memory */
+    if (c->output_fd < 0 && c->output_capacity < OUTPUT_BUFFER_SIZE) {
+        uint8_t *buffer = malloc(OUTPUT_BUFFER_SIZE);
+        if (!buffer) {
+            fprintf(stderr, "Error: Failed to allocate output buffer\n");
+            return -1;
+        }
+        free(c->output_buffer);
+        c->output_buffer = buffer;
+        c->output_capacity = OUTPUT_BUFFER_SIZE;
+        nal_writer_init(&c->nw, c->output_buffer, c->output_capacity,
+                        c->rbsp_temp, c->rbsp_capacity);
+    }
+
     /* Generate and write our SPS */
     size_t sps_size = h264_generate_sps(c->rbsp_temp, c->rbsp_capacity,
                                         c->cfg.width, c->cfg.height);
@@ -249,18 +501,448 @@ void composer_write_header(Composer *c) {
     h264_rewrite_as_non_idr_i_frame(&c->nw, &c->cfg, &c->parse_cfg,
                                      c->ref_b_rbsp, c->ref_b_size, 1);
 
+    composer_flush_output(c);
     printf("Header written: SPS + PPS + 2 reference frames\n");
+    return 0;
 }
 
 void composer_write_scroll_frame(Composer *c, int offset_px) {
-    /* Check if waypoint needed */
-    if (h264_needs_waypoint(&c->cfg, offset_px)) {
-        h264_write_waypoint_p_frame(&c->nw, &c->cfg, offset_px);
-        printf("  Waypoint at offset %d\n", offset_px);
+    composer_write_scroll_frame_qpel(c, offset_px * 4);
+}
+
+/* Offset a scroll frame at offset_qpel is written at, warning once when
+ * the waypoints do not reach it */
+static int composer_scroll_offset(Composer *c, const ComposerConfig *cfg, int offset_qpel) {
+    int clamped = h264_clamp_scroll_offset(cfg, offset_qpel);
+
+    if (clamped != offset_qpel && !c->warned_scroll_range) {
+        fprintf(stderr, "Warning: Scroll offset %.2f px is beyond the last waypoint's "
+                "reach; showing %.2f px\n", offset_qpel / 4.0, clamped / 4.0);
+        c->warned_scroll_range = 1;
+    }
+    return clamped;
+}
+
+/*
+ * Write the waypoint frames a frame at offset_qpel needs first, if any
+ *
+ * Returns the offset to write the frame at
+ */
+static int composer_write_waypoints(Composer *c, int offset_qpel) {
+    int waypoint_qpel;
+
+    while (h264_needs_waypoint(&c->cfg, offset_qpel, &waypoint_qpel)) {
+        h264_write_waypoint_p_frame(&c->nw, &c->cfg, waypoint_qpel);
+        composer_flush_output(c);
+        printf("  Waypoint at offset %d\n", waypoint_qpel / 4);
+    }
+    return composer_scroll_offset(c, &c->cfg, offset_qpel);
+}
+
+void composer_write_scroll_frame_qpel(Composer *c, int offset_qpel) {
+    offset_qpel = composer_write_waypoints(c, offset_qpel);
+
+    h264_write_scroll_p_frame(&c->nw, &c->cfg, offset_qpel);
+    c->frames_written++;
+    composer_flush_output(c);
+}
+
+/*
+ * Check that motion m (of what, e.g. "MB", number i) can be coded
+ *
+ * Returns 0 if so, -1 with an error printed if not
+ */
+static int composer_check_motion(Composer *c, const MBMotion *m, const char *what, int i) {
+    int num_refs = 2 + c->cfg.num_waypoints;
+
+    if (m->ref_idx == MB_REF_SKIP) {
+        return 0;
+    }
+    if (m->ref_idx < 0 || m->ref_idx >= num_refs) {
+        fprintf(stderr, "Error: %s %d references ref_idx %d of %d\n",
+                what, i, m->ref_idx, num_refs);
+        return -1;
+    }
+    if (m->mv_x < -MV_LIMIT_X_PX * 4 || m->mv_x >= MV_LIMIT_X_PX * 4 ||
+        m->mv_y < -MV_LIMIT_PX * 4 || m->mv_y > MV_LIMIT_PX * 4) {
+        fprintf(stderr, "Error: %s %d MV (%d, %d) beyond the hardware limits\n",
+                what, i, m->mv_x, m->mv_y);
+        return -1;
+    }
+    return 0;
+}
+
+int composer_write_motion_frame(Composer *c, const MBMotion *field,
+                                FrameMarking marking, int offset_qpel) {
+    int num_mbs = c->cfg.mb_width * c->cfg.mb_height;
+
+    if (marking == FRAME_MARK_LONG_TERM && c->cfg.num_waypoints >= MAX_WAYPOINTS) {
+        fprintf(stderr, "Error: No long-term reference left (max %d)\n", MAX_WAYPOINTS);
+        return -1;
+    }
+    /* The waypoint stands for this scroll offset */
+    if (marking == FRAME_MARK_LONG_TERM &&
+        (offset_qpel < 0 || offset_qpel > c->cfg.height * 4)) {
+        fprintf(stderr, "Error: Long-term frame offset %d outside 0..%d quarter pixels\n",
+                offset_qpel, c->cfg.height * 4);
+        return -1;
+    }
+
+    for (int i = 0; i < num_mbs; i++) {
+        if (composer_check_motion(c, &field[i], "MB", i) < 0) {
+            return -1;
+        }
+    }
+
+    h264_write_motion_p_frame(&c->nw, &c->cfg, field, marking, offset_qpel);
+    c->frames_written++;
+    composer_flush_output(c);
+    return 0;
+}
+
+/* Static and dynamic MBs are always valid; check the regions only */
+static int composer_check_regions(Composer *c, const RegionHints *hints) {
+    for (int i = 0; i < hints->num_motion_regions; i++) {
+        const MotionRegion *r = &hints->motion_regions[i];
+        MBMotion m = {r->ref_idx, r->mv_x, r->mv_y};
+        if (composer_check_motion(c, &m, "Region", i) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int composer_write_hinted_frame(Composer *c, const RegionHints *hints) {
+    if (composer_check_regions(c, hints) < 0) {
+        return -1;
+    }
+
+    region_hints_update(hints, &c->mb_map);
+    h264_write_incremental_p_frame(&c->nw, &c->cfg, &c->row_cache, c->mb_map.motion,
+                                   c->mb_map.dirty, FRAME_MARK_NONE, 0);
+    c->frames_written++;
+    composer_flush_output(c);
+    return 0;
+}
+
+/* Hand the dynamic encoder's access unit to the splicer */
+static int composer_load_dynamic(Composer *c, const uint8_t *au, size_t au_size) {
+    const MBMap *map = &c->mb_map;
+    NALUnit units[SPLICE_MAX_SLICES];
+    int num_units = 0;
+    NALParser parser;
+    NALUnit unit;
+
+    if (!map->has_dynamic) {
+        fprintf(stderr, "Error: Dynamic picture without a dynamic region\n");
+        return -1;
+    }
+
+    nal_parser_init(&parser, au, au_size);
+    while (nal_parser_next(&parser, &unit)) {
+        if (unit.nal_unit_type == NAL_TYPE_SPS || unit.nal_unit_type == NAL_TYPE_PPS) {
+            if (splicer_set_parameter_set(&c->splicer, &unit) < 0) {
+                return -1;
+            }
+        } else if (unit.nal_unit_type == NAL_TYPE_SLICE || unit.nal_unit_type == NAL_TYPE_IDR) {
+            /* Too many slices are counted for the splicer to refuse */
+            if (num_units < SPLICE_MAX_SLICES) {
+                units[num_units] = unit;
+            }
+            num_units++;
+        }
+    }
+
+    return splicer_load_picture(&c->splicer, units, num_units, map->dyn_x0, map->dyn_y0,
+                                map->dyn_x1, map->dyn_y1, c->cfg.dynamic_ref);
+}
+
+int composer_write_spliced_frame(Composer *c, const RegionHints *hints,
+                                 const uint8_t *au, size_t au_size) {
+    if (composer_check_regions(c, hints) < 0) {
+        return -1;
+    }
+
+    region_hints_update(hints, &c->mb_map);
+    if (composer_load_dynamic(c, au, au_size) < 0) {
+        /* The frame still goes out; P pictures wait for the next I picture */
+        c->cfg.dynamic_ref = 0;
+        h264_write_incremental_p_frame(&c->nw, &c->cfg, &c->row_cache, c->mb_map.motion,
+                                       c->mb_map.dirty, FRAME_MARK_NONE, 0);
+        c->frames_written++;
+        composer_flush_output(c);
+        return -1;
     }
 
-    h264_write_scroll_p_frame(&c->nw, &c->cfg, offset_px);
+    if (c->splicer.pps_changed) {
+        size_t pps_size = h264_generate_spliced_pps(c->rbsp_temp, c->rbsp_capacity,
+                                                    c->splicer.params.constrained_intra_pred_flag,
+                                                    c->splicer.params.chroma_qp_index_offset);
+        nal_write_unit(&c->nw, NAL_REF_IDC_HIGHEST, NAL_TYPE_PPS,
+                       c->rbsp_temp, pps_size, 1);
+        c->splicer.pps_changed = 0;
+    }
+
+    h264_write_spliced_p_frame(&c->nw, &c->cfg, &c->row_cache, c->mb_map.motion,
+                               c->mb_map.dirty, &c->splicer);
     c->frames_written++;
+    composer_flush_output(c);
+    return 0;
+}
+
+int composer_write_carousel_frame(Composer *c, int offset_qpel,
+                                  const ScrollBand *bands, int num_bands) {
+    for (int i = 0; i < num_bands; i++) {
+        const ScrollBand *band = &bands[i];
+
+        if (band->first_row < 0 || band->num_rows <= 0 ||
+            band->first_row + band->num_rows > c->cfg.mb_height) {
+            fprintf(stderr, "Error: Carousel band %d rows %d..%d outside 0..%d\n", i,
+                    band->first_row, band->first_row + band->num_rows - 1,
+                    c->cfg.mb_height - 1);
+            return -1;
+        }
+        if (band->offset_x_qpel < 0 || band->offset_x_qpel > c->cfg.width * 4) {
+            fprintf(stderr, "Error: Carousel band %d offset %d outside 0..%d quarter pixels\n",
+                    i, band->offset_x_qpel, c->cfg.width * 4);
+            return -1;
+        }
+        /* Columns from B exist as soon as the band has moved, columns
+         * from A until it has moved a whole MB short of the width */
+        if ((band->offset_x_qpel > 0 &&
+             c->cfg.width * 4 - band->offset_x_qpel > MV_LIMIT_X_PX * 4) ||
+            ((c->cfg.width * 4 - band->offset_x_qpel) / 64 > 0 &&
+             band->offset_x_qpel >= MV_LIMIT_X_PX * 4)) {
+            fprintf(stderr, "Error: Carousel band %d needs an MV beyond %d pixels\n",
+                    i, MV_LIMIT_X_PX);
+            return -1;
+        }
+        if (band->offset_y_qpel < -MV_LIMIT_PX * 4 || band->offset_y_qpel > MV_LIMIT_PX * 4) {
+            fprintf(stderr, "Error: Carousel band %d vertical offset beyond %d pixels\n",
+                    i, MV_LIMIT_PX);
+            return -1;
+        }
+    }
+
+    offset_qpel = composer_write_waypoints(c, offset_qpel);
+
+    h264_write_carousel_p_frame(&c->nw, &c->cfg, offset_qpel, bands, num_bands);
+    c->frames_written++;
+    composer_flush_output(c);
+    return 0;
+}
+
+/*
+ * Parallel frame generation
+ *
+ * Frames are planned in order on the calling thread: each job gets a
+ * snapshot of the encoder state it would have been written with. Workers
+ * then encode jobs into a ring of per-frame buffers, and the calling
+ * thread appends finished frames to the output in order. A worker only
+ * takes job j once job j - FRAME_RING_SIZE has been committed, so its
+ * ring slot is free.
+ */
+#define FRAME_RING_SIZE 64
+
+typedef struct {
+    ComposerConfig cfg;     /* Encoder state before this frame */
+    int offset_qpel;
+    int is_waypoint;
+} FrameJob;
+
+typedef struct {
+    const FrameJob *jobs;
+    int num_jobs;
+
+    uint8_t *slots;         /* FRAME_RING_SIZE frame buffers */
+    size_t slot_capacity;
+    size_t slot_size[FRAME_RING_SIZE];
+    int slot_done[FRAME_RING_SIZE];
+
+    int next_job;           /* Next job to hand to a worker */
+    int committed;          /* Jobs appended to the output */
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+} FramePool;
+
+typedef struct {
+    FramePool *pool;
+    ScratchArena scratch;   /* Working memory of this worker's frames */
+} FrameWorker;
+
+static void *frame_pool_worker(void *arg) {
+    FrameWorker *worker = arg;
+    FramePool *pool = worker->pool;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->next_job < pool->num_jobs &&
+               pool->next_job >= pool->committed + FRAME_RING_SIZE) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (pool->next_job >= pool->num_jobs) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        int j = pool->next_job++;
+        pthread_mutex_unlock(&pool->lock);
+
+        const FrameJob *job = &pool->jobs[j];
+        int slot = j % FRAME_RING_SIZE;
+        ComposerConfig cfg = job->cfg;
+        cfg.scratch = &worker->scratch;
+        NALWriter nw;
+        nal_writer_init(&nw, pool->slots + (size_t)slot * pool->slot_capacity,
+                        pool->slot_capacity, NULL, 0);
+
+        if (job->is_waypoint) {
+            h264_write_waypoint_p_frame(&nw, &cfg, job->offset_qpel);
+        } else {
+            h264_write_scroll_p_frame(&nw, &cfg, job->offset_qpel);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        pool->slot_size[slot] = nal_writer_get_size(&nw);
+        pool->slot_done[slot] = 1;
+        pthread_cond_broadcast(&pool->done_cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+int composer_write_scroll_frames(Composer *c, const int *offsets_qpel, int count,
+                                 int num_threads) {
+    if (num_threads <= 1) {
+        for (int i = 0; i < count; i++) {
+            composer_write_scroll_frame_qpel(c, offsets_qpel[i]);
+        }
+        return 0;
+    }
+
+    /* Plan: decide waypoints and snapshot state for every frame. The plan
+     * advances a copy of the state, kept only once every frame is written */
+    ComposerConfig cfg = c->cfg;
+    FrameJob *jobs = malloc(((size_t)count + MAX_WAYPOINTS) * sizeof(FrameJob));
+    if (!jobs) {
+        fprintf(stderr, "Error: Failed to allocate frame jobs\n");
+        return -1;
+    }
+
+    int num_jobs = 0;
+    for (int i = 0; i < count; i++) {
+        int waypoint_qpel;
+        while (h264_needs_waypoint(&cfg, offsets_qpel[i], &waypoint_qpel)) {
+            jobs[num_jobs].cfg = cfg;
+            jobs[num_jobs].offset_qpel = waypoint_qpel;
+            jobs[num_jobs].is_waypoint = 1;
+            num_jobs++;
+            h264_advance_frame_state(&cfg, waypoint_qpel, 1);
+            printf("  Waypoint at offset %d\n", waypoint_qpel / 4);
+        }
+
+        int offset_qpel = composer_scroll_offset(c, &cfg, offsets_qpel[i]);
+        jobs[num_jobs].cfg = cfg;
+        jobs[num_jobs].offset_qpel = offset_qpel;
+        jobs[num_jobs].is_waypoint = 0;
+        num_jobs++;
+        h264_advance_frame_state(&cfg, offset_qpel, 0);
+    }
+
+    /* The payload cache is not shared between threads, and frame workers
+     * encode their slices serially */
+    for (int i = 0; i < num_jobs; i++) {
+        jobs[i].cfg.frame_cache = NULL;
+        jobs[i].cfg.slice_pool = NULL;
+    }
+
+    FramePool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.jobs = jobs;
+    pool.num_jobs = num_jobs;
+    /* Worst case: uncompressed MB layer with emulation prevention, plus header */
+    pool.slot_capacity = h264_scroll_payload_capacity(&c->cfg) * 3 / 2 +
+                         1024 * (size_t)c->cfg.num_slices;
+    pool.slots = malloc(pool.slot_capacity * FRAME_RING_SIZE);
+    pthread_t *threads = malloc((size_t)num_threads * sizeof(pthread_t));
+    FrameWorker *workers = malloc((size_t)num_threads * sizeof(FrameWorker));
+    size_t scratch_size = h264_frame_scratch_size(&c->cfg);
+    uint8_t *scratch = malloc(scratch_size * num_threads);
+
+    if (!pool.slots || !threads || !workers || !scratch) {
+        fprintf(stderr, "Error: Failed to allocate frame buffers\n");
+        free(pool.slots);
+        free(threads);
+        free(workers);
+        free(scratch);
+        free(jobs);
+        return -1;
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].pool = &pool;
+        scratch_arena_init(&workers[i].scratch, scratch + scratch_size * i, scratch_size);
+    }
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.work_cond, NULL);
+    pthread_cond_init(&pool.done_cond, NULL);
+
+    int started = 0;
+    while (started < num_threads &&
+           pthread_create(&threads[started], NULL, frame_pool_worker,
+                          &workers[started]) == 0) {
+        started++;
+    }
+
+    int result = 0;
+    if (started == 0) {
+        fprintf(stderr, "Error: Failed to start worker threads\n");
+        result = -1;
+    }
+
+    /* Commit frames in order as they finish */
+    for (int j = 0; result == 0 && j < num_jobs; j++) {
+        int slot = j % FRAME_RING_SIZE;
+
+        pthread_mutex_lock(&pool.lock);
+        while (!pool.slot_done[slot]) {
+            pthread_cond_wait(&pool.done_cond, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        nal_writer_append(&c->nw, pool.slots + (size_t)slot * pool.slot_capacity,
+                          pool.slot_size[slot]);
+        if (!jobs[j].is_waypoint) {
+            c->frames_written++;
+        }
+        composer_flush_output(c);
+
+        pthread_mutex_lock(&pool.lock);
+        pool.slot_done[slot] = 0;
+        pool.committed++;
+        pthread_cond_broadcast(&pool.work_cond);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        /* Count worker heap fallbacks with the composer's */
+        c->scratch.allocations += workers[i].scratch.allocations;
+    }
+
+    pthread_cond_destroy(&pool.done_cond);
+    pthread_cond_destroy(&pool.work_cond);
+    pthread_mutex_destroy(&pool.lock);
+    free(pool.slots);
+    free(threads);
+    free(workers);
+    free(scratch);
+    free(jobs);
+    if (result == 0) {
+        c->cfg = cfg;
+    }
+    return result;
 }
 
 size_t composer_get_output_size(Composer *c) {
@@ -272,6 +954,11 @@ uint8_t *composer_get_output(Composer *c) {
 }
 
 int composer_write_to_file(Composer *c, const char *path) {
+    if (c->output_fd >= 0) {
+        fprintf(stderr, "Error: Output is streamed to %s\n", c->output_path);
+        return -1;
+    }
+
     FILE *f = fopen(path, "wb");
     if (!f) {
         fprintf(stderr, "Error: Cannot create %s\n", path);
@@ -290,11 +977,212 @@ int composer_write_to_file(Composer *c, const char *path) {
     return 0;
 }
 
+int composer_open_output(Composer *c, const char *path) {
+    if (nal_writer_get_total(&c->nw) > 0) {
+        fprintf(stderr, "Error: Output must be opened before writing\n");
+        return -1;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot create %s\n", path);
+        return -1;
+    }
+
+    c->output_fd = fd;
+    c->output_path = path;
+    c->output_error = 0;
+
+    nal_writer_init(&c->nw, c->output_buffer, c->output_capacity,
+                    c->rbsp_temp, c->rbsp_capacity);
+    nal_writer_set_sink(&c->nw, fd_sink, &c->output_fd);
+    return 0;
+}
+
+int composer_close_output(Composer *c) {
+    composer_flush_output(c);
+
+    if (close(c->output_fd) < 0 && !c->output_error) {
+        fprintf(stderr, "Error: Failed to write %s\n", c->output_path);
+        c->output_error = 1;
+    }
+    c->output_fd = -1;
+
+    if (c->output_error) {
+        return -1;
+    }
+    printf("Written %zu bytes to %s\n", nal_writer_get_total(&c->nw), c->output_path);
+    return 0;
+}
+
+int composer_build_clip_library(Composer *c, const char *path) {
+    /*
+     * The reference sets a scroll can have: A and B plus the first k
+     * waypoints, made in the same order by every scroll
+     */
+    ComposerConfig sets[MAX_WAYPOINTS + 1];
+    int num_sets = 1;
+    int waypoint_qpel;
+
+    sets[0] = c->cfg;
+    while (h264_needs_waypoint(&sets[num_sets - 1], c->cfg.height * 4, &waypoint_qpel)) {
+        sets[num_sets] = sets[num_sets - 1];
+        h264_advance_frame_state(&sets[num_sets], waypoint_qpel, 1);
+        num_sets++;
+    }
+
+    size_t capacity = h264_scroll_payload_capacity(&c->cfg);
+    ClipLibraryEntry *entries = NULL;
+    uint32_t num_entries = 0;
+    uint8_t *scratch = malloc(capacity);
+    uint8_t *data = NULL;
+    size_t data_size = 0;
+    int ok = scratch != NULL;
+
+    /* Every whole-pixel offset 0..height against each set that reaches it
+     * without another waypoint, and the waypoint frames themselves */
+    for (int offset_px = 0; ok && offset_px <= c->cfg.height; offset_px++) {
+        for (int k = 0; ok && k < num_sets; k++) {
+            const ComposerConfig *cfg = &sets[k];
+            int offset_qpel = offset_px * 4;
+            int needs = h264_needs_waypoint(cfg, offset_qpel, &waypoint_qpel);
+            if ((needs && waypoint_qpel != offset_qpel) ||
+                h264_clamp_scroll_offset(cfg, offset_qpel) != offset_qpel) {
+                continue;
+            }
+
+            FrameCacheKey key;
+            size_t num_bits = h264_render_scroll_payload(cfg, offset_qpel,
+                                                         scratch, capacity, &key);
+            size_t nbytes = (num_bits + 7) / 8;
+
+            uint8_t *p = realloc(data, data_size + nbytes);
+            ClipLibraryEntry *e = realloc(entries, (num_entries + 1) * sizeof(ClipLibraryEntry));
+            if (p) {
+                data = p;
+            }
+            if (e) {
+                entries = e;
+            }
+            if (!p || !e) {
+                ok = 0;
+                break;
+            }
+            memcpy(data + data_size, scratch, nbytes);
+
+            memset(&entries[num_entries], 0, sizeof(ClipLibraryEntry));
+            entries[num_entries].offset_qpel = key.offset_qpel;
+            entries[num_entries].ref_set = key.ref_set;
+            entries[num_entries].mv_hash = key.mv_hash;
+            entries[num_entries].data_offset = data_size;
+            entries[num_entries].num_bits = num_bits;
+            num_entries++;
+            data_size += nbytes;
+        }
+    }
+
+    int result = -1;
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to allocate clip library buffers\n");
+    } else {
+        result = clip_library_write(path, c->cfg.width, c->cfg.height,
+                                    entries, num_entries, data, data_size);
+    }
+
+    if (result == 0) {
+        printf("Clip library: %u payloads for %d reference sets, %zu payload bytes "
+               "written to %s\n", num_entries, num_sets, data_size, path);
+    }
+
+    free(entries);
+    free(scratch);
+    free(data);
+    return result;
+}
+
+int composer_load_clip_library(Composer *c, const char *path) {
+    if (clip_library_open(&c->clip_library, path, c->cfg.width, c->cfg.height) < 0) {
+        return -1;
+    }
+    c->cfg.clip_library = &c->clip_library;
+
+    printf("Clip library: %u payloads from %s\n",
+           c->clip_library.header->num_entries, path);
+    return 0;
+}
+
+int composer_set_slices(Composer *c, int num_slices) {
+    if (num_slices < 1 || num_slices > c->cfg.mb_height) {
+        fprintf(stderr, "Error: Slice count must be 1..%d\n", c->cfg.mb_height);
+        return -1;
+    }
+
+    /* Drop the pool of an earlier call; slices are encoded serially without one */
+    if (c->cfg.slice_pool) {
+        worker_pool_free(&c->slice_pool);
+        c->cfg.slice_pool = NULL;
+    }
+
+    c->cfg.num_slices = num_slices;
+    if (composer_alloc_scratch(c) < 0) {
+        return -1;
+    }
+    if (num_slices == 1) {
+        return 0;
+    }
+
+    /* The calling thread encodes one slice itself */
+    if (worker_pool_init(&c->slice_pool, num_slices - 1) < 0) {
+        return -1;
+    }
+    c->cfg.slice_pool = &c->slice_pool;
+
+    printf("Encoding %d slices per P-frame\n", num_slices);
+    return 0;
+}
+
+void composer_print_stats(Composer *c) {
+    if (c->cfg.clip_library) {
+        printf("Clip library: %llu/%llu hits\n",
+               (unsigned long long)c->clip_library.hits,
+               (unsigned long long)c->clip_library.lookups);
+    }
+    frame_cache_print_stats(&c->frame_cache);
+    printf("Scratch arena: %zu/%zu bytes peak, %llu heap fallbacks\n",
+           c->scratch.high_water, c->scratch.capacity,
+           (unsigned long long)c->scratch.allocations);
+    if (c->row_cache.rows_encoded > 0) {
+        printf("Hinted rows: %llu encoded, %llu reused\n",
+               (unsigned long long)c->row_cache.rows_encoded,
+               (unsigned long long)c->row_cache.rows_reused);
+    }
+    if (c->splicer.mbs_spliced > 0) {
+        printf("Spliced: %llu passthrough, %llu merged frames, %llu MBs\n",
+               (unsigned long long)c->splicer.frames_passthrough,
+               (unsigned long long)c->splicer.frames_merged,
+               (unsigned long long)c->splicer.mbs_spliced);
+    }
+}
+
+uint64_t composer_get_frame_allocations(Composer *c) {
+    return c->scratch.allocations + c->frame_cache.allocations;
+}
+
 void composer_finish(Composer *c) {
-    free(c->ref_a_rbsp);
-    free(c->ref_b_rbsp);
-    free(c->orig_sps);
-    free(c->orig_pps);
+    if (c->cfg.slice_pool) {
+        worker_pool_free(&c->slice_pool);
+    }
+    if (c->output_fd >= 0) {
+        close(c->output_fd);
+    }
+    clip_library_close(&c->clip_library);
+    frame_cache_free(&c->frame_cache);
+    scratch_arena_reset(&c->scratch);
+    free(c->scratch_buffer);
+    mb_map_free(&c->mb_map);
+    row_cache_free(&c->row_cache);
+    splicer_free(&c->splicer);
+    free(c->ref_rbsp);
     free(c->output_buffer);
     free(c->rbsp_temp);
     memset(c, 0, sizeof(*c));
@@ -0,0 +1,104 @@
+#include "frame_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int frame_cache_init(FrameCache *fc, int num_entries) {
+    memset(fc, 0, sizeof(*fc));
+
+    fc->entries = calloc((size_t)num_entries, sizeof(FrameCacheEntry));
+    if (!fc->entries) {
+        return -1;
+    }
+    fc->num_entries = num_entries;
+    return 0;
+}
+
+void frame_cache_free(FrameCache *fc) {
+    for (int i = 0; i < fc->num_entries; i++) {
+        free(fc->entries[i].bits);
+    }
+    free(fc->entries);
+    memset(fc, 0, sizeof(*fc));
+}
+
+uint64_t frame_cache_hash(uint64_t seed, const void *data, size_t size) {
+    const uint8_t *p = data;
+    uint64_t h = seed;
+
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int key_equal(const FrameCacheKey *a, const FrameCacheKey *b) {
+    return a->offset_qpel == b->offset_qpel &&
+           a->ref_set == b->ref_set &&
+           a->mv_hash == b->mv_hash;
+}
+
+const FrameCacheEntry *frame_cache_lookup(FrameCache *fc, const FrameCacheKey *key) {
+    fc->lookups++;
+    fc->clock++;
+
+    for (int i = 0; i < fc->num_entries; i++) {
+        FrameCacheEntry *e = &fc->entries[i];
+        if (e->valid && key_equal(&e->key, key)) {
+            e->last_used = fc->clock;
+            fc->hits++;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+int frame_cache_insert(FrameCache *fc, const FrameCacheKey *key,
+                       const uint8_t *bits, size_t num_bits) {
+    /* Free slot, or the least recently used one */
+    FrameCacheEntry *victim = &fc->entries[0];
+    for (int i = 0; i < fc->num_entries; i++) {
+        FrameCacheEntry *e = &fc->entries[i];
+        if (!e->valid) {
+            victim = e;
+            break;
+        }
+        if (e->last_used < victim->last_used) {
+            victim = e;
+        }
+    }
+
+    size_t size = (num_bits + 7) / 8;
+    if (!victim->bits || victim->capacity < size) {
+        uint8_t *buf = malloc(size ? size : 1);
+        if (!buf) {
+            return -1;
+        }
+        free(victim->bits);
+        victim->bits = buf;
+        victim->capacity = size;
+        fc->allocations++;
+    }
+    memcpy(victim->bits, bits, size);
+
+    if (victim->valid) {
+        fc->evictions++;
+    }
+
+    victim->key = *key;
+    victim->num_bits = num_bits;
+    victim->last_used = fc->clock;
+    victim->valid = 1;
+    return 0;
+}
+
+void frame_cache_print_stats(const FrameCache *fc) {
+    double rate = fc->lookups ? 100.0 * (double)fc->hits / (double)fc->lookups : 0.0;
+
+    printf("Payload cache: %llu/%llu hits (%.1f%%), %llu evictions, %llu MBs reused, "
+           "%llu buffers allocated\n",
+           (unsigned long long)fc->hits, (unsigned long long)fc->lookups, rate,
+           (unsigned long long)fc->evictions, (unsigned long long)fc->mbs_reused,
+           (unsigned long long)fc->allocations);
+}
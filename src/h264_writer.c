@@ -1,13 +1,15 @@
 #include "h264_writer.h"
+#include "bitreader.h"
+#include "splicer.h"
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
 
 /* Forward declarations */
-static void h264_write_p_slice_header(BitWriter *bw, ComposerConfig *cfg,
+static void h264_write_p_slice_header(BitWriter *bw, ComposerConfig *cfg, int first_mb,
                                        int frame_num, int poc_lsb, int is_reference);
 static void h264_write_p_slice_header_waypoint(BitWriter *bw, ComposerConfig *cfg,
-                                                int frame_num, int poc_lsb,
+                                                int first_mb, int frame_num, int poc_lsb,
                                                 int is_reference, int long_term_idx);
 
 void composer_config_init(ComposerConfig *cfg, int width, int height) {
@@ -18,6 +20,7 @@ void composer_config_init(ComposerConfig *cfg, int width, int height) {
     cfg->mb_height = height / 16;
     cfg->frame_num = 0;
     cfg->idr_pic_id = 0;
+    cfg->num_slices = 1;
 
     /* Defaults - will be overridden when parsing external SPS */
     cfg->log2_max_frame_num = 4;
@@ -71,8 +74,8 @@ size_t h264_generate_sps(uint8_t *rbsp, size_t capacity, int width, int height)
     /* pic_order_cnt_type: ue(2) */
     bitwriter_write_ue(&bw, 2);
 
-    /* max_num_ref_frames: ue(v) - 2 base refs + waypoints */
-    bitwriter_write_ue(&bw, 2 + MAX_WAYPOINTS);
+    /* max_num_ref_frames: ue(v) - 2 base refs + waypoints + dynamic ref */
+    bitwriter_write_ue(&bw, DYNAMIC_LONG_TERM_IDX + 1);
 
     /* gaps_in_frame_num_value_allowed_flag: u(1) = 0 */
     bitwriter_write_bit(&bw, 0);
@@ -99,14 +102,12 @@ size_t h264_generate_sps(uint8_t *rbsp, size_t capacity, int width, int height)
     return bitwriter_get_size(&bw);
 }
 
-/*
- * Generate minimal PPS for Baseline profile
- */
-size_t h264_generate_pps(uint8_t *rbsp, size_t capacity) {
+static size_t generate_pps(uint8_t *rbsp, size_t capacity, int pps_id,
+                           int constrained_intra_pred_flag, int chroma_qp_index_offset) {
     BitWriter bw;
     bitwriter_init(&bw, rbsp, capacity);
 
-    bitwriter_write_ue(&bw, 0);  /* pps_id */
+    bitwriter_write_ue(&bw, pps_id);  /* pps_id */
     bitwriter_write_ue(&bw, 0);  /* sps_id */
     bitwriter_write_bit(&bw, 0); /* entropy_coding_mode_flag (CAVLC) */
     bitwriter_write_bit(&bw, 0); /* bottom_field_pic_order_in_frame_present_flag */
@@ -117,15 +118,28 @@ size_t h264_generate_pps(uint8_t *rbsp, size_t capacity) {
     bitwriter_write_bits(&bw, 0, 2); /* weighted_bipred_idc */
     bitwriter_write_se(&bw, 0);  /* pic_init_qp_minus26 */
     bitwriter_write_se(&bw, 0);  /* pic_init_qs_minus26 */
-    bitwriter_write_se(&bw, 0);  /* chroma_qp_index_offset */
+    bitwriter_write_se(&bw, chroma_qp_index_offset);
     bitwriter_write_bit(&bw, 1); /* deblocking_filter_control_present_flag */
-    bitwriter_write_bit(&bw, 0); /* constrained_intra_pred_flag */
+    bitwriter_write_bit(&bw, constrained_intra_pred_flag);
     bitwriter_write_bit(&bw, 0); /* redundant_pic_cnt_present_flag */
 
     bitwriter_write_trailing_bits(&bw);
     return bitwriter_get_size(&bw);
 }
 
+/*
+ * Generate minimal PPS for Baseline profile
+ */
+size_t h264_generate_pps(uint8_t *rbsp, size_t capacity) {
+    return generate_pps(rbsp, capacity, 0, 0, 0);
+}
+
+size_t h264_generate_spliced_pps(uint8_t *rbsp, size_t capacity,
+                                 int constrained_intra_pred_flag, int chroma_qp_index_offset) {
+    return generate_pps(rbsp, capacity, SPLICED_PPS_ID, constrained_intra_pred_flag,
+                        chroma_qp_index_offset);
+}
+
 /* ============================================================================
  * Slice Header Parsing and Rewriting
  * ============================================================================ */
@@ -138,107 +152,40 @@ typedef struct {
     int32_t slice_beta_offset_div2;
 } ParsedSliceHeader;
 
-/* Simple bit reader for parsing */
-typedef struct {
-    const uint8_t *data;
-    size_t size;
-    size_t byte_pos;
-    int bit_pos;
-} SliceBitReader;
-
-static void sbreader_init(SliceBitReader *br, const uint8_t *data, size_t size) {
-    br->data = data;
-    br->size = size;
-    br->byte_pos = 0;
-    br->bit_pos = 0;
-}
-
-static int sbreader_read_bit(SliceBitReader *br) {
-    if (br->byte_pos >= br->size) return 0;
-    int bit = (br->data[br->byte_pos] >> (7 - br->bit_pos)) & 1;
-    br->bit_pos++;
-    if (br->bit_pos == 8) {
-        br->bit_pos = 0;
-        br->byte_pos++;
-    }
-    return bit;
-}
-
-static uint32_t sbreader_read_bits(SliceBitReader *br, int n) {
-    uint32_t value = 0;
-    for (int i = 0; i < n; i++) {
-        value = (value << 1) | sbreader_read_bit(br);
-    }
-    return value;
-}
-
-static uint32_t sbreader_read_ue(SliceBitReader *br) {
-    int leading_zeros = 0;
-    while (sbreader_read_bit(br) == 0 && leading_zeros < 32) {
-        leading_zeros++;
-    }
-    if (leading_zeros == 0) return 0;
-    return (1 << leading_zeros) - 1 + sbreader_read_bits(br, leading_zeros);
-}
-
-static int32_t sbreader_read_se(SliceBitReader *br) {
-    uint32_t ue = sbreader_read_ue(br);
-    if (ue & 1) return (int32_t)((ue + 1) / 2);
-    return -(int32_t)(ue / 2);
-}
-
-static size_t sbreader_get_bit_position(SliceBitReader *br) {
-    return br->byte_pos * 8 + br->bit_pos;
-}
-
 static int parse_idr_slice_header(const uint8_t *rbsp, size_t rbsp_size,
                                    ComposerConfig *cfg, ParsedSliceHeader *hdr) {
-    SliceBitReader br;
-    sbreader_init(&br, rbsp, rbsp_size);
+    BitReader br;
+    bitreader_init(&br, rbsp, rbsp_size);
     memset(hdr, 0, sizeof(*hdr));
 
-    sbreader_read_ue(&br);  /* first_mb_in_slice */
-    sbreader_read_ue(&br);  /* slice_type */
-    sbreader_read_ue(&br);  /* pps_id */
-    sbreader_read_bits(&br, cfg->log2_max_frame_num);  /* frame_num */
-    sbreader_read_ue(&br);  /* idr_pic_id */
+    bitreader_read_ue(&br);  /* first_mb_in_slice */
+    bitreader_read_ue(&br);  /* slice_type */
+    bitreader_read_ue(&br);  /* pps_id */
+    bitreader_read_bits(&br, cfg->log2_max_frame_num);  /* frame_num */
+    bitreader_read_ue(&br);  /* idr_pic_id */
 
     if (cfg->pic_order_cnt_type == 0) {
-        sbreader_read_bits(&br, cfg->log2_max_pic_order_cnt_lsb);
+        bitreader_read_bits(&br, cfg->log2_max_pic_order_cnt_lsb);
     }
 
     /* dec_ref_pic_marking for IDR */
-    sbreader_read_bit(&br);  /* no_output_of_prior_pics_flag */
-    sbreader_read_bit(&br);  /* long_term_reference_flag */
+    bitreader_read_bit(&br);  /* no_output_of_prior_pics_flag */
+    bitreader_read_bit(&br);  /* long_term_reference_flag */
 
-    hdr->slice_qp_delta = sbreader_read_se(&br);
+    hdr->slice_qp_delta = bitreader_read_se(&br);
 
     if (cfg->deblocking_filter_control_present_flag) {
-        hdr->disable_deblocking_filter_idc = sbreader_read_ue(&br);
+        hdr->disable_deblocking_filter_idc = bitreader_read_ue(&br);
         if (hdr->disable_deblocking_filter_idc != 1) {
-            hdr->slice_alpha_c0_offset_div2 = sbreader_read_se(&br);
-            hdr->slice_beta_offset_div2 = sbreader_read_se(&br);
+            hdr->slice_alpha_c0_offset_div2 = bitreader_read_se(&br);
+            hdr->slice_beta_offset_div2 = bitreader_read_se(&br);
         }
     }
 
-    hdr->mb_data_start_bit = sbreader_get_bit_position(&br);
+    hdr->mb_data_start_bit = bitreader_get_bit_position(&br);
     return 1;
 }
 
-static void copy_bits(BitWriter *bw, const uint8_t *src, size_t src_size,
-                       size_t start_bit, size_t num_bits) {
-    SliceBitReader br;
-    sbreader_init(&br, src, src_size);
-
-    for (size_t i = 0; i < start_bit; i++) {
-        sbreader_read_bit(&br);
-    }
-
-    for (size_t i = 0; i < num_bits; i++) {
-        bitwriter_write_bit(bw, sbreader_read_bit(&br));
-    }
-}
-
 size_t h264_rewrite_idr_frame(NALWriter *nw, ComposerConfig *write_cfg,
                                ComposerConfig *parse_cfg,
                                const uint8_t *rbsp, size_t rbsp_size) {
@@ -250,10 +197,8 @@ size_t h264_rewrite_idr_frame(NALWriter *nw, ComposerConfig *write_cfg,
     size_t total_bits = rbsp_size * 8;
     size_t mb_data_bits = total_bits - hdr.mb_data_start_bit;
 
-    size_t out_capacity = rbsp_size + 256;
-    uint8_t *out_rbsp = malloc(out_capacity);
     BitWriter bw;
-    bitwriter_init(&bw, out_rbsp, out_capacity);
+    nal_begin_unit(nw, &bw, NAL_REF_IDC_HIGHEST, NAL_TYPE_IDR, 1);
 
     /* Write our IDR slice header */
     bitwriter_write_ue(&bw, 0);  /* first_mb_in_slice */
@@ -282,13 +227,10 @@ size_t h264_rewrite_idr_frame(NALWriter *nw, ComposerConfig *write_cfg,
     }
 
     /* Copy MB data */
-    copy_bits(&bw, rbsp, rbsp_size, hdr.mb_data_start_bit, mb_data_bits);
+    bitwriter_copy_bits(&bw, rbsp, rbsp_size, hdr.mb_data_start_bit, mb_data_bits);
 
-    size_t out_size = bitwriter_get_size(&bw);
-    size_t written = nal_write_unit(nw, NAL_REF_IDC_HIGHEST, NAL_TYPE_IDR,
-                                    out_rbsp, out_size, 1);
+    size_t written = nal_end_unit(nw, &bw);
 
-    free(out_rbsp);
     write_cfg->frame_num = 1;
     return written;
 }
@@ -305,10 +247,8 @@ size_t h264_rewrite_as_non_idr_i_frame(NALWriter *nw, ComposerConfig *write_cfg,
     size_t total_bits = rbsp_size * 8;
     size_t mb_data_bits = total_bits - hdr.mb_data_start_bit;
 
-    size_t out_capacity = rbsp_size + 256;
-    uint8_t *out_rbsp = malloc(out_capacity);
     BitWriter bw;
-    bitwriter_init(&bw, out_rbsp, out_capacity);
+    nal_begin_unit(nw, &bw, NAL_REF_IDC_HIGHEST, NAL_TYPE_SLICE, 1);
 
     /* Write non-IDR I-slice header */
     bitwriter_write_ue(&bw, 0);  /* first_mb_in_slice */
@@ -338,13 +278,10 @@ size_t h264_rewrite_as_non_idr_i_frame(NALWriter *nw, ComposerConfig *write_cfg,
         }
     }
 
-    copy_bits(&bw, rbsp, rbsp_size, hdr.mb_data_start_bit, mb_data_bits);
+    bitwriter_copy_bits(&bw, rbsp, rbsp_size, hdr.mb_data_start_bit, mb_data_bits);
 
-    size_t out_size = bitwriter_get_size(&bw);
-    size_t written = nal_write_unit(nw, NAL_REF_IDC_HIGHEST, NAL_TYPE_SLICE,
-                                    out_rbsp, out_size, 1);
+    size_t written = nal_end_unit(nw, &bw);
 
-    free(out_rbsp);
     write_cfg->frame_num = frame_num + 1;
     return written;
 }
@@ -353,16 +290,15 @@ size_t h264_rewrite_as_non_idr_i_frame(NALWriter *nw, ComposerConfig *write_cfg,
  * P-Frame Generation
  * ============================================================================ */
 
-typedef struct {
+struct MVInfo {
     int mv_x, mv_y;
     int ref_idx;
     int available;
-} MVInfo;
+};
 
 static int median3(int a, int b, int c) {
     if (a > b) { int t = a; a = b; b = t; }
     if (b > c) { b = c; }
-    if (a > b) { a = b; }
     return b > a ? b : a;
 }
 
@@ -406,8 +342,9 @@ static void get_mv_prediction(int mb_x, int mb_y, int mb_width,
         *pred_mvy = 0;
     } else if (num_available == 1) {
         if (a.available) {
-            *pred_mvx = a_ref_match ? a.mv_x : 0;
-            *pred_mvy = a_ref_match ? a.mv_y : 0;
+            /* B and C take A's values, so the median is A (8.4.1.3) */
+            *pred_mvx = a.mv_x;
+            *pred_mvy = a.mv_y;
         } else if (b.available) {
             *pred_mvx = b_ref_match ? b.mv_x : 0;
             *pred_mvy = b_ref_match ? b.mv_y : 0;
@@ -452,9 +389,247 @@ static void write_p16x16_mb(BitWriter *bw, int ref_idx, int mvd_x, int mvd_y, in
     bitwriter_write_ue(bw, 0);
 }
 
-static void h264_write_p_slice_header(BitWriter *bw, ComposerConfig *cfg,
+/*
+ * P_Skip motion vector (H.264 8.4.1.1)
+ *
+ * Zero if A or B is unavailable, or if either is ref 0 with a zero MV;
+ * otherwise the ref 0 prediction.
+ */
+static void get_skip_mv(int mb_x, int mb_y, int mb_width,
+                        const MVInfo *above_row, const MVInfo *left,
+                        int *skip_mvx, int *skip_mvy) {
+    int a_available = mb_x > 0 && left->available;
+    int b_available = mb_y > 0 && above_row[mb_x].available;
+
+    if (!a_available || !b_available ||
+        (left->ref_idx == 0 && left->mv_x == 0 && left->mv_y == 0) ||
+        (above_row[mb_x].ref_idx == 0 && above_row[mb_x].mv_x == 0 &&
+         above_row[mb_x].mv_y == 0)) {
+        *skip_mvx = 0;
+        *skip_mvy = 0;
+        return;
+    }
+
+    get_mv_prediction(mb_x, mb_y, mb_width, above_row, left, 0, skip_mvx, skip_mvy);
+}
+
+/*
+ * Write one inter MB with a single 16x16 MV (quarter-pel)
+ *
+ * An MB on ref 0 whose MV equals the P_Skip MV is skipped: it only
+ * extends the pending mb_skip_run. Otherwise the run is flushed and a
+ * P_L0_16x16 is written. ref_idx MB_REF_SKIP skips unconditionally.
+ * The MB's motion is recorded in current_row and left either way, since
+ * skipped MBs predict their neighbours too.
+ */
+static void write_inter_mb(BitWriter *bw, int mb_x, int mb_y, int mb_width,
+                           const MVInfo *above_row, MVInfo *current_row, MVInfo *left,
+                           int ref_idx, int mv_x, int mv_y, int num_refs,
+                           int *skip_count) {
+    int skip_mvx, skip_mvy;
+    get_skip_mv(mb_x, mb_y, mb_width, above_row, left, &skip_mvx, &skip_mvy);
+
+    if (ref_idx == MB_REF_SKIP) {
+        ref_idx = 0;
+        mv_x = skip_mvx;
+        mv_y = skip_mvy;
+    }
+
+    if (ref_idx == 0 && mv_x == skip_mvx && mv_y == skip_mvy) {
+        (*skip_count)++;
+    } else {
+        int pred_mvx, pred_mvy;
+        get_mv_prediction(mb_x, mb_y, mb_width, above_row, left,
+                          ref_idx, &pred_mvx, &pred_mvy);
+
+        bitwriter_write_ue(bw, *skip_count);
+        *skip_count = 0;
+        write_p16x16_mb(bw, ref_idx, mv_x - pred_mvx, mv_y - pred_mvy, num_refs);
+    }
+
+    current_row[mb_x].mv_x = mv_x;
+    current_row[mb_x].mv_y = mv_y;
+    current_row[mb_x].ref_idx = ref_idx;
+    current_row[mb_x].available = 1;
+    *left = current_row[mb_x];
+}
+
+/*
+ * Row bit-templates
+ *
+ * A scroll row has one ref/MV for every MB. With the row above it also
+ * uniform, the row's MB layer bits depend only on those two motions, so
+ * they are encoded once per frame and replayed with a bulk bit copy.
+ * The skip run in front of the row's first coded MB depends on the rows
+ * before it, so it is rewritten on every replay.
+ */
+#define ROW_TEMPLATE_SLOTS  4
+#define ROW_TEMPLATE_MB_BYTES 16   /* Worst-case bytes per MB incl. skip run */
+
+struct RowTemplate {
+    int valid;
+    MVInfo row;             /* Motion of every MB in the row */
+    MVInfo above;           /* Motion of the row above (available = 0 on row 0) */
+    uint8_t *bits;          /* ue(lead_skips) + rest of the row */
+    size_t capacity;
+    size_t num_bits;
+    int lead_skips;         /* Skipped MBs before the first coded MB (mb_width if none) */
+    int lead_bits;          /* Length of ue(lead_skips) at the start of bits */
+    int trail_skips;        /* Skipped MBs after the last coded MB */
+};
+
+typedef struct {
+    RowTemplate slots[ROW_TEMPLATE_SLOTS];
+    int next_slot;
+    uint8_t *storage;
+} RowTemplateCache;
+
+/* Bytes of one template's bits */
+static size_t row_template_capacity(int mb_width) {
+    return (size_t)mb_width * ROW_TEMPLATE_MB_BYTES + 16;
+}
+
+static int row_template_cache_init(RowTemplateCache *cache, int mb_width,
+                                   ScratchArena *arena) {
+    size_t capacity = row_template_capacity(mb_width);
+
+    memset(cache, 0, sizeof(*cache));
+    cache->storage = scratch_arena_alloc(arena, capacity * ROW_TEMPLATE_SLOTS);
+    if (!cache->storage) {
+        return -1;
+    }
+    for (int i = 0; i < ROW_TEMPLATE_SLOTS; i++) {
+        cache->slots[i].bits = cache->storage + capacity * i;
+        cache->slots[i].capacity = capacity;
+    }
+    return 0;
+}
+
+static int mvinfo_equal(const MVInfo *a, const MVInfo *b) {
+    return a->available == b->available &&
+           (!a->available ||
+            (a->ref_idx == b->ref_idx && a->mv_x == b->mv_x && a->mv_y == b->mv_y));
+}
+
+/* Bits in ue(value) */
+static int ue_length(unsigned value) {
+    int len = 1;
+    for (value++; value > 1; value >>= 1) {
+        len += 2;
+    }
+    return len;
+}
+
+/*
+ * Encode a row into a template slot through the per-MB path, MB mb_x
+ * with motion mbs[mb_x * stride] (stride 0 for a uniform row)
+ */
+static void row_template_build(RowTemplate *t, int mb_y, int mb_width,
+                               const MVInfo *above_row, MVInfo *current_row,
+                               const MVInfo *mbs, int stride, int num_refs) {
+    BitWriter tw;
+    MVInfo left = {0};
+    int skip_count = 0;
+
+    bitwriter_init(&tw, t->bits, t->capacity);
+    t->lead_skips = mb_width;
+
+    for (int mb_x = 0; mb_x < mb_width; mb_x++) {
+        const MVInfo *m = &mbs[mb_x * stride];
+        int coded_before = t->lead_skips < mb_width;
+        write_inter_mb(&tw, mb_x, mb_y, mb_width, above_row, current_row, &left,
+                       m->ref_idx, m->mv_x, m->mv_y, num_refs, &skip_count);
+        if (!coded_before && skip_count == 0) {
+            t->lead_skips = mb_x;
+        }
+    }
+
+    t->num_bits = bitwriter_get_bit_position(&tw);
+    bitwriter_flush(&tw);
+    t->lead_bits = t->lead_skips < mb_width ? ue_length(t->lead_skips) : 0;
+    t->trail_skips = skip_count;
+}
+
+/* Write a row from its template, after the skip run pending before it */
+static void row_template_replay(BitWriter *bw, const RowTemplate *t, int mb_width,
+                                int *skip_count) {
+    if (t->lead_skips == mb_width) {
+        *skip_count += mb_width;
+        return;
+    }
+
+    bitwriter_write_ue(bw, *skip_count + t->lead_skips);
+    bitwriter_copy_bits(bw, t->bits, t->capacity, t->lead_bits, t->num_bits - t->lead_bits);
+    *skip_count = t->trail_skips;
+}
+
+/*
+ * Write a row whose MBs all have the same motion, below a row that is
+ * also uniform (above->available = 0 for the first row)
+ */
+static void write_uniform_row(BitWriter *bw, RowTemplateCache *cache,
+                              int mb_y, int mb_width,
+                              const MVInfo *above_row, MVInfo *current_row,
+                              const MVInfo *row, const MVInfo *above,
+                              int num_refs, int *skip_count) {
+    RowTemplate *t = NULL;
+
+    for (int i = 0; i < ROW_TEMPLATE_SLOTS; i++) {
+        RowTemplate *slot = &cache->slots[i];
+        if (slot->valid && mvinfo_equal(&slot->row, row) && mvinfo_equal(&slot->above, above)) {
+            t = slot;
+            break;
+        }
+    }
+
+    if (t) {
+        for (int mb_x = 0; mb_x < mb_width; mb_x++) {
+            current_row[mb_x] = *row;
+        }
+    } else {
+        t = &cache->slots[cache->next_slot];
+        cache->next_slot = (cache->next_slot + 1) % ROW_TEMPLATE_SLOTS;
+        row_template_build(t, mb_y, mb_width, above_row, current_row, row, 0, num_refs);
+        t->valid = 1;
+        t->row = *row;
+        t->above = *above;
+    }
+
+    row_template_replay(bw, t, mb_width, skip_count);
+}
+
+/* Write a row MB by MB, each with its own motion (mbs[mb_x]) */
+static void write_mixed_row(BitWriter *bw, int mb_y, int mb_width,
+                            const MVInfo *above_row, MVInfo *current_row,
+                            const MVInfo *mbs, int num_refs, int *skip_count) {
+    MVInfo left = {0};
+
+    for (int mb_x = 0; mb_x < mb_width; mb_x++) {
+        write_inter_mb(bw, mb_x, mb_y, mb_width, above_row, current_row, &left,
+                       mbs[mb_x].ref_idx, mbs[mb_x].mv_x, mbs[mb_x].mv_y, num_refs,
+                       skip_count);
+    }
+}
+
+/*
+ * Whether every MB of a field row has the same motion (a row of
+ * MB_REF_SKIP resolves MB by MB, so it never counts as uniform)
+ */
+static int row_is_uniform(const MVInfo *mbs, int mb_width) {
+    if (mbs[0].ref_idx == MB_REF_SKIP) {
+        return 0;
+    }
+    for (int mb_x = 1; mb_x < mb_width; mb_x++) {
+        if (!mvinfo_equal(&mbs[mb_x], &mbs[0])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void h264_write_p_slice_header(BitWriter *bw, ComposerConfig *cfg, int first_mb,
                                        int frame_num, int poc_lsb, int is_reference) {
-    bitwriter_write_ue(bw, 0);  /* first_mb_in_slice */
+    bitwriter_write_ue(bw, first_mb);  /* first_mb_in_slice */
     bitwriter_write_ue(bw, SLICE_TYPE_P);
     bitwriter_write_ue(bw, 0);  /* pps_id */
 
@@ -488,9 +663,9 @@ static void h264_write_p_slice_header(BitWriter *bw, ComposerConfig *cfg,
 }
 
 static void h264_write_p_slice_header_waypoint(BitWriter *bw, ComposerConfig *cfg,
-                                                int frame_num, int poc_lsb,
+                                                int first_mb, int frame_num, int poc_lsb,
                                                 int is_reference, int long_term_idx) {
-    bitwriter_write_ue(bw, 0);
+    bitwriter_write_ue(bw, first_mb);
     bitwriter_write_ue(bw, SLICE_TYPE_P);
     bitwriter_write_ue(bw, 0);
 
@@ -521,8 +696,10 @@ static void h264_write_p_slice_header_waypoint(BitWriter *bw, ComposerConfig *cf
     if (is_reference) {
         if (long_term_idx >= 0) {
             bitwriter_write_bit(bw, 1);
+            /* Keep the dynamic reference past the waypoints */
             bitwriter_write_ue(bw, 4);
-            bitwriter_write_ue(bw, long_term_idx + 1);
+            bitwriter_write_ue(bw, cfg->dynamic_ref ? DYNAMIC_LONG_TERM_IDX + 1
+                                                    : long_term_idx + 1);
             bitwriter_write_ue(bw, 6);
             bitwriter_write_ue(bw, long_term_idx);
             bitwriter_write_ue(bw, 0);
@@ -538,31 +715,428 @@ static void h264_write_p_slice_header_waypoint(BitWriter *bw, ComposerConfig *cf
     }
 }
 
-size_t h264_write_scroll_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_px) {
-    uint8_t *rbsp = malloc(1024 * 1024);
+/* Scratch bytes write_mb_layer takes */
+static size_t mb_layer_scratch_size(const ComposerConfig *cfg) {
+    return 2 * SCRATCH_ARENA_SIZE((size_t)cfg->mb_width * sizeof(MVInfo)) +
+           SCRATCH_ARENA_SIZE(row_template_capacity(cfg->mb_width) * ROW_TEMPLATE_SLOTS);
+}
+
+/*
+ * Write the MB layer of a slice of num_rows MB rows, ending with any
+ * pending skip run
+ *
+ * Motion is uniform per row (rows[mb_y]) when field is NULL, otherwise
+ * per MB (field[mb_y * mb_width + mb_x]). Uniform field rows below a
+ * uniform row still take the row template path.
+ *
+ * mb_y counts from the slice's first row, so nothing above the slice is
+ * available for prediction. Working rows and templates come from arena.
+ */
+static void write_mb_layer(BitWriter *bw, const ComposerConfig *cfg,
+                           const MVInfo *rows, const MVInfo *field,
+                           int num_rows, int num_refs, ScratchArena *arena) {
+    size_t row_size = (size_t)cfg->mb_width * sizeof(MVInfo);
+    MVInfo *above_row = scratch_arena_alloc(arena, row_size);
+    MVInfo *current_row = scratch_arena_alloc(arena, row_size);
+    memset(above_row, 0, row_size);
+    memset(current_row, 0, row_size);
+    RowTemplateCache templates;
+    row_template_cache_init(&templates, cfg->mb_width, arena);
+    MVInfo above = {0};
+    int above_uniform = 1;
+    int skip_count = 0;
+
+    for (int mb_y = 0; mb_y < num_rows; mb_y++) {
+        const MVInfo *mbs = field ? field + (size_t)mb_y * cfg->mb_width : NULL;
+        int uniform = !mbs || row_is_uniform(mbs, cfg->mb_width);
+        const MVInfo *row = mbs ? &mbs[0] : &rows[mb_y];
+
+        if (uniform && above_uniform) {
+            write_uniform_row(bw, &templates, mb_y, cfg->mb_width, above_row, current_row,
+                              row, &above, num_refs, &skip_count);
+        } else {
+            write_mixed_row(bw, mb_y, cfg->mb_width, above_row, current_row,
+                            mbs, num_refs, &skip_count);
+        }
+        above = *row;
+        above_uniform = uniform;
+
+        MVInfo *tmp = above_row;
+        above_row = current_row;
+        current_row = tmp;
+    }
+
+    if (skip_count > 0) {
+        bitwriter_write_ue(bw, skip_count);
+    }
+}
+
+/* Hash of what each ref_idx points at: the base refs plus waypoints in list order */
+static uint64_t ref_set_hash(const ComposerConfig *cfg, int num_refs) {
+    uint64_t h = frame_cache_hash(FRAME_CACHE_HASH_INIT, &num_refs, sizeof(num_refs));
+
+    for (int i = 0; i < cfg->num_waypoints; i++) {
+        if (cfg->waypoints[i].valid) {
+            h = frame_cache_hash(h, &cfg->waypoints[i].offset_qpel, sizeof(int));
+        }
+    }
+    return h;
+}
+
+/* Payload cache / clip library key of a slice's MB layer */
+static void payload_key(const ComposerConfig *cfg, int offset_qpel,
+                        const MVInfo *rows, const MVInfo *field, int num_rows,
+                        int num_refs, FrameCacheKey *key) {
+    key->offset_qpel = offset_qpel;
+    key->ref_set = ref_set_hash(cfg, num_refs);
+    if (field) {
+        key->mv_hash = frame_cache_hash(FRAME_CACHE_HASH_INIT, field,
+                                        (size_t)num_rows * cfg->mb_width * sizeof(MVInfo));
+    } else {
+        key->mv_hash = frame_cache_hash(FRAME_CACHE_HASH_INIT, rows,
+                                        (size_t)num_rows * sizeof(MVInfo));
+    }
+}
+
+/* Bytes needed to render one frame's MB layer */
+static size_t payload_capacity(const ComposerConfig *cfg) {
+    return (size_t)cfg->mb_width * cfg->mb_height * ROW_TEMPLATE_MB_BYTES + 16;
+}
+
+/*
+ * Stored payload for key from the clip library or payload cache
+ *
+ * Returns the payload bits (num_bits set), or NULL if neither has it
+ */
+static const uint8_t *find_payload(ComposerConfig *cfg, const FrameCacheKey *key,
+                                   int num_mbs, size_t *num_bits) {
+    if (cfg->clip_library) {
+        const uint8_t *bits = clip_library_find(cfg->clip_library, key, num_bits);
+        if (bits) {
+            return bits;
+        }
+    }
+
+    if (cfg->frame_cache) {
+        const FrameCacheEntry *e = frame_cache_lookup(cfg->frame_cache, key);
+        if (e) {
+            cfg->frame_cache->mbs_reused += (uint64_t)num_mbs;
+            *num_bits = e->num_bits;
+            return e->bits;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * write_mb_layer through the clip library and payload cache, if the
+ * config has them
+ *
+ * A library or cache hit only copies bits. A miss renders the MB layer
+ * into a scratch buffer, stores it in the cache and copies it out.
+ */
+static void write_mb_layer_cached(BitWriter *bw, ComposerConfig *cfg, int offset_qpel,
+                                  const MVInfo *rows, const MVInfo *field, int num_rows,
+                                  int num_refs, ScratchArena *arena) {
+    FrameCache *fc = cfg->frame_cache;
+    if (!fc && !cfg->clip_library) {
+        write_mb_layer(bw, cfg, rows, field, num_rows, num_refs, arena);
+        return;
+    }
+
+    FrameCacheKey key;
+    payload_key(cfg, offset_qpel, rows, field, num_rows, num_refs, &key);
+
+    size_t num_bits;
+    const uint8_t *bits = find_payload(cfg, &key, num_rows * cfg->mb_width, &num_bits);
+    if (bits) {
+        bitwriter_copy_bits(bw, bits, (num_bits + 7) / 8, 0, num_bits);
+        return;
+    }
+    if (!fc) {
+        write_mb_layer(bw, cfg, rows, field, num_rows, num_refs, arena);
+        return;
+    }
+
+    size_t capacity = payload_capacity(cfg);
+    uint8_t *scratch = scratch_arena_alloc(arena, capacity);
+    BitWriter pw;
+    bitwriter_init(&pw, scratch, capacity);
+
+    write_mb_layer(&pw, cfg, rows, field, num_rows, num_refs, arena);
+    num_bits = bitwriter_get_bit_position(&pw);
+    bitwriter_flush(&pw);
+
+    frame_cache_insert(fc, &key, scratch, num_bits);
+    bitwriter_copy_bits(bw, scratch, capacity, 0, num_bits);
+}
+
+/*
+ * Slice header of a P-frame: a waypoint frame (is_reference) marks
+ * itself long-term, other frames list the waypoints if there are any
+ */
+static void write_p_slice_header(BitWriter *bw, ComposerConfig *cfg, int first_mb,
+                                 int frame_num, int is_reference, int long_term_idx) {
+    if (is_reference) {
+        h264_write_p_slice_header_waypoint(bw, cfg, first_mb, frame_num, frame_num * 2,
+                                           1, long_term_idx);
+    } else if (cfg->num_waypoints > 0) {
+        h264_write_p_slice_header_waypoint(bw, cfg, first_mb, frame_num, frame_num * 2,
+                                           0, -1);
+    } else {
+        h264_write_p_slice_header(bw, cfg, first_mb, frame_num, frame_num * 2, 0);
+    }
+}
+
+/* Slices per frame, at least one MB row each */
+static int slice_count(const ComposerConfig *cfg) {
+    if (cfg->num_slices < 1) return 1;
+    if (cfg->num_slices > cfg->mb_height) return cfg->mb_height;
+    return cfg->num_slices;
+}
+
+/* First MB row of slice s (s = num_slices gives the row past the end) */
+static int slice_first_row(const ComposerConfig *cfg, int num_slices, int s) {
+    return (int)((long)cfg->mb_height * s / num_slices);
+}
+
+/*
+ * Slice-parallel encoding
+ *
+ * Payload lookups and cache inserts stay on the calling thread. Pool
+ * threads render missing payloads and build each slice's NAL unit in a
+ * buffer of its own; the units are then appended in slice order.
+ */
+typedef struct {
+    int first_row;
+    int num_rows;
+    FrameCacheKey key;
+    const uint8_t *bits;    /* Stored payload, NULL to render */
+    size_t num_bits;
+    uint8_t *scratch;       /* Render target when the payload is to be cached */
+    uint8_t *nal;           /* Slice NAL unit */
+    size_t nal_size;
+    ScratchArena arena;     /* Working memory of the task */
+} SliceJob;
+
+typedef struct {
+    ComposerConfig *cfg;
+    const MVInfo *rows;
+    const MVInfo *field;    /* Per-MB motion, or NULL for uniform rows */
+    int num_refs;
+    int frame_num;
+    int is_reference;
+    int long_term_idx;
+    SliceJob *jobs;
+    size_t scratch_capacity;
+    size_t nal_capacity;
+} SliceBatch;
+
+static void slice_task(void *arg, int s) {
+    SliceBatch *batch = arg;
+    SliceJob *job = &batch->jobs[s];
+    ComposerConfig *cfg = batch->cfg;
+    const MVInfo *rows = batch->rows ? batch->rows + job->first_row : NULL;
+    const MVInfo *field = batch->field ?
+                          batch->field + (size_t)job->first_row * cfg->mb_width : NULL;
+
+    if (!job->bits && job->scratch) {
+        BitWriter pw;
+        bitwriter_init(&pw, job->scratch, batch->scratch_capacity);
+        write_mb_layer(&pw, cfg, rows, field, job->num_rows, batch->num_refs, &job->arena);
+        job->num_bits = bitwriter_get_bit_position(&pw);
+        bitwriter_flush(&pw);
+        job->bits = job->scratch;
+    }
+
+    NALWriter nw;
     BitWriter bw;
-    bitwriter_init(&bw, rbsp, 1024 * 1024);
+    nal_writer_init(&nw, job->nal, batch->nal_capacity, NULL, 0);
+    nal_begin_unit(&nw, &bw, batch->is_reference ? NAL_REF_IDC_HIGH : NAL_REF_IDC_NONE,
+                   NAL_TYPE_SLICE, 1);
+    write_p_slice_header(&bw, cfg, job->first_row * cfg->mb_width, batch->frame_num,
+                         batch->is_reference, batch->long_term_idx);
+
+    if (job->bits) {
+        bitwriter_copy_bits(&bw, job->bits, (job->num_bits + 7) / 8, 0, job->num_bits);
+    } else {
+        write_mb_layer(&bw, cfg, rows, field, job->num_rows, batch->num_refs, &job->arena);
+    }
 
+    bitwriter_write_trailing_bits(&bw);
+    job->nal_size = nal_end_unit(&nw, &bw);
+}
+
+/* Buffer sizes of a frame split into num_slices slices */
+static void slice_buffer_sizes(const ComposerConfig *cfg, int num_slices,
+                               size_t *scratch_capacity, size_t *nal_capacity) {
+    int max_rows = (cfg->mb_height + num_slices - 1) / num_slices;
+
+    *scratch_capacity = (size_t)max_rows * cfg->mb_width * ROW_TEMPLATE_MB_BYTES + 16;
+    /* Worst case: payload with emulation prevention, plus header */
+    *nal_capacity = *scratch_capacity * 3 / 2 + 1024;
+}
+
+/* Scratch bytes write_p_frame_parallel takes */
+static size_t parallel_scratch_size(const ComposerConfig *cfg, int num_slices) {
+    size_t scratch_capacity, nal_capacity;
+    slice_buffer_sizes(cfg, num_slices, &scratch_capacity, &nal_capacity);
+
+    size_t per_slice = SCRATCH_ARENA_SIZE(scratch_capacity + nal_capacity) +
+                       SCRATCH_ARENA_SIZE(mb_layer_scratch_size(cfg));
+    return SCRATCH_ARENA_SIZE((size_t)num_slices * sizeof(SliceJob)) +
+           per_slice * num_slices;
+}
+
+/* Returns bytes written, or 0 if the slice buffers could not be allocated */
+static size_t write_p_frame_parallel(NALWriter *nw, ComposerConfig *cfg, int offset_qpel,
+                                     const MVInfo *rows, const MVInfo *field,
+                                     int num_slices, int frame_num,
+                                     int is_reference, int long_term_idx,
+                                     ScratchArena *arena) {
+    SliceBatch batch;
+
+    batch.cfg = cfg;
+    batch.rows = rows;
+    batch.field = field;
+    batch.num_refs = 2 + cfg->num_waypoints;
+    batch.frame_num = frame_num;
+    batch.is_reference = is_reference;
+    batch.long_term_idx = long_term_idx;
+    slice_buffer_sizes(cfg, num_slices, &batch.scratch_capacity, &batch.nal_capacity);
+
+    size_t slot_size = batch.scratch_capacity + batch.nal_capacity;
+    size_t task_size = mb_layer_scratch_size(cfg);
+    batch.jobs = scratch_arena_alloc(arena, (size_t)num_slices * sizeof(SliceJob));
+    if (!batch.jobs) {
+        return 0;
+    }
+    memset(batch.jobs, 0, (size_t)num_slices * sizeof(SliceJob));
+
+    for (int s = 0; s < num_slices; s++) {
+        uint8_t *slot = scratch_arena_alloc(arena, slot_size);
+        uint8_t *task_scratch = scratch_arena_alloc(arena, task_size);
+        if (!slot || !task_scratch) {
+            return 0;
+        }
+        batch.jobs[s].nal = slot;
+        scratch_arena_init(&batch.jobs[s].arena, task_scratch, task_size);
+    }
+
+    int cached = cfg->frame_cache || cfg->clip_library;
+    for (int s = 0; s < num_slices; s++) {
+        SliceJob *job = &batch.jobs[s];
+        job->first_row = slice_first_row(cfg, num_slices, s);
+        job->num_rows = slice_first_row(cfg, num_slices, s + 1) - job->first_row;
+
+        if (cached) {
+            payload_key(cfg, offset_qpel, rows ? rows + job->first_row : NULL,
+                        field ? field + (size_t)job->first_row * cfg->mb_width : NULL,
+                        job->num_rows, batch.num_refs, &job->key);
+            job->bits = find_payload(cfg, &job->key, job->num_rows * cfg->mb_width,
+                                     &job->num_bits);
+            if (!job->bits && cfg->frame_cache) {
+                job->scratch = job->nal + batch.nal_capacity;
+            }
+        }
+    }
+
+    worker_pool_run(cfg->slice_pool, slice_task, &batch, num_slices);
+
+    size_t written = 0;
+    for (int s = 0; s < num_slices; s++) {
+        SliceJob *job = &batch.jobs[s];
+        nal_writer_append(nw, job->nal, job->nal_size);
+        written += job->nal_size;
+
+        /* Fold task heap fallbacks into the frame's arena */
+        arena->allocations += job->arena.allocations;
+        scratch_arena_reset(&job->arena);
+
+        if (!job->scratch) {
+            continue;
+        }
+
+        /* Equal bands of equal motion render the same payload; cache it once */
+        int duplicate = 0;
+        for (int t = 0; t < s && !duplicate; t++) {
+            duplicate = batch.jobs[t].scratch &&
+                        batch.jobs[t].key.offset_qpel == job->key.offset_qpel &&
+                        batch.jobs[t].key.ref_set == job->key.ref_set &&
+                        batch.jobs[t].key.mv_hash == job->key.mv_hash;
+        }
+        if (!duplicate) {
+            frame_cache_insert(cfg->frame_cache, &job->key, job->scratch, job->num_bits);
+        }
+    }
+    return written;
+}
+
+/*
+ * Write a P-frame as cfg->num_slices slice NAL units, with uniform motion
+ * per row (rows) or, if field is not NULL, per MB (field; rows may be NULL)
+ *
+ * Returns bytes written
+ */
+static size_t write_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_qpel,
+                            const MVInfo *rows, const MVInfo *field,
+                            int is_reference, int long_term_idx,
+                            ScratchArena *arena) {
     int max_frame_num = 1 << cfg->log2_max_frame_num;
     int frame_num = cfg->frame_num % max_frame_num;
+    int num_slices = slice_count(cfg);
+
+    if (num_slices > 1 && cfg->slice_pool) {
+        size_t written = write_p_frame_parallel(nw, cfg, offset_qpel, rows, field,
+                                                num_slices, frame_num, is_reference,
+                                                long_term_idx, arena);
+        if (written > 0) {
+            return written;
+        }
+        /* Out of memory for slice buffers: encode in place instead */
+    }
 
-    if (cfg->num_waypoints > 0) {
-        h264_write_p_slice_header_waypoint(&bw, cfg, frame_num, frame_num * 2, 0, -1);
-    } else {
-        h264_write_p_slice_header(&bw, cfg, frame_num, frame_num * 2, 0);
+    size_t written = 0;
+    for (int s = 0; s < num_slices; s++) {
+        int first_row = slice_first_row(cfg, num_slices, s);
+        int num_rows = slice_first_row(cfg, num_slices, s + 1) - first_row;
+        BitWriter bw;
+
+        nal_begin_unit(nw, &bw, is_reference ? NAL_REF_IDC_HIGH : NAL_REF_IDC_NONE,
+                       NAL_TYPE_SLICE, 1);
+        write_p_slice_header(&bw, cfg, first_row * cfg->mb_width, frame_num,
+                             is_reference, long_term_idx);
+        write_mb_layer_cached(&bw, cfg, offset_qpel, rows ? rows + first_row : NULL,
+                              field ? field + (size_t)first_row * cfg->mb_width : NULL,
+                              num_rows, 2 + cfg->num_waypoints, arena);
+        bitwriter_write_trailing_bits(&bw);
+        written += nal_end_unit(nw, &bw);
     }
+    return written;
+}
 
-    int a_region_end = (cfg->height - offset_px) / 16;
+/*
+ * Per-row motion of a scroll frame (quarter-pel)
+ *
+ *   - A region (mb_y < boundary): ref=0, or the closest waypoint at or
+ *     above the offset when the direct MV would exceed MV_LIMIT_PX
+ *   - B region: ref=1, or the closest waypoint below the offset likewise
+ *
+ * Waypoints keep the quarter-pel offset they were made at.
+ */
+static void compute_scroll_rows(const ComposerConfig *cfg, int offset_qpel, MVInfo *rows) {
+    int a_region_end = (cfg->height * 4 - offset_qpel) / 64;
+    int limit_qpel = MV_LIMIT_PX * 4;
 
     /* Find waypoints for A and B regions */
     int wp_idx_a = -1, wp_offset_a = 0;
-    if (offset_px > MV_LIMIT_PX && cfg->num_waypoints > 0) {
+    if (offset_qpel > limit_qpel && cfg->num_waypoints > 0) {
         for (int i = 0; i < cfg->num_waypoints; i++) {
             if (!cfg->waypoints[i].valid) continue;
-            int wo = cfg->waypoints[i].offset_px;
-            if (wo <= offset_px && wo > wp_offset_a) {
-                int delta = offset_px - wo;
-                if (delta <= MV_LIMIT_PX) {
+            int wo = cfg->waypoints[i].offset_qpel;
+            if (wo <= offset_qpel && wo > wp_offset_a) {
+                int delta = offset_qpel - wo;
+                if (delta <= limit_qpel) {
                     wp_idx_a = i;
                     wp_offset_a = wo;
                 }
@@ -571,14 +1145,14 @@ size_t h264_write_scroll_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_
     }
 
     int wp_idx_b = -1, wp_offset_b = 0;
-    int b_direct_mv = offset_px - cfg->height;
-    if (b_direct_mv < -MV_LIMIT_PX && cfg->num_waypoints > 0) {
+    int b_direct_mv = offset_qpel - cfg->height * 4;
+    if (b_direct_mv < -limit_qpel && cfg->num_waypoints > 0) {
         for (int i = 0; i < cfg->num_waypoints; i++) {
             if (!cfg->waypoints[i].valid) continue;
-            int wo = cfg->waypoints[i].offset_px;
-            if (wo > offset_px) {
-                int delta = offset_px - wo;
-                if (delta >= -MV_LIMIT_PX) {
+            int wo = cfg->waypoints[i].offset_qpel;
+            if (wo > offset_qpel) {
+                int delta = offset_qpel - wo;
+                if (delta >= -limit_qpel) {
                     wp_idx_b = i;
                     wp_offset_b = wo;
                     break;
@@ -587,196 +1161,512 @@ size_t h264_write_scroll_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_
         }
     }
 
-    MVInfo *above_row = calloc(cfg->mb_width, sizeof(MVInfo));
-    MVInfo *current_row = calloc(cfg->mb_width, sizeof(MVInfo));
-    MVInfo left = {0};
-    int skip_count = 0;
-
     for (int mb_y = 0; mb_y < cfg->mb_height; mb_y++) {
-        left.available = 0;
+        int ref_idx, mv_y, mv_x = 0;
 
-        for (int mb_x = 0; mb_x < cfg->mb_width; mb_x++) {
-            int ref_idx, mv_y, mv_x = 0;
-
-            if (mb_y < a_region_end) {
-                if (wp_idx_a >= 0) {
-                    ref_idx = 2 + wp_idx_a;
-                    mv_y = offset_px - wp_offset_a;
-                } else {
-                    ref_idx = 0;
-                    mv_y = offset_px;
-                }
+        if (mb_y < a_region_end) {
+            if (wp_idx_a >= 0) {
+                ref_idx = 2 + wp_idx_a;
+                mv_y = offset_qpel - wp_offset_a;
             } else {
-                if (wp_idx_b >= 0) {
-                    ref_idx = 2 + wp_idx_b;
-                    mv_y = offset_px - wp_offset_b;
-                } else {
-                    ref_idx = 1;
-                    mv_y = offset_px - cfg->height;
-                }
+                ref_idx = 0;
+                mv_y = offset_qpel;
             }
+        } else {
+            if (wp_idx_b >= 0) {
+                ref_idx = 2 + wp_idx_b;
+                mv_y = offset_qpel - wp_offset_b;
+            } else {
+                ref_idx = 1;
+                mv_y = offset_qpel - cfg->height * 4;
+            }
+        }
+
+        rows[mb_y].mv_x = mv_x;
+        rows[mb_y].mv_y = mv_y;
+        rows[mb_y].ref_idx = ref_idx;
+        rows[mb_y].available = 1;
+    }
+}
+
+size_t h264_frame_scratch_size(const ComposerConfig *cfg) {
+    size_t rows = SCRATCH_ARENA_SIZE((size_t)cfg->mb_height * sizeof(MVInfo)) +
+                  SCRATCH_ARENA_SIZE((size_t)cfg->mb_width * cfg->mb_height * sizeof(MVInfo));
+    size_t serial = mb_layer_scratch_size(cfg) + SCRATCH_ARENA_SIZE(payload_capacity(cfg));
+    int num_slices = slice_count(cfg);
+
+    if (num_slices > 1) {
+        size_t parallel = parallel_scratch_size(cfg, num_slices);
+        if (parallel > serial) {
+            serial = parallel;
+        }
+    }
+    /* Headroom for aligning the start of the buffer */
+    return rows + serial + SCRATCH_ARENA_ALIGN;
+}
+
+/*
+ * Working memory for one frame: cfg->scratch, or an empty arena that
+ * serves everything from the heap
+ */
+static ScratchArena *frame_scratch(const ComposerConfig *cfg, ScratchArena *heap) {
+    if (cfg->scratch) {
+        return cfg->scratch;
+    }
+    scratch_arena_init(heap, NULL, 0);
+    return heap;
+}
+
+/*
+ * Write a frame from per-row (rows) or per-MB (field) motion, release its
+ * working memory and advance the encoder state
+ */
+static size_t finish_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_qpel,
+                             const MVInfo *rows, const MVInfo *field, int is_reference,
+                             ScratchArena *arena) {
+    int long_term_idx = is_reference ? 2 + cfg->num_waypoints : -1;
+
+    size_t written = write_p_frame(nw, cfg, offset_qpel, rows, field, is_reference,
+                                   long_term_idx, arena);
+    scratch_arena_reset(arena);
+
+    h264_advance_frame_state(cfg, offset_qpel, is_reference);
+    return written;
+}
+
+size_t h264_write_scroll_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_qpel) {
+    ScratchArena heap;
+    ScratchArena *arena = frame_scratch(cfg, &heap);
+
+    /* Motion depends only on the row, so every row is uniform */
+    MVInfo *rows = scratch_arena_alloc(arena, (size_t)cfg->mb_height * sizeof(MVInfo));
+    compute_scroll_rows(cfg, offset_qpel, rows);
+
+    return finish_p_frame(nw, cfg, offset_qpel, rows, NULL, 0, arena);
+}
 
-            int mv_x_qpel = mv_x * 4;
-            int mv_y_qpel = mv_y * 4;
+size_t h264_write_motion_p_frame(NALWriter *nw, ComposerConfig *cfg, const MBMotion *field,
+                                 FrameMarking marking, int offset_qpel) {
+    ScratchArena heap;
+    ScratchArena *arena = frame_scratch(cfg, &heap);
+    size_t num_mbs = (size_t)cfg->mb_width * cfg->mb_height;
+
+    MVInfo *mbs = scratch_arena_alloc(arena, num_mbs * sizeof(MVInfo));
+    for (size_t i = 0; i < num_mbs; i++) {
+        mbs[i].mv_x = field[i].mv_x;
+        mbs[i].mv_y = field[i].mv_y;
+        mbs[i].ref_idx = field[i].ref_idx;
+        mbs[i].available = 1;
+    }
 
-            int pred_mvx, pred_mvy;
-            get_mv_prediction(mb_x, mb_y, cfg->mb_width, above_row, &left,
-                              ref_idx, &pred_mvx, &pred_mvy);
+    return finish_p_frame(nw, cfg, offset_qpel, NULL, mbs, marking == FRAME_MARK_LONG_TERM,
+                          arena);
+}
 
-            int mvd_x = mv_x_qpel - pred_mvx;
-            int mvd_y = mv_y_qpel - pred_mvy;
+int row_cache_init(RowCache *rc, int mb_width, int mb_height) {
+    size_t capacity = row_template_capacity(mb_width);
+
+    memset(rc, 0, sizeof(*rc));
+    rc->rows = calloc((size_t)mb_height, sizeof(RowTemplate));
+    rc->storage = malloc(capacity * mb_height);
+    rc->resolved = malloc((size_t)mb_width * mb_height * sizeof(MVInfo));
+    rc->row_motion = malloc((size_t)mb_width * sizeof(MVInfo));
+    if (!rc->rows || !rc->storage || !rc->resolved || !rc->row_motion) {
+        row_cache_free(rc);
+        return -1;
+    }
 
-            /* P_Skip disabled for now */
-            bitwriter_write_ue(&bw, skip_count);
-            skip_count = 0;
+    for (int i = 0; i < mb_height; i++) {
+        rc->rows[i].bits = rc->storage + capacity * i;
+        rc->rows[i].capacity = capacity;
+    }
+    rc->mb_width = mb_width;
+    rc->mb_height = mb_height;
+    return 0;
+}
 
-            int num_refs = 2 + cfg->num_waypoints;
-            write_p16x16_mb(&bw, ref_idx, mvd_x, mvd_y, num_refs);
+void row_cache_free(RowCache *rc) {
+    free(rc->rows);
+    free(rc->storage);
+    free(rc->resolved);
+    free(rc->row_motion);
+    memset(rc, 0, sizeof(*rc));
+}
 
-            current_row[mb_x].mv_x = mv_x_qpel;
-            current_row[mb_x].mv_y = mv_y_qpel;
-            current_row[mb_x].ref_idx = ref_idx;
-            current_row[mb_x].available = 1;
-            left = current_row[mb_x];
+/*
+ * Write the MB layer of a slice's rows from rc, re-encoding the rows
+ * that are dirty or below a row whose motion changed
+ */
+static void write_mb_layer_rows(BitWriter *bw, RowCache *rc, const MBMotion *field,
+                                const uint8_t *dirty_rows, int first_row, int num_rows,
+                                int num_refs) {
+    int mb_width = rc->mb_width;
+    int above_changed = 0;
+    int skip_count = 0;
+
+    for (int r = 0; r < num_rows; r++) {
+        int mb_y = first_row + r;
+        int dirty = !rc->valid || !dirty_rows || dirty_rows[mb_y];
+        RowTemplate *t = &rc->rows[mb_y];
+        int changed = dirty;
+
+        if (dirty || above_changed) {
+            const MBMotion *mbs = field + (size_t)mb_y * mb_width;
+            MVInfo *current_row = rc->resolved + (size_t)mb_y * mb_width;
+            /* Nothing above the slice's first row is read */
+            const MVInfo *above_row = r > 0 ? current_row - mb_width : current_row;
+
+            for (int mb_x = 0; mb_x < mb_width; mb_x++) {
+                rc->row_motion[mb_x].mv_x = mbs[mb_x].mv_x;
+                rc->row_motion[mb_x].mv_y = mbs[mb_x].mv_y;
+                rc->row_motion[mb_x].ref_idx = mbs[mb_x].ref_idx;
+                rc->row_motion[mb_x].available = 1;
+                /* What P_Skip infers follows the row above */
+                changed |= mbs[mb_x].ref_idx == MB_REF_SKIP;
+            }
+
+            row_template_build(t, r, mb_width, above_row, current_row,
+                               rc->row_motion, 1, num_refs);
+            rc->rows_encoded++;
+        } else {
+            rc->rows_reused++;
         }
 
-        MVInfo *tmp = above_row;
-        above_row = current_row;
-        current_row = tmp;
+        row_template_replay(bw, t, mb_width, &skip_count);
+        above_changed = changed;
     }
 
     if (skip_count > 0) {
-        bitwriter_write_ue(&bw, skip_count);
+        bitwriter_write_ue(bw, skip_count);
     }
+}
 
-    free(above_row);
-    free(current_row);
+size_t h264_write_incremental_p_frame(NALWriter *nw, ComposerConfig *cfg, RowCache *rc,
+                                      const MBMotion *field, const uint8_t *dirty_rows,
+                                      FrameMarking marking, int offset_qpel) {
+    int max_frame_num = 1 << cfg->log2_max_frame_num;
+    int frame_num = cfg->frame_num % max_frame_num;
+    int num_slices = slice_count(cfg);
+    int num_refs = 2 + cfg->num_waypoints;
+    int is_reference = marking == FRAME_MARK_LONG_TERM;
+    int long_term_idx = is_reference ? 2 + cfg->num_waypoints : -1;
 
-    bitwriter_write_trailing_bits(&bw);
-    size_t rbsp_size = bitwriter_get_size(&bw);
+    /* Row bits depend on how ref_idx is coded and where slices start */
+    if (rc->num_refs != num_refs || rc->num_slices != num_slices || rc->splice_y1 > 0) {
+        rc->valid = 0;
+    }
+
+    size_t written = 0;
+    for (int s = 0; s < num_slices; s++) {
+        int first_row = slice_first_row(cfg, num_slices, s);
+        int num_rows = slice_first_row(cfg, num_slices, s + 1) - first_row;
+        BitWriter bw;
+
+        nal_begin_unit(nw, &bw, is_reference ? NAL_REF_IDC_HIGH : NAL_REF_IDC_NONE,
+                       NAL_TYPE_SLICE, 1);
+        write_p_slice_header(&bw, cfg, first_row * cfg->mb_width, frame_num,
+                             is_reference, long_term_idx);
+        write_mb_layer_rows(&bw, rc, field, dirty_rows, first_row, num_rows, num_refs);
+        bitwriter_write_trailing_bits(&bw);
+        written += nal_end_unit(nw, &bw);
+    }
 
-    size_t written = nal_write_unit(nw, NAL_REF_IDC_NONE, NAL_TYPE_SLICE,
-                                    rbsp, rbsp_size, 1);
+    rc->valid = 1;
+    rc->num_refs = num_refs;
+    rc->num_slices = num_slices;
+    rc->splice_y0 = 0;
+    rc->splice_y1 = 0;
 
-    free(rbsp);
-    cfg->frame_num++;
+    h264_advance_frame_state(cfg, offset_qpel, is_reference);
     return written;
 }
 
-int h264_needs_waypoint(ComposerConfig *cfg, int offset_px) {
-    if (offset_px == 0) return 0;
-    if (offset_px % MV_LIMIT_PX != 0) return 0;
+/* Reference list of a slice of a spliced frame */
+typedef enum {
+    SPLICE_LIST_COMPOSER = 0,   /* A, B and the waypoints */
+    SPLICE_LIST_MERGED,         /* Those and the dynamic reference */
+    SPLICE_LIST_DYNAMIC         /* The dynamic reference alone */
+} SpliceList;
 
-    for (int i = 0; i < cfg->num_waypoints; i++) {
-        if (cfg->waypoints[i].valid && cfg->waypoints[i].offset_px == offset_px) {
-            return 0;
+/*
+ * Slice header of a spliced frame. All its slices refer to SPLICED_PPS_ID
+ * and share the marking: a dynamic reference picture becomes
+ * DYNAMIC_LONG_TERM_IDX, replacing the previous one.
+ */
+static void write_spliced_slice_header(BitWriter *bw, const ComposerConfig *cfg, int first_mb,
+                                       int slice_type, int frame_num, SpliceList list,
+                                       int is_reference, int qp, int deblocking_idc,
+                                       int alpha_c0_offset_div2, int beta_offset_div2) {
+    bitwriter_write_ue(bw, first_mb);
+    bitwriter_write_ue(bw, slice_type);
+    bitwriter_write_ue(bw, SPLICED_PPS_ID);
+
+    int frame_num_bits = cfg->log2_max_frame_num;
+    bitwriter_write_bits(bw, frame_num & ((1 << frame_num_bits) - 1), frame_num_bits);
+
+    if (cfg->pic_order_cnt_type == 0) {
+        int poc_bits = cfg->log2_max_pic_order_cnt_lsb;
+        bitwriter_write_bits(bw, (frame_num * 2) & ((1 << poc_bits) - 1), poc_bits);
+    }
+
+    if (slice_type == SLICE_TYPE_P) {
+        int num_refs = list == SPLICE_LIST_DYNAMIC ? 1 :
+                       2 + cfg->num_waypoints + (list == SPLICE_LIST_MERGED);
+        bitwriter_write_bit(bw, 1);
+        bitwriter_write_ue(bw, num_refs - 1);
+
+        /* Ref list modification */
+        bitwriter_write_bit(bw, 1);
+        if (list != SPLICE_LIST_DYNAMIC) {
+            bitwriter_write_ue(bw, 2); bitwriter_write_ue(bw, 0);  /* A */
+            bitwriter_write_ue(bw, 2); bitwriter_write_ue(bw, 1);  /* B */
+            for (int i = 0; i < cfg->num_waypoints; i++) {
+                if (cfg->waypoints[i].valid) {
+                    bitwriter_write_ue(bw, 2);
+                    bitwriter_write_ue(bw, cfg->waypoints[i].long_term_idx);
+                }
+            }
+        }
+        if (list != SPLICE_LIST_COMPOSER) {
+            bitwriter_write_ue(bw, 2);
+            bitwriter_write_ue(bw, DYNAMIC_LONG_TERM_IDX);
         }
+        bitwriter_write_ue(bw, 3);
+    }
+
+    if (is_reference) {
+        bitwriter_write_bit(bw, 1);
+        bitwriter_write_ue(bw, 4);
+        bitwriter_write_ue(bw, DYNAMIC_LONG_TERM_IDX + 1);
+        bitwriter_write_ue(bw, 6);
+        bitwriter_write_ue(bw, DYNAMIC_LONG_TERM_IDX);
+        bitwriter_write_ue(bw, 0);
+    }
+
+    bitwriter_write_se(bw, qp - 26);
+
+    /* SPLICED_PPS_ID has deblocking_filter_control_present_flag set */
+    bitwriter_write_ue(bw, deblocking_idc);
+    if (deblocking_idc != 1) {
+        bitwriter_write_se(bw, alpha_c0_offset_div2);
+        bitwriter_write_se(bw, beta_offset_div2);
     }
-    return 1;
 }
 
-size_t h264_write_waypoint_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_px) {
-    uint8_t *rbsp = malloc(1024 * 1024);
+/* One slice of the composer's rows [first_row, end_row) of a spliced frame */
+static size_t write_spliced_band(NALWriter *nw, ComposerConfig *cfg, RowCache *rc,
+                                 const MBMotion *field, const uint8_t *dirty_rows,
+                                 int first_row, int end_row, int frame_num, int is_reference) {
     BitWriter bw;
-    bitwriter_init(&bw, rbsp, 1024 * 1024);
 
+    if (first_row >= end_row) {
+        return 0;
+    }
+
+    nal_begin_unit(nw, &bw, is_reference ? NAL_REF_IDC_HIGH : NAL_REF_IDC_NONE,
+                   NAL_TYPE_SLICE, 1);
+    write_spliced_slice_header(&bw, cfg, first_row * cfg->mb_width, SLICE_TYPE_P, frame_num,
+                               SPLICE_LIST_COMPOSER, is_reference, 26, 1, 0, 0);
+    write_mb_layer_rows(&bw, rc, field, dirty_rows, first_row, end_row - first_row,
+                        2 + cfg->num_waypoints);
+    bitwriter_write_trailing_bits(&bw);
+    return nal_end_unit(nw, &bw);
+}
+
+size_t h264_write_spliced_p_frame(NALWriter *nw, ComposerConfig *cfg, RowCache *rc,
+                                  const MBMotion *field, const uint8_t *dirty_rows,
+                                  Splicer *sp) {
     int max_frame_num = 1 << cfg->log2_max_frame_num;
     int frame_num = cfg->frame_num % max_frame_num;
-    int long_term_idx = 2 + cfg->num_waypoints;
-
-    h264_write_p_slice_header_waypoint(&bw, cfg, frame_num, frame_num * 2, 1, long_term_idx);
+    int num_refs = 2 + cfg->num_waypoints;
+    int ref_idc = sp->is_reference ? NAL_REF_IDC_HIGH : NAL_REF_IDC_NONE;
+    int y0 = sp->y0;
+    int y1 = sp->y0 + sp->params.mb_height;
+    size_t written = 0;
+    BitWriter bw;
 
-    int a_region_end = (cfg->height - offset_px) / 16;
+    /* Cached rows hold the slice layout of the last spliced rectangle */
+    if (rc->num_refs != num_refs || rc->num_slices != 0 ||
+        rc->splice_y0 != y0 || rc->splice_y1 != y1) {
+        rc->valid = 0;
+    }
 
-    /* Find best existing waypoint for A region */
-    int wp_idx = -1, wp_offset = 0;
-    if (offset_px > MV_LIMIT_PX) {
-        for (int i = 0; i < cfg->num_waypoints; i++) {
-            if (!cfg->waypoints[i].valid) continue;
-            int wo = cfg->waypoints[i].offset_px;
-            if (wo <= offset_px && wo > wp_offset) {
-                int delta = offset_px - wo;
-                if (delta <= MV_LIMIT_PX) {
-                    wp_idx = i;
-                    wp_offset = wo;
-                }
-            }
+    written += write_spliced_band(nw, cfg, rc, field, dirty_rows, 0, y0, frame_num,
+                                  sp->is_reference);
+
+    if (sp->passthrough) {
+        for (int s = 0; s < sp->num_slices; s++) {
+            const SpliceSlice *sl = &sp->slices[s];
+            /* Filter up to the slice edge, never into the composer's rows */
+            int idc = sl->disable_deblocking_filter_idc == 0 ? 2 : sl->disable_deblocking_filter_idc;
+
+            nal_begin_unit(nw, &bw, ref_idc, NAL_TYPE_SLICE, 1);
+            write_spliced_slice_header(&bw, cfg, y0 * cfg->mb_width + sl->first_mb,
+                                       sl->slice_type, frame_num, SPLICE_LIST_DYNAMIC,
+                                       sp->is_reference, sl->qp, idc,
+                                       sl->slice_alpha_c0_offset_div2,
+                                       sl->slice_beta_offset_div2);
+            splicer_write_slice_data(sp, &bw, s);
+            bitwriter_write_trailing_bits(&bw);
+            written += nal_end_unit(nw, &bw);
         }
+    } else {
+        int qp = sp->slices[0].qp;
+
+        nal_begin_unit(nw, &bw, ref_idc, NAL_TYPE_SLICE, 1);
+        write_spliced_slice_header(&bw, cfg, y0 * cfg->mb_width, SLICE_TYPE_P, frame_num,
+                                   SPLICE_LIST_MERGED, sp->is_reference, qp, 1, 0, 0);
+        splicer_write_merged(sp, &bw, field + (size_t)y0 * cfg->mb_width,
+                             num_refs + 1, num_refs, qp);
+        bitwriter_write_trailing_bits(&bw);
+        written += nal_end_unit(nw, &bw);
     }
 
-    MVInfo *above_row = calloc(cfg->mb_width, sizeof(MVInfo));
-    MVInfo *current_row = calloc(cfg->mb_width, sizeof(MVInfo));
-    MVInfo left = {0};
-    int skip_count = 0;
+    written += write_spliced_band(nw, cfg, rc, field, dirty_rows, y1, cfg->mb_height,
+                                  frame_num, sp->is_reference);
 
-    for (int mb_y = 0; mb_y < cfg->mb_height; mb_y++) {
-        left.available = 0;
+    rc->valid = 1;
+    rc->num_refs = num_refs;
+    rc->num_slices = 0;
+    rc->splice_y0 = y0;
+    rc->splice_y1 = y1;
+
+    if (sp->is_reference) {
+        sp->ref_x0 = sp->x0;
+        sp->ref_y0 = sp->y0;
+        cfg->dynamic_ref = 1;
+    }
+
+    h264_advance_frame_state(cfg, 0, 0);
+    return written;
+}
+
+/* Per-MB motion of a band's rows, side by side from A and B */
+static void fill_band(const ComposerConfig *cfg, const ScrollBand *band, MVInfo *field) {
+    int first_row = band->first_row < 0 ? 0 : band->first_row;
+    int end_row = band->first_row + band->num_rows;
+    int b_region_start = (cfg->width * 4 - band->offset_x_qpel) / 64;
+    if (end_row > cfg->mb_height) end_row = cfg->mb_height;
 
+    for (int mb_y = first_row; mb_y < end_row; mb_y++) {
+        MVInfo *mbs = field + (size_t)mb_y * cfg->mb_width;
         for (int mb_x = 0; mb_x < cfg->mb_width; mb_x++) {
-            int ref_idx, mv_y, mv_x = 0;
-
-            if (mb_y < a_region_end) {
-                if (wp_idx >= 0) {
-                    ref_idx = 2 + wp_idx;
-                    mv_y = offset_px - wp_offset;
-                } else {
-                    ref_idx = 0;
-                    mv_y = offset_px;
-                }
+            if (mb_x < b_region_start) {
+                mbs[mb_x].ref_idx = 0;
+                mbs[mb_x].mv_x = band->offset_x_qpel;
             } else {
-                ref_idx = 1;
-                mv_y = offset_px - cfg->height;
+                mbs[mb_x].ref_idx = 1;
+                mbs[mb_x].mv_x = band->offset_x_qpel - cfg->width * 4;
             }
+            mbs[mb_x].mv_y = band->offset_y_qpel;
+            mbs[mb_x].available = 1;
+        }
+    }
+}
 
-            int mv_x_qpel = mv_x * 4;
-            int mv_y_qpel = mv_y * 4;
+size_t h264_write_carousel_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_qpel,
+                                   const ScrollBand *bands, int num_bands) {
+    ScratchArena heap;
+    ScratchArena *arena = frame_scratch(cfg, &heap);
+    size_t num_mbs = (size_t)cfg->mb_width * cfg->mb_height;
 
-            int pred_mvx, pred_mvy;
-            get_mv_prediction(mb_x, mb_y, cfg->mb_width, above_row, &left,
-                              ref_idx, &pred_mvx, &pred_mvy);
+    MVInfo *rows = scratch_arena_alloc(arena, (size_t)cfg->mb_height * sizeof(MVInfo));
+    MVInfo *field = scratch_arena_alloc(arena, num_mbs * sizeof(MVInfo));
+    compute_scroll_rows(cfg, offset_qpel, rows);
 
-            int mvd_x = mv_x_qpel - pred_mvx;
-            int mvd_y = mv_y_qpel - pred_mvy;
+    for (int mb_y = 0; mb_y < cfg->mb_height; mb_y++) {
+        for (int mb_x = 0; mb_x < cfg->mb_width; mb_x++) {
+            field[(size_t)mb_y * cfg->mb_width + mb_x] = rows[mb_y];
+        }
+    }
+    for (int i = 0; i < num_bands; i++) {
+        fill_band(cfg, &bands[i], field);
+    }
 
-            bitwriter_write_ue(&bw, skip_count);
-            skip_count = 0;
-            int num_refs = 2 + cfg->num_waypoints;
-            write_p16x16_mb(&bw, ref_idx, mvd_x, mvd_y, num_refs);
+    return finish_p_frame(nw, cfg, offset_qpel, rows, field, 0, arena);
+}
 
-            current_row[mb_x].mv_x = mv_x_qpel;
-            current_row[mb_x].mv_y = mv_y_qpel;
-            current_row[mb_x].ref_idx = ref_idx;
-            current_row[mb_x].available = 1;
-            left = current_row[mb_x];
+size_t h264_scroll_payload_capacity(const ComposerConfig *cfg) {
+    return payload_capacity(cfg);
+}
+
+size_t h264_render_scroll_payload(const ComposerConfig *cfg, int offset_qpel,
+                                  uint8_t *buf, size_t capacity, FrameCacheKey *key) {
+    ScratchArena heap;
+    ScratchArena *arena = frame_scratch(cfg, &heap);
+    MVInfo *rows = scratch_arena_alloc(arena, (size_t)cfg->mb_height * sizeof(MVInfo));
+    int num_refs = 2 + cfg->num_waypoints;
+    compute_scroll_rows(cfg, offset_qpel, rows);
+    payload_key(cfg, offset_qpel, rows, NULL, cfg->mb_height, num_refs, key);
+
+    BitWriter bw;
+    bitwriter_init(&bw, buf, capacity);
+    write_mb_layer(&bw, cfg, rows, NULL, cfg->mb_height, num_refs, arena);
+    size_t num_bits = bitwriter_get_bit_position(&bw);
+    bitwriter_flush(&bw);
+
+    scratch_arena_reset(arena);
+    return num_bits;
+}
+
+/* Offset of the closest reference at or above offset_qpel: A or a waypoint */
+static int closest_reference_above(const ComposerConfig *cfg, int offset_qpel) {
+    int best = 0;
+
+    for (int i = 0; i < cfg->num_waypoints; i++) {
+        int wo = cfg->waypoints[i].offset_qpel;
+        if (cfg->waypoints[i].valid && wo <= offset_qpel && wo > best) {
+            best = wo;
         }
+    }
+    return best;
+}
 
-        MVInfo *tmp = above_row;
-        above_row = current_row;
-        current_row = tmp;
+int h264_needs_waypoint(const ComposerConfig *cfg, int offset_qpel, int *waypoint_qpel) {
+    int limit_qpel = MV_LIMIT_PX * 4;
+    int base = closest_reference_above(cfg, offset_qpel);
+
+    if (offset_qpel - base < limit_qpel || cfg->num_waypoints >= MAX_WAYPOINTS) return 0;
+
+    /* As far from base as MVs reach, back to where the A/B boundary
+     * falls on an MB edge */
+    int waypoint = base + limit_qpel;
+    int excess = (waypoint - cfg->height * 4) % 64;
+    if (excess < 0) {
+        excess += 64;
     }
+    *waypoint_qpel = waypoint - excess;
+    return 1;
+}
 
-    if (skip_count > 0) {
-        bitwriter_write_ue(&bw, skip_count);
+int h264_clamp_scroll_offset(const ComposerConfig *cfg, int offset_qpel) {
+    int base = closest_reference_above(cfg, offset_qpel);
+
+    if (offset_qpel - base > MV_LIMIT_PX * 4) {
+        return base + MV_LIMIT_PX * 4;
     }
+    return offset_qpel;
+}
 
-    free(above_row);
-    free(current_row);
+size_t h264_write_waypoint_p_frame(NALWriter *nw, ComposerConfig *cfg, int offset_qpel) {
+    ScratchArena heap;
+    ScratchArena *arena = frame_scratch(cfg, &heap);
 
-    bitwriter_write_trailing_bits(&bw);
-    size_t rbsp_size = bitwriter_get_size(&bw);
+    /* The scroll frame's motion, marked as the next long-term reference */
+    MVInfo *rows = scratch_arena_alloc(arena, (size_t)cfg->mb_height * sizeof(MVInfo));
+    compute_scroll_rows(cfg, offset_qpel, rows);
 
-    size_t written = nal_write_unit(nw, NAL_REF_IDC_HIGH, NAL_TYPE_SLICE,
-                                    rbsp, rbsp_size, 1);
+    return finish_p_frame(nw, cfg, offset_qpel, rows, NULL, 1, arena);
+}
 
-    /* Register waypoint */
-    if (cfg->num_waypoints < MAX_WAYPOINTS) {
-        cfg->waypoints[cfg->num_waypoints].offset_px = offset_px;
-        cfg->waypoints[cfg->num_waypoints].long_term_idx = long_term_idx;
+void h264_advance_frame_state(ComposerConfig *cfg, int offset_qpel, int is_waypoint) {
+    /* Register waypoint under the long-term index its frame marked */
+    if (is_waypoint && cfg->num_waypoints < MAX_WAYPOINTS) {
+        cfg->waypoints[cfg->num_waypoints].offset_qpel = offset_qpel;
+        cfg->waypoints[cfg->num_waypoints].long_term_idx = 2 + cfg->num_waypoints;
         cfg->waypoints[cfg->num_waypoints].valid = 1;
         cfg->num_waypoints++;
     }
 
-    free(rbsp);
     cfg->frame_num++;
-    return written;
 }
@@ -0,0 +1,349 @@
+#include "live.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static uint64_t live_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int live_accept_socket(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        fprintf(stderr, "Error: Cannot create socket\n");
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 1) < 0) {
+        fprintf(stderr, "Error: Cannot listen on %s\n", path);
+        close(listen_fd);
+        return -1;
+    }
+
+    printf("Waiting for a client on %s\n", path);
+    int fd;
+    do {
+        fd = accept(listen_fd, NULL, NULL);
+    } while (fd < 0 && errno == EINTR);
+
+    close(listen_fd);
+    unlink(path);
+
+    if (fd < 0) {
+        fprintf(stderr, "Error: Failed to accept on %s\n", path);
+        return -1;
+    }
+    return fd;
+}
+
+/* Split line into at most max whitespace-separated tokens; returns the count */
+static int live_split(char *line, char **tokens, int max) {
+    int n = 0;
+    char *save;
+
+    for (char *t = strtok_r(line, " \t\r", &save); t; t = strtok_r(NULL, " \t\r", &save)) {
+        if (n == max) {
+            return max + 1;
+        }
+        tokens[n++] = t;
+    }
+    return n;
+}
+
+static int live_parse_int(const char *s, int *value) {
+    char *end;
+    long v = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || v < -(1 << 28) || v > 1 << 28) {
+        return -1;
+    }
+    *value = (int)v;
+    return 0;
+}
+
+/* Pixels, possibly fractional, rounded to the nearest quarter pixel */
+static int live_parse_qpel(const char *s, int *qpel) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || *end != '\0' || !(v >= -(1 << 26) && v <= 1 << 26)) {
+        return -1;
+    }
+    *qpel = (int)(v * 4 + (v < 0 ? -0.5 : 0.5));
+    return 0;
+}
+
+/* Record a written frame's latency and print progress every 50 frames */
+static void live_frame_written(LiveStats *stats, uint64_t received_ns, const char *what) {
+    uint64_t latency = live_now_ns() - received_ns;
+    if (stats->frames == 0 || latency < stats->latency_min_ns) {
+        stats->latency_min_ns = latency;
+    }
+    if (latency > stats->latency_max_ns) {
+        stats->latency_max_ns = latency;
+    }
+    stats->latency_sum_ns += latency;
+    stats->latency_last_ns = latency;
+    stats->frames++;
+
+    if (stats->frames % 50 == 0) {
+        printf("  Frame %llu (%s), latency %.1f us (avg %.1f, max %.1f)\n",
+               (unsigned long long)stats->frames, what, latency / 1000.0,
+               stats->latency_sum_ns / 1000.0 / (double)stats->frames,
+               stats->latency_max_ns / 1000.0);
+    }
+}
+
+/* What the commands since the last frame command gave the next frame */
+typedef struct {
+    RegionHints hints;
+    uint8_t *au;            /* Dynamic access unit, LIVE_SPLICE_MAX bytes */
+    size_t au_size;
+    int has_au;             /* au holds a complete access unit */
+    size_t au_pending;      /* Bytes of the access unit still to be read */
+    int au_discard;         /* The access unit is too large; drop its bytes */
+} LiveFrame;
+
+/*
+ * Run one command line received at received_ns
+ *
+ * Region, dynamic and splice commands add to frame, which the next frame
+ * command writes and clears.
+ *
+ * Returns 0, or -1 if the line is malformed
+ */
+static int live_command(Composer *c, char *line, uint64_t received_ns,
+                        LiveFrame *frame, LiveStats *stats) {
+    RegionHints *hints = &frame->hints;
+    char *tok[LIVE_MAX_TOKENS];
+    int n = live_split(line, tok, LIVE_MAX_TOKENS);
+    char what[64];
+
+    if (n == 0 || tok[0][0] == '#') {
+        return 0;
+    }
+    if (n > LIVE_MAX_TOKENS) {
+        return -1;
+    }
+
+    if (strcmp(tok[0], "region") == 0) {
+        MotionRegion r;
+        r.z = 0;
+        if ((n != 8 && n != 9) ||
+            live_parse_int(tok[1], &r.rect.x) < 0 || live_parse_int(tok[2], &r.rect.y) < 0 ||
+            live_parse_int(tok[3], &r.rect.w) < 0 || live_parse_int(tok[4], &r.rect.h) < 0 ||
+            live_parse_int(tok[5], &r.ref_idx) < 0 ||
+            live_parse_qpel(tok[6], &r.mv_x) < 0 || live_parse_qpel(tok[7], &r.mv_y) < 0 ||
+            (n == 9 && live_parse_int(tok[8], &r.z) < 0)) {
+            return -1;
+        }
+        if (region_hints_add_motion(hints, &r) < 0) {
+            fprintf(stderr, "Warning: More than %d regions in a frame\n", MAX_MOTION_REGIONS);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (strcmp(tok[0], "dynamic") == 0) {
+        HintRect rect;
+        int margin = DYNAMIC_MARGIN_DEFAULT;
+        if ((n != 5 && n != 6) ||
+            live_parse_int(tok[1], &rect.x) < 0 || live_parse_int(tok[2], &rect.y) < 0 ||
+            live_parse_int(tok[3], &rect.w) < 0 || live_parse_int(tok[4], &rect.h) < 0 ||
+            (n == 6 && live_parse_int(tok[5], &margin) < 0)) {
+            return -1;
+        }
+        region_hints_set_dynamic(hints, &rect, margin);
+        return 0;
+    }
+
+    if (strcmp(tok[0], "splice") == 0) {
+        int size;
+        if (n != 2 || live_parse_int(tok[1], &size) < 0 || size <= 0) {
+            return -1;
+        }
+        /* The bytes follow the line whatever happens to them */
+        frame->has_au = 0;
+        frame->au_size = 0;
+        frame->au_pending = (size_t)size;
+        frame->au_discard = size > LIVE_SPLICE_MAX;
+        if (frame->au_discard) {
+            fprintf(stderr, "Warning: Dynamic access unit over %d bytes\n", LIVE_SPLICE_MAX);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (strcmp(tok[0], "frame") == 0) {
+        if (n != 1) {
+            return -1;
+        }
+        /* A frame that fails to splice is still written, so not ignored */
+        int frames_written = c->frames_written;
+        int r = frame->has_au ?
+                composer_write_spliced_frame(c, hints, frame->au, frame->au_size) :
+                composer_write_hinted_frame(c, hints);
+        snprintf(what, sizeof(what), "%d regions%s", hints->num_motion_regions,
+                 frame->has_au ? " + spliced" : (hints->has_dynamic ? " + dynamic" : ""));
+        region_hints_init(hints);
+        frame->has_au = 0;
+        if (c->frames_written > frames_written) {
+            live_frame_written(stats, received_ns, what);
+            return 0;
+        }
+        return r;
+    }
+
+    int offset_qpel;
+    if (n != 1 || live_parse_qpel(tok[0], &offset_qpel) < 0) {
+        return -1;
+    }
+
+    int height = composer_get_height(c);
+    if (offset_qpel < 0) {
+        offset_qpel = 0;
+    }
+    if (offset_qpel > height * 4) {
+        offset_qpel = height * 4;
+    }
+
+    /* Writes the frame and flushes it to the sink */
+    composer_write_scroll_frame_qpel(c, offset_qpel);
+
+    snprintf(what, sizeof(what), "offset %.2f px", offset_qpel / 4.0);
+    live_frame_written(stats, received_ns, what);
+    return 0;
+}
+
+/* Run a complete line, counting it as rejected if malformed */
+static void live_line(Composer *c, char *line, uint64_t received_ns,
+                      LiveFrame *frame, LiveStats *stats) {
+    char copy[LIVE_LINE_MAX];
+    memcpy(copy, line, strlen(line) + 1);
+
+    if (live_command(c, line, received_ns, frame, stats) < 0) {
+        fprintf(stderr, "Warning: Ignoring live command '%s'\n", copy);
+        stats->rejected++;
+    }
+}
+
+/* Take up to n bytes of the pending access unit; returns how many */
+static size_t live_take_au(LiveFrame *frame, const char *data, size_t n) {
+    if (n > frame->au_pending) {
+        n = frame->au_pending;
+    }
+    if (!frame->au_discard) {
+        memcpy(frame->au + frame->au_size, data, n);
+        frame->au_size += n;
+    }
+    frame->au_pending -= n;
+    frame->has_au = frame->au_pending == 0 && !frame->au_discard;
+    return n;
+}
+
+static int live_loop(Composer *c, int fd, LiveFrame *frame, LiveStats *stats) {
+    char line[LIVE_LINE_MAX];
+    size_t len = 0;
+    int overlong = 0;      /* Discarding the rest of a too-long line */
+
+    for (;;) {
+        char chunk[LIVE_LINE_MAX];
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: Failed to read live commands\n");
+            return -1;
+        }
+
+        uint64_t received_ns = live_now_ns();
+
+        if (n == 0) {
+            /* Last line without a newline */
+            if (len > 0 && !overlong) {
+                line[len] = '\0';
+                live_line(c, line, received_ns, frame, stats);
+            }
+            return c->output_error ? -1 : 0;
+        }
+
+        for (ssize_t i = 0; i < n; i++) {
+            if (frame->au_pending > 0) {
+                i += (ssize_t)live_take_au(frame, chunk + i, (size_t)(n - i)) - 1;
+                continue;
+            }
+
+            if (chunk[i] != '\n') {
+                if (len + 1 < sizeof(line)) {
+                    line[len++] = chunk[i];
+                } else {
+                    overlong = 1;
+                }
+                continue;
+            }
+
+            if (overlong) {
+                fprintf(stderr, "Warning: Ignoring live command over %d bytes\n",
+                        LIVE_LINE_MAX);
+                stats->rejected++;
+            } else {
+                line[len] = '\0';
+                live_line(c, line, received_ns, frame, stats);
+            }
+            len = 0;
+            overlong = 0;
+        }
+
+        /* Nobody is reading the output any more */
+        if (c->output_error) {
+            return -1;
+        }
+    }
+}
+
+int live_run(Composer *c, int fd, LiveStats *stats) {
+    LiveFrame frame;
+
+    memset(stats, 0, sizeof(*stats));
+    memset(&frame, 0, sizeof(frame));
+    region_hints_init(&frame.hints);
+    frame.au = malloc(LIVE_SPLICE_MAX);
+    if (!frame.au) {
+        fprintf(stderr, "Error: Failed to allocate live buffers\n");
+        return -1;
+    }
+
+    int r = live_loop(c, fd, &frame, stats);
+    free(frame.au);
+    return r;
+}
+
+void live_print_stats(const LiveStats *stats) {
+    printf("Live: %llu frames", (unsigned long long)stats->frames);
+    if (stats->rejected > 0) {
+        printf(", %llu commands rejected", (unsigned long long)stats->rejected);
+    }
+    printf("\n");
+
+    if (stats->frames > 0) {
+        printf("Hint-to-NAL latency: min %.1f us, avg %.1f us, max %.1f us\n",
+               stats->latency_min_ns / 1000.0,
+               stats->latency_sum_ns / 1000.0 / (double)stats->frames,
+               stats->latency_max_ns / 1000.0);
+    }
+}
@@ -9,7 +9,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
 #include "composer.h"
+#include "live.h"
 
 static void print_usage(const char *prog) {
     printf("Usage: %s [options]\n", prog);
@@ -18,8 +21,16 @@ static void print_usage(const char *prog) {
     printf("  --ref-a FILE      First reference I-frame (required)\n");
     printf("  --ref-b FILE      Second reference I-frame (required)\n");
     printf("  -n, --frames N    Number of P-frames to generate (default: 250)\n");
-    printf("  -s, --speed N     Scroll speed in pixels/frame (default: 4)\n");
+    printf("  -s, --speed N     Scroll speed in pixels/frame, may be fractional (default: 4)\n");
     printf("  -o, --output FILE Output H.264 file (default: output.h264)\n");
+    printf("  -j, --threads N   Encode frames on N worker threads (default: 1)\n");
+    printf("  --slices N        Split P-frames into N slices encoded in parallel\n");
+    printf("  --carousel ROW:N  Scroll MB rows ROW..ROW+N-1 sideways instead of the page\n");
+    printf("  --live SRC        Write one frame per scroll offset line read from SRC\n");
+    printf("                    ('-' for stdin, or a Unix socket path to listen on)\n");
+    printf("  --clips FILE      Serve frames from a pre-rendered clip library\n");
+    printf("  --build-clips FILE\n");
+    printf("                    Pre-render every scroll offset to FILE and exit\n");
     printf("  -h, --help        Show this help\n");
     printf("\n");
     printf("Example:\n");
@@ -34,7 +45,13 @@ int main(int argc, char **argv) {
     const char *ref_b_path = NULL;
     const char *output_path = "output.h264";
     int num_frames = 250;
-    int scroll_speed = 4;
+    double scroll_speed = 4;
+    int num_threads = 1;
+    int num_slices = 1;
+    const char *clips_path = NULL;
+    const char *build_clips_path = NULL;
+    const char *live_source = NULL;
+    ScrollBand band = {0, 0, 0, 0};
 
     static struct option long_options[] = {
         {"ref-a",   required_argument, 0, 'a'},
@@ -42,12 +59,18 @@ int main(int argc, char **argv) {
         {"frames",  required_argument, 0, 'n'},
         {"speed",   required_argument, 0, 's'},
         {"output",  required_argument, 0, 'o'},
+        {"threads", required_argument, 0, 'j'},
+        {"slices",  required_argument, 0, 'S'},
+        {"clips",   required_argument, 0, 'c'},
+        {"build-clips", required_argument, 0, 'B'},
+        {"carousel", required_argument, 0, 'C'},
+        {"live",    required_argument, 0, 'L'},
         {"help",    no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "a:b:n:s:o:h", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "a:b:n:s:o:j:h", long_options, NULL)) != -1) {
         switch (opt) {
             case 'a':
                 ref_a_path = optarg;
@@ -59,11 +82,32 @@ int main(int argc, char **argv) {
                 num_frames = atoi(optarg);
                 break;
             case 's':
-                scroll_speed = atoi(optarg);
+                scroll_speed = atof(optarg);
                 break;
             case 'o':
                 output_path = optarg;
                 break;
+            case 'j':
+                num_threads = atoi(optarg);
+                break;
+            case 'S':
+                num_slices = atoi(optarg);
+                break;
+            case 'c':
+                clips_path = optarg;
+                break;
+            case 'B':
+                build_clips_path = optarg;
+                break;
+            case 'C':
+                if (sscanf(optarg, "%d:%d", &band.first_row, &band.num_rows) != 2) {
+                    fprintf(stderr, "Error: --carousel expects ROW:N\n");
+                    return 1;
+                }
+                break;
+            case 'L':
+                live_source = optarg;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -96,39 +140,137 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if (build_clips_path) {
+        int r = composer_build_clip_library(&c, build_clips_path);
+        composer_finish(&c);
+        return r < 0 ? 1 : 0;
+    }
+
+    if (num_slices > 1 && composer_set_slices(&c, num_slices) < 0) {
+        composer_finish(&c);
+        return 1;
+    }
+
+    if (clips_path && composer_load_clip_library(&c, clips_path) < 0) {
+        composer_finish(&c);
+        return 1;
+    }
+
+    /* Live input: stdin, or a renderer connecting to our socket */
+    int live_fd = -1;
+    if (live_source) {
+        live_fd = strcmp(live_source, "-") == 0 ? 0 : live_accept_socket(live_source);
+        if (live_fd < 0) {
+            composer_finish(&c);
+            return 1;
+        }
+    }
+
     int height = composer_get_height(&c);
     int max_offset = height;  /* Scroll from 0 to height */
+    if (band.num_rows > 0) {
+        max_offset = composer_get_width(&c);  /* Carousel: 0 to width */
+    }
 
-    printf("Generating %d frames, scroll speed %d px/frame\n", num_frames, scroll_speed);
+    if (live_source) {
+        printf("Live mode: reading scroll offsets from %s\n", live_source);
+    } else {
+        printf("Generating %d frames, scroll speed %g px/frame\n", num_frames, scroll_speed);
+    }
     printf("Max scroll offset: %d pixels\n", max_offset);
 
+    /* Stream frames to the output file as they are generated. A reader
+     * closing a FIFO early is reported as a write error, not SIGPIPE. */
+    signal(SIGPIPE, SIG_IGN);
+    if (composer_open_output(&c, output_path) < 0) {
+        composer_finish(&c);
+        return 1;
+    }
+
     /* Write header (SPS + PPS + I-frames) */
-    composer_write_header(&c);
+    if (composer_write_header(&c) < 0) {
+        composer_finish(&c);
+        return 1;
+    }
+
+    if (live_source) {
+        LiveStats stats;
+        int r = live_run(&c, live_fd, &stats);
+        if (live_fd > 0) {
+            close(live_fd);
+        }
+        live_print_stats(&stats);
+        composer_print_stats(&c);
+        if (composer_close_output(&c) < 0) {
+            r = -1;
+        }
+        composer_finish(&c);
+        return r < 0 ? 1 : 0;
+    }
+
+    /* Generate P-frames with scroll animation, offsets in quarter pixels */
+    int *offsets = malloc((size_t)num_frames * sizeof(int));
+    if (!offsets) {
+        fprintf(stderr, "Error: Out of memory\n");
+        composer_finish(&c);
+        return 1;
+    }
 
-    /* Generate P-frames with scroll animation */
     int start_offset = 0;
     for (int i = 0; i < num_frames; i++) {
         /* Scroll pattern: 0 → max → 0 → max ... */
-        int cycle_len = max_offset * 2;
-        int cycle_pos = (i * scroll_speed + start_offset) % cycle_len;
-        int offset_px;
+        long cycle_len = (long)max_offset * 4 * 2;
+        long cycle_pos = ((long)(i * scroll_speed * 4 + 0.5) + start_offset) % cycle_len;
 
-        if (cycle_pos < max_offset) {
-            offset_px = cycle_pos;  /* Scrolling down */
+        if (cycle_pos < (long)max_offset * 4) {
+            offsets[i] = (int)cycle_pos;  /* Scrolling down */
         } else {
-            offset_px = cycle_len - cycle_pos;  /* Scrolling back up */
+            offsets[i] = (int)(cycle_len - cycle_pos);  /* Scrolling back up */
         }
+    }
 
-        composer_write_scroll_frame(&c, offset_px);
+    if (band.num_rows > 0) {
+        printf("Carousel: MB rows %d..%d\n", band.first_row,
+               band.first_row + band.num_rows - 1);
+        for (int i = 0; i < num_frames; i++) {
+            band.offset_x_qpel = offsets[i];
+            if (composer_write_carousel_frame(&c, 0, &band, 1) < 0) {
+                free(offsets);
+                composer_finish(&c);
+                return 1;
+            }
 
-        /* Progress indicator */
-        if ((i + 1) % 50 == 0 || i == num_frames - 1) {
-            printf("  Frame %d/%d (offset %d px)\n", i + 1, num_frames, offset_px);
+            if ((i + 1) % 50 == 0 || i == num_frames - 1) {
+                printf("  Frame %d/%d (band offset %.2f px)\n", i + 1, num_frames,
+                       offsets[i] / 4.0);
+            }
+        }
+    } else if (num_threads > 1) {
+        printf("Encoding on %d threads\n", num_threads);
+        if (composer_write_scroll_frames(&c, offsets, num_frames, num_threads) < 0) {
+            free(offsets);
+            composer_finish(&c);
+            return 1;
+        }
+        printf("  Frame %d/%d (offset %.2f px)\n", num_frames, num_frames,
+               offsets[num_frames - 1] / 4.0);
+    } else {
+        for (int i = 0; i < num_frames; i++) {
+            composer_write_scroll_frame_qpel(&c, offsets[i]);
+
+            /* Progress indicator */
+            if ((i + 1) % 50 == 0 || i == num_frames - 1) {
+                printf("  Frame %d/%d (offset %.2f px)\n", i + 1, num_frames,
+                       offsets[i] / 4.0);
+            }
         }
     }
+    free(offsets);
+
+    composer_print_stats(&c);
 
-    /* Write output */
-    if (composer_write_to_file(&c, output_path) < 0) {
+    /* Finish output */
+    if (composer_close_output(&c) < 0) {
         composer_finish(&c);
         return 1;
     }
@@ -1,4 +1,5 @@
 #include "nal.h"
+#include "zeroscan.h"
 #include <string.h>
 #include <assert.h>
 
@@ -9,6 +10,27 @@ void nal_writer_init(NALWriter *nw, uint8_t *output, size_t output_capacity,
     nw->output_pos = 0;
     nw->rbsp = rbsp_temp;
     nw->rbsp_capacity = rbsp_capacity;
+    nw->unit_start = 0;
+    nw->sink = NULL;
+    nw->sink_opaque = NULL;
+    nw->flushed = 0;
+}
+
+void nal_writer_set_sink(NALWriter *nw, NALSinkFn sink, void *opaque) {
+    nw->sink = sink;
+    nw->sink_opaque = opaque;
+}
+
+int nal_writer_flush(NALWriter *nw) {
+    if (!nw->sink || nw->output_pos == 0) {
+        return 0;
+    }
+
+    int result = nw->sink(nw->sink_opaque, nw->output, nw->output_pos);
+    nw->flushed += nw->output_pos;
+    nw->output_pos = 0;
+    nw->unit_start = 0;
+    return result;
 }
 
 /*
@@ -24,36 +46,51 @@ void nal_writer_init(NALWriter *nw, uint8_t *output, size_t output_capacity,
 size_t rbsp_to_ebsp(uint8_t *ebsp, size_t ebsp_capacity,
                     const uint8_t *rbsp, size_t rbsp_size) {
     size_t ebsp_pos = 0;
-    int zero_count = 0;
+    size_t i = 0;
 
-    for (size_t i = 0; i < rbsp_size; i++) {
-        uint8_t byte = rbsp[i];
+    while (i < rbsp_size) {
+        /*
+         * No zeros pending: everything up to and including the next
+         * 00 00 pair can be copied as-is, since an escape is only ever
+         * needed right after such a pair.
+         */
+        size_t pair = zeroscan_find_pair(rbsp, i, rbsp_size);
+        size_t run_end = pair < rbsp_size ? pair + 2 : rbsp_size;
 
-        if (zero_count >= 2 && byte <= 0x03) {
-            /* Need to insert emulation prevention byte */
-            assert(ebsp_pos < ebsp_capacity);
-            ebsp[ebsp_pos++] = 0x03;
-            zero_count = 0;
-        }
+        assert(ebsp_pos + (run_end - i) <= ebsp_capacity);
+        memcpy(ebsp + ebsp_pos, rbsp + i, run_end - i);
+        ebsp_pos += run_end - i;
+        i = run_end;
+
+        /* After the pair: escape and track zeros bytewise until a nonzero byte */
+        int zero_count = 2;
+        while (i < rbsp_size && zero_count > 0) {
+            uint8_t byte = rbsp[i++];
 
-        assert(ebsp_pos < ebsp_capacity);
-        ebsp[ebsp_pos++] = byte;
+            if (zero_count >= 2 && byte <= 0x03) {
+                /* Need to insert emulation prevention byte */
+                assert(ebsp_pos < ebsp_capacity);
+                ebsp[ebsp_pos++] = 0x03;
+                zero_count = 0;
+            }
+
+            assert(ebsp_pos < ebsp_capacity);
+            ebsp[ebsp_pos++] = byte;
 
-        if (byte == 0x00) {
-            zero_count++;
-        } else {
-            zero_count = 0;
+            if (byte == 0x00) {
+                zero_count++;
+            } else {
+                zero_count = 0;
+            }
         }
     }
 
     return ebsp_pos;
 }
 
-size_t nal_write_unit(NALWriter *nw, int nal_ref_idc, int nal_type,
-                      const uint8_t *rbsp, size_t rbsp_size,
-                      int use_long_startcode) {
-    size_t start_pos = nw->output_pos;
-
+/* Write start code and NAL header byte */
+static void nal_write_header(NALWriter *nw, int nal_ref_idc, int nal_type,
+                             int use_long_startcode) {
     /* Write start code */
     if (use_long_startcode) {
         assert(nw->output_pos + 4 <= nw->output_capacity);
@@ -73,6 +110,14 @@ size_t nal_write_unit(NALWriter *nw, int nal_ref_idc, int nal_type,
     assert(nw->output_pos < nw->output_capacity);
     uint8_t nal_header = ((nal_ref_idc & 0x03) << 5) | (nal_type & 0x1F);
     nw->output[nw->output_pos++] = nal_header;
+}
+
+size_t nal_write_unit(NALWriter *nw, int nal_ref_idc, int nal_type,
+                      const uint8_t *rbsp, size_t rbsp_size,
+                      int use_long_startcode) {
+    size_t start_pos = nw->output_pos;
+
+    nal_write_header(nw, nal_ref_idc, nal_type, use_long_startcode);
 
     /* Convert RBSP to EBSP and write */
     size_t ebsp_size = rbsp_to_ebsp(nw->output + nw->output_pos,
@@ -83,10 +128,34 @@ size_t nal_write_unit(NALWriter *nw, int nal_ref_idc, int nal_type,
     return nw->output_pos - start_pos;
 }
 
+void nal_begin_unit(NALWriter *nw, BitWriter *bw, int nal_ref_idc, int nal_type,
+                    int use_long_startcode) {
+    nw->unit_start = nw->output_pos;
+    nal_write_header(nw, nal_ref_idc, nal_type, use_long_startcode);
+    bitwriter_init_ebsp(bw, nw->output + nw->output_pos,
+                        nw->output_capacity - nw->output_pos);
+}
+
+size_t nal_end_unit(NALWriter *nw, BitWriter *bw) {
+    bitwriter_flush(bw);
+    nw->output_pos += bitwriter_get_size(bw);
+    return nw->output_pos - nw->unit_start;
+}
+
+void nal_writer_append(NALWriter *nw, const uint8_t *data, size_t size) {
+    assert(nw->output_pos + size <= nw->output_capacity);
+    memcpy(nw->output + nw->output_pos, data, size);
+    nw->output_pos += size;
+}
+
 size_t nal_writer_get_size(NALWriter *nw) {
     return nw->output_pos;
 }
 
+size_t nal_writer_get_total(NALWriter *nw) {
+    return nw->flushed + nw->output_pos;
+}
+
 uint8_t *nal_writer_get_output(NALWriter *nw) {
     return nw->output;
 }
@@ -0,0 +1,161 @@
+#include "nal_index.h"
+#include "nal.h"
+#include "bitreader.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Grow an array to hold at least one more element */
+static int grow(void **array, size_t *capacity, size_t count, size_t elem_size) {
+    if (count < *capacity) {
+        return 0;
+    }
+
+    size_t new_capacity = *capacity ? *capacity * 2 : 64;
+    void *p = realloc(*array, new_capacity * elem_size);
+    if (!p) {
+        return -1;
+    }
+    *array = p;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static int is_slice(int nal_unit_type) {
+    return nal_unit_type == NAL_TYPE_SLICE || nal_unit_type == NAL_TYPE_IDR;
+}
+
+/*
+ * first_mb_in_slice is the first syntax element of a slice header. It
+ * is read from the EBSP directly: a 00 00 escape cannot occur before the
+ * codeword ends for any first_mb_in_slice below 65535.
+ */
+static uint32_t read_first_mb(const NALUnit *unit) {
+    BitReader br;
+    bitreader_init(&br, unit->data, unit->size);
+    return bitreader_read_ue(&br);
+}
+
+/* Counting sort of the entry indices by nal_unit_type */
+static int group_by_type(NALIndex *index) {
+    size_t next[NAL_INDEX_TYPES];
+
+    index->by_type = malloc((index->num_entries ? index->num_entries : 1) * sizeof(size_t));
+    if (!index->by_type) {
+        return -1;
+    }
+
+    memset(index->type_start, 0, sizeof(index->type_start));
+    for (size_t i = 0; i < index->num_entries; i++) {
+        index->type_start[index->entries[i].nal_unit_type + 1]++;
+    }
+    for (int t = 0; t < NAL_INDEX_TYPES; t++) {
+        index->type_start[t + 1] += index->type_start[t];
+        next[t] = index->type_start[t];
+    }
+    for (size_t i = 0; i < index->num_entries; i++) {
+        index->by_type[next[index->entries[i].nal_unit_type]++] = i;
+    }
+    return 0;
+}
+
+int nal_index_build(NALIndex *index, const uint8_t *data, size_t size) {
+    memset(index, 0, sizeof(*index));
+    index->data = data;
+    index->size = size;
+
+    NALParser parser;
+    NALUnit unit;
+    nal_parser_init(&parser, data, size);
+
+    while (nal_parser_next(&parser, &unit)) {
+        if (grow((void **)&index->entries, &index->entries_capacity,
+                 index->num_entries, sizeof(NALIndexEntry)) < 0) {
+            nal_index_free(index);
+            return -1;
+        }
+
+        NALIndexEntry *e = &index->entries[index->num_entries];
+        e->offset = (size_t)(unit.data - data) - 1;
+        e->size = unit.size;
+        e->rbsp_size = unit.rbsp_size;
+        e->nal_unit_type = unit.nal_unit_type;
+        e->nal_ref_idc = unit.nal_ref_idc;
+        e->picture = -1;
+
+        if (is_slice(unit.nal_unit_type)) {
+            NALIndexPicture *pic = index->num_pictures
+                                 ? &index->pictures[index->num_pictures - 1] : NULL;
+            int continues = pic &&
+                            pic->first_entry + pic->num_slices == index->num_entries &&
+                            read_first_mb(&unit) != 0;
+
+            if (!continues) {
+                if (grow((void **)&index->pictures, &index->pictures_capacity,
+                         index->num_pictures, sizeof(NALIndexPicture)) < 0) {
+                    nal_index_free(index);
+                    return -1;
+                }
+                pic = &index->pictures[index->num_pictures++];
+                pic->first_entry = index->num_entries;
+                pic->num_slices = 0;
+                pic->is_idr = unit.nal_unit_type == NAL_TYPE_IDR;
+
+                if (pic->is_idr) {
+                    if (grow((void **)&index->idr_pictures, &index->idr_pictures_capacity,
+                             index->num_idr_pictures, sizeof(size_t)) < 0) {
+                        nal_index_free(index);
+                        return -1;
+                    }
+                    index->idr_pictures[index->num_idr_pictures++] = index->num_pictures - 1;
+                }
+            }
+
+            pic->num_slices++;
+            e->picture = (int)(index->num_pictures - 1);
+        }
+
+        index->num_entries++;
+    }
+
+    if (group_by_type(index) < 0) {
+        nal_index_free(index);
+        return -1;
+    }
+    return 0;
+}
+
+void nal_index_free(NALIndex *index) {
+    free(index->entries);
+    free(index->pictures);
+    free(index->idr_pictures);
+    free(index->by_type);
+    memset(index, 0, sizeof(*index));
+}
+
+long nal_index_find(const NALIndex *index, int nal_unit_type, int nth) {
+    if (nal_unit_type < 0 || nal_unit_type >= NAL_INDEX_TYPES || nth < 0) {
+        return -1;
+    }
+
+    size_t start = index->type_start[nal_unit_type];
+    if ((size_t)nth >= index->type_start[nal_unit_type + 1] - start) {
+        return -1;
+    }
+    return (long)index->by_type[start + (size_t)nth];
+}
+
+long nal_index_find_idr_picture(const NALIndex *index, int nth) {
+    if (nth < 0 || (size_t)nth >= index->num_idr_pictures) {
+        return -1;
+    }
+    return (long)index->idr_pictures[nth];
+}
+
+void nal_index_get_unit(const NALIndex *index, size_t entry, NALUnit *unit) {
+    const NALIndexEntry *e = &index->entries[entry];
+    unit->nal_ref_idc = e->nal_ref_idc;
+    unit->nal_unit_type = e->nal_unit_type;
+    unit->data = index->data + e->offset + 1;
+    unit->size = e->size;
+    unit->rbsp_size = e->rbsp_size;
+}
@@ -1,10 +1,30 @@
 #include "nal_parser.h"
+#include "bitreader.h"
+#include "zeroscan.h"
 #include <string.h>
 
 void nal_parser_init(NALParser *parser, const uint8_t *data, size_t size) {
     parser->data = data;
     parser->size = size;
     parser->pos = 0;
+    parser->next_start = 0;
+}
+
+/*
+ * Length of the start code at data[i] (3 for 00 00 01, 4 for 00 00 00 01),
+ * or 0 if there is none. data[i] and data[i + 1] must already be zero.
+ */
+static inline int start_code_length(const uint8_t *data, size_t size, size_t i) {
+    if (i + 2 >= size) {
+        return 0;
+    }
+    if (data[i + 2] == 1) {
+        return 3;
+    }
+    if (i + 3 < size && data[i + 2] == 0 && data[i + 3] == 1) {
+        return 4;
+    }
+    return 0;
 }
 
 /*
@@ -12,39 +32,58 @@ void nal_parser_init(NALParser *parser, const uint8_t *data, size_t size) {
  * Returns position after start code, or size if not found
  */
 static size_t find_start_code(const uint8_t *data, size_t size, size_t start) {
-    for (size_t i = start; i + 2 < size; i++) {
-        if (data[i] == 0 && data[i + 1] == 0) {
-            if (data[i + 2] == 1) {
-                return i + 3;
-            }
-            if (i + 3 < size && data[i + 2] == 0 && data[i + 3] == 1) {
-                return i + 4;
-            }
+    size_t i = start;
+    while ((i = zeroscan_find_pair(data, i, size)) < size) {
+        int len = start_code_length(data, size, i);
+        if (len) {
+            return i + len;
         }
+        i++;
     }
     return size;
 }
 
 int nal_parser_next(NALParser *parser, NALUnit *unit) {
-    /* Find start of this NAL */
-    size_t nal_start = find_start_code(parser->data, parser->size, parser->pos);
-    if (nal_start >= parser->size) {
+    const uint8_t *data = parser->data;
+    size_t size = parser->size;
+
+    /* Start of this NAL: remembered from the previous scan, or searched */
+    size_t nal_start = parser->next_start > parser->pos
+                     ? parser->next_start
+                     : find_start_code(data, size, parser->pos);
+    if (nal_start >= size) {
         return 0;
     }
 
-    /* Find start of next NAL (or end of data) */
-    size_t nal_end = parser->size;
-    for (size_t i = nal_start; i + 2 < parser->size; i++) {
-        if (parser->data[i] == 0 && parser->data[i + 1] == 0 &&
-            (parser->data[i + 2] == 1 ||
-             (i + 3 < parser->size && parser->data[i + 2] == 0 && parser->data[i + 3] == 1))) {
+    /*
+     * One pass over zero pairs finds the next start code (end of this
+     * NAL) and counts emulation prevention bytes along the way.
+     */
+    size_t nal_end = size;
+    size_t next_start = size;
+    size_t epb_count = 0;
+    size_t last_epb = 0;
+    size_t i = nal_start;
+
+    while ((i = zeroscan_find_pair(data, i, size)) < size) {
+        int len = start_code_length(data, size, i);
+        if (len) {
             nal_end = i;
+            next_start = i + len;
             break;
         }
+        /* Escapes only count in the payload, not a zero header byte */
+        if (i > nal_start && i + 3 < size && data[i + 2] == 0x03 && data[i + 3] <= 0x03) {
+            epb_count++;
+            last_epb = i + 2;
+            i += 3;
+        } else {
+            i++;
+        }
     }
 
     /* Remove trailing zeros before next start code */
-    while (nal_end > nal_start && parser->data[nal_end - 1] == 0) {
+    while (nal_end > nal_start && data[nal_end - 1] == 0) {
         nal_end--;
     }
 
@@ -53,85 +92,221 @@ int nal_parser_next(NALParser *parser, NALUnit *unit) {
         return 0;
     }
 
+    /* An 0x03 that ends up as the last payload byte is not an escape */
+    if (epb_count > 0 && last_epb + 1 >= nal_end) {
+        epb_count--;
+    }
+
     /* Parse NAL header */
-    uint8_t header = parser->data[nal_start];
+    uint8_t header = data[nal_start];
     unit->nal_ref_idc = (header >> 5) & 0x03;
     unit->nal_unit_type = header & 0x1F;
-    unit->data = parser->data + nal_start + 1;
+    unit->data = data + nal_start + 1;
     unit->size = nal_end - nal_start - 1;
+    unit->rbsp_size = unit->size - epb_count;
 
     parser->pos = nal_end;
+    parser->next_start = next_start;
     return 1;
 }
 
-size_t ebsp_to_rbsp(uint8_t *rbsp, const uint8_t *ebsp, size_t ebsp_size) {
-    size_t rbsp_pos = 0;
-    int zero_count = 0;
+void nal_stream_init(NALStreamParser *sp, uint8_t *carry, size_t carry_capacity) {
+    memset(sp, 0, sizeof(*sp));
+    sp->carry = carry;
+    sp->carry_capacity = carry_capacity;
+}
 
-    for (size_t i = 0; i < ebsp_size; i++) {
-        if (zero_count >= 2 && ebsp[i] == 0x03 && i + 1 < ebsp_size && ebsp[i + 1] <= 0x03) {
-            /* Skip emulation prevention byte */
-            zero_count = 0;
-            continue;
-        }
+void nal_stream_push(NALStreamParser *sp, const uint8_t *data, size_t size) {
+    sp->chunk = data;
+    sp->chunk_size = size;
+    sp->chunk_pos = 0;
+}
 
-        rbsp[rbsp_pos++] = ebsp[i];
+/* Count emulation prevention bytes in a NAL payload */
+static size_t count_epb(const uint8_t *data, size_t size) {
+    size_t count = 0;
+    size_t i = 0;
 
-        if (ebsp[i] == 0x00) {
-            zero_count++;
+    while ((i = zeroscan_find_pair(data, i, size)) < size) {
+        if (i + 3 < size && data[i + 2] == 0x03 && data[i + 3] <= 0x03) {
+            count++;
+            i += 3;
         } else {
-            zero_count = 0;
+            i++;
         }
     }
+    return count;
+}
 
-    return rbsp_pos;
+/* Fill unit from a NAL (header byte onwards) */
+static void stream_set_unit(NALUnit *unit, const uint8_t *nal, size_t size) {
+    unit->nal_ref_idc = (nal[0] >> 5) & 0x03;
+    unit->nal_unit_type = nal[0] & 0x1F;
+    unit->data = nal + 1;
+    unit->size = size - 1;
+    unit->rbsp_size = unit->size - count_epb(unit->data, unit->size);
+}
+
+/* Append to the carry buffer. On overflow the carried NAL is dropped. */
+static int stream_carry(NALStreamParser *sp, const uint8_t *data, size_t size) {
+    if (size > sp->carry_capacity - sp->carry_size) {
+        sp->carry_size = 0;
+        return -1;
+    }
+    memcpy(sp->carry + sp->carry_size, data, size);
+    sp->carry_size += size;
+    return 0;
 }
 
 /*
- * Bit reader for parsing RBSP
+ * Find the 01 byte of the next start code at or after chunk_pos. Zero
+ * bytes from before chunk_pos count, so start codes split across chunks
+ * are found. Returns chunk_size if there is none.
  */
-typedef struct {
-    const uint8_t *data;
-    size_t size;
-    size_t byte_pos;
-    int bit_pos;
-} BitReader;
-
-static void bitreader_init(BitReader *br, const uint8_t *data, size_t size) {
-    br->data = data;
-    br->size = size;
-    br->byte_pos = 0;
-    br->bit_pos = 0;
+static size_t stream_find_start_code(const NALStreamParser *sp) {
+    const uint8_t *data = sp->chunk;
+    size_t size = sp->chunk_size;
+    size_t pos = sp->chunk_pos;
+
+    if (pos < size && sp->zeros >= 2 && data[pos] == 1) {
+        return pos;
+    }
+    if (pos + 1 < size && sp->zeros >= 1 && data[pos] == 0 && data[pos + 1] == 1) {
+        return pos + 1;
+    }
+
+    size_t i = pos;
+    while ((i = zeroscan_find_pair(data, i, size)) < size) {
+        if (i + 2 < size && data[i + 2] == 1) {
+            return i + 2;
+        }
+        i++;
+    }
+    return size;
 }
 
-static int bitreader_read_bit(BitReader *br) {
-    if (br->byte_pos >= br->size) return 0;
+int nal_stream_next(NALStreamParser *sp, NALUnit *unit) {
+    const uint8_t *data = sp->chunk;
+    size_t size = sp->chunk_size;
+
+    while (sp->chunk_pos < size) {
+        size_t sc = stream_find_start_code(sp);
+        if (sc >= size) {
+            break;
+        }
+
+        /* The NAL ends before the start code's 00 00 */
+        size_t start = sp->chunk_pos;
+        size_t end = sc >= start + 2 ? sc - 2 : start;
+        int was_in_nal = sp->in_nal;
+
+        sp->chunk_pos = sc + 1;
+        sp->zeros = 0;
+        sp->in_nal = 1;
+
+        if (!was_in_nal) {
+            continue;
+        }
+
+        const uint8_t *nal = data + start;
+        size_t nal_size = end - start;
+
+        /* Started in an earlier chunk: complete it in the carry buffer */
+        if (sp->carry_size > 0) {
+            if (stream_carry(sp, nal, nal_size) < 0) {
+                return -1;
+            }
+            nal = sp->carry;
+            nal_size = sp->carry_size;
+            sp->carry_size = 0;
+        }
 
-    int bit = (br->data[br->byte_pos] >> (7 - br->bit_pos)) & 1;
-    br->bit_pos++;
-    if (br->bit_pos == 8) {
-        br->bit_pos = 0;
-        br->byte_pos++;
+        /* Remove trailing zeros before next start code */
+        while (nal_size > 0 && nal[nal_size - 1] == 0) {
+            nal_size--;
+        }
+
+        if (nal_size > 0) {
+            stream_set_unit(unit, nal, nal_size);
+            return 1;
+        }
     }
-    return bit;
+
+    /* Chunk used up: carry the unfinished NAL and its trailing zero count */
+    size_t start = sp->chunk_pos;
+    sp->chunk_pos = size;
+
+    if (start < size) {
+        size_t tail = size;
+        while (tail > start && data[tail - 1] == 0) {
+            tail--;
+        }
+        size_t zeros = size - tail + (tail == start ? (size_t)sp->zeros : 0);
+        sp->zeros = zeros > 2 ? 2 : (int)zeros;
+
+        if (sp->in_nal && stream_carry(sp, data + start, size - start) < 0) {
+            /* Skip the rest of this NAL */
+            sp->in_nal = 0;
+            return -1;
+        }
+    }
+
+    return 0;
 }
 
-static uint32_t bitreader_read_bits(BitReader *br, int n) {
-    uint32_t value = 0;
-    for (int i = 0; i < n; i++) {
-        value = (value << 1) | bitreader_read_bit(br);
+int nal_stream_finish(NALStreamParser *sp, NALUnit *unit) {
+    size_t nal_size = sp->in_nal ? sp->carry_size : 0;
+
+    sp->carry_size = 0;
+    sp->in_nal = 0;
+    sp->zeros = 0;
+
+    while (nal_size > 0 && sp->carry[nal_size - 1] == 0) {
+        nal_size--;
     }
-    return value;
+    if (nal_size == 0) {
+        return 0;
+    }
+
+    stream_set_unit(unit, sp->carry, nal_size);
+    return 1;
 }
 
-static uint32_t bitreader_read_ue(BitReader *br) {
-    int leading_zeros = 0;
-    while (bitreader_read_bit(br) == 0 && leading_zeros < 32) {
-        leading_zeros++;
+size_t ebsp_to_rbsp(uint8_t *rbsp, const uint8_t *ebsp, size_t ebsp_size) {
+    size_t rbsp_pos = 0;
+    size_t i = 0;
+
+    while (i < ebsp_size) {
+        /* Copy everything up to and including the next 00 00 pair */
+        size_t pair = zeroscan_find_pair(ebsp, i, ebsp_size);
+        size_t run_end = pair < ebsp_size ? pair + 2 : ebsp_size;
+
+        memcpy(rbsp + rbsp_pos, ebsp + i, run_end - i);
+        rbsp_pos += run_end - i;
+        i = run_end;
+
+        /* Bytewise until the zero run ends or an escape is dropped */
+        int zero_count = 2;
+        while (i < ebsp_size && zero_count > 0) {
+            if (zero_count >= 2 && ebsp[i] == 0x03 && i + 1 < ebsp_size && ebsp[i + 1] <= 0x03) {
+                /* Skip emulation prevention byte */
+                zero_count = 0;
+                i++;
+                continue;
+            }
+
+            rbsp[rbsp_pos++] = ebsp[i];
+
+            if (ebsp[i] == 0x00) {
+                zero_count++;
+            } else {
+                zero_count = 0;
+            }
+            i++;
+        }
     }
-    if (leading_zeros == 0) return 0;
-    uint32_t value = (1 << leading_zeros) - 1 + bitreader_read_bits(br, leading_zeros);
-    return value;
+
+    return rbsp_pos;
 }
 
 int parse_sps(const uint8_t *rbsp, size_t size,
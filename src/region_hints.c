@@ -0,0 +1,195 @@
+#include "region_hints.h"
+#include <stdlib.h>
+#include <string.h>
+
+void region_hints_init(RegionHints *hints) {
+    memset(hints, 0, sizeof(*hints));
+    hints->dynamic_margin = DYNAMIC_MARGIN_DEFAULT;
+}
+
+int region_hints_add_motion(RegionHints *hints, const MotionRegion *region) {
+    if (hints->num_motion_regions >= MAX_MOTION_REGIONS) {
+        return -1;
+    }
+    hints->motion_regions[hints->num_motion_regions++] = *region;
+    return 0;
+}
+
+void region_hints_set_dynamic(RegionHints *hints, const HintRect *rect, int margin) {
+    hints->has_dynamic = 1;
+    hints->dynamic_rect = *rect;
+    hints->dynamic_margin = margin;
+}
+
+int mb_map_init(MBMap *map, int mb_width, int mb_height) {
+    size_t num_mbs = (size_t)mb_width * mb_height;
+
+    memset(map, 0, sizeof(*map));
+    map->cls = malloc(num_mbs);
+    map->motion = malloc(num_mbs * sizeof(MBMotion));
+    map->dirty = malloc((size_t)mb_height);
+    if (!map->cls || !map->motion || !map->dirty) {
+        mb_map_free(map);
+        return -1;
+    }
+    map->mb_width = mb_width;
+    map->mb_height = mb_height;
+    return 0;
+}
+
+void mb_map_free(MBMap *map) {
+    free(map->cls);
+    free(map->motion);
+    free(map->dirty);
+    memset(map, 0, sizeof(*map));
+}
+
+/* Floor of a / 16 for negative a too */
+static int floor_div16(int a) {
+    return a >= 0 ? a / 16 : -((15 - a) / 16);
+}
+
+static int clamp(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+/* MB rectangle [x0, x1) x [y0, y1), clipped to the map */
+typedef struct {
+    int x0, y0;
+    int x1, y1;
+} MBRect;
+
+static MBRect mb_rect(const MBMap *map, int x0, int y0, int x1, int y1) {
+    MBRect r;
+    r.x0 = clamp(x0, 0, map->mb_width);
+    r.x1 = clamp(x1, 0, map->mb_width);
+    r.y0 = clamp(y0, 0, map->mb_height);
+    r.y1 = clamp(y1, 0, map->mb_height);
+    return r;
+}
+
+/* MBs whose centre (16 * mb + 8) lies inside the region's rectangle */
+static MBRect motion_mbs(const MBMap *map, const MotionRegion *r) {
+    return mb_rect(map, floor_div16(r->rect.x + 7), floor_div16(r->rect.y + 7),
+                   floor_div16(r->rect.x + r->rect.w + 7),
+                   floor_div16(r->rect.y + r->rect.h + 7));
+}
+
+/* MBs the dynamic rectangle touches once grown by its margin */
+static MBRect dynamic_mbs(const MBMap *map, const RegionHints *hints) {
+    const HintRect *d = &hints->dynamic_rect;
+    int m = hints->dynamic_margin;
+
+    return mb_rect(map, floor_div16(d->x - m), floor_div16(d->y - m),
+                   floor_div16(d->x + d->w + m + 15), floor_div16(d->y + d->h + m + 15));
+}
+
+/* Set the dirty rows of r to cls and motion, one span per row */
+static void fill_rect(MBMap *map, MBRect r, MBClass cls, const MBMotion *motion) {
+    if (r.x0 >= r.x1) {
+        return;
+    }
+
+    for (int mb_y = r.y0; mb_y < r.y1; mb_y++) {
+        if (!map->dirty[mb_y]) {
+            continue;
+        }
+        size_t row = (size_t)mb_y * map->mb_width;
+        memset(map->cls + row + r.x0, cls, (size_t)(r.x1 - r.x0));
+        for (int mb_x = r.x0; mb_x < r.x1; mb_x++) {
+            map->motion[row + mb_x] = *motion;
+        }
+    }
+}
+
+/* Mark rows [y0, y1) of r dirty */
+static void mark_dirty(MBMap *map, MBRect r) {
+    for (int mb_y = r.y0; mb_y < r.y1; mb_y++) {
+        map->dirty[mb_y] = 1;
+    }
+}
+
+/* Re-derive the dirty rows of map from hints */
+static void rasterize_dirty(const RegionHints *hints, MBMap *map) {
+    MBMotion still = MB_MOTION_STATIC;
+    int order[MAX_MOTION_REGIONS];
+    int n = hints->num_motion_regions;
+
+    map->num_dirty = 0;
+    for (int mb_y = 0; mb_y < map->mb_height; mb_y++) {
+        map->num_dirty += map->dirty[mb_y] != 0;
+    }
+
+    fill_rect(map, mb_rect(map, 0, 0, map->mb_width, map->mb_height),
+              MB_CLASS_STATIC, &still);
+
+    /* Paint bottom to top: stable insertion sort of the regions by z */
+    for (int i = 0; i < n; i++) {
+        int j = i;
+        while (j > 0 && hints->motion_regions[order[j - 1]].z > hints->motion_regions[i].z) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    for (int i = 0; i < n; i++) {
+        const MotionRegion *r = &hints->motion_regions[order[i]];
+        MBMotion motion = {r->ref_idx, r->mv_x, r->mv_y};
+        fill_rect(map, motion_mbs(map, r), MB_CLASS_MOTION, &motion);
+    }
+
+    map->has_dynamic = 0;
+    if (hints->has_dynamic) {
+        MBRect d = dynamic_mbs(map, hints);
+        map->dyn_x0 = d.x0;
+        map->dyn_y0 = d.y0;
+        map->dyn_x1 = d.x1;
+        map->dyn_y1 = d.y1;
+        map->has_dynamic = d.x0 < d.x1 && d.y0 < d.y1;
+        fill_rect(map, d, MB_CLASS_DYNAMIC, &still);
+    }
+
+    map->hints = *hints;
+    map->has_hints = 1;
+}
+
+void region_hints_rasterize(const RegionHints *hints, MBMap *map) {
+    memset(map->dirty, 1, (size_t)map->mb_height);
+    rasterize_dirty(hints, map);
+}
+
+int region_hints_update(const RegionHints *hints, MBMap *map) {
+    if (!map->has_hints) {
+        region_hints_rasterize(hints, map);
+        return map->num_dirty;
+    }
+
+    const RegionHints *prev = &map->hints;
+    int n = hints->num_motion_regions > prev->num_motion_regions ?
+            hints->num_motion_regions : prev->num_motion_regions;
+
+    memset(map->dirty, 0, (size_t)map->mb_height);
+
+    for (int i = 0; i < n; i++) {
+        const MotionRegion *old = i < prev->num_motion_regions ? &prev->motion_regions[i] : NULL;
+        const MotionRegion *cur = i < hints->num_motion_regions ? &hints->motion_regions[i] : NULL;
+
+        if (old && cur && memcmp(old, cur, sizeof(*cur)) == 0) {
+            continue;
+        }
+        if (old) mark_dirty(map, motion_mbs(map, old));
+        if (cur) mark_dirty(map, motion_mbs(map, cur));
+    }
+
+    if (hints->has_dynamic != prev->has_dynamic ||
+        (hints->has_dynamic &&
+         (memcmp(&hints->dynamic_rect, &prev->dynamic_rect, sizeof(HintRect)) != 0 ||
+          hints->dynamic_margin != prev->dynamic_margin))) {
+        if (prev->has_dynamic) mark_dirty(map, dynamic_mbs(map, prev));
+        if (hints->has_dynamic) mark_dirty(map, dynamic_mbs(map, hints));
+    }
+
+    rasterize_dirty(hints, map);
+    return map->num_dirty;
+}
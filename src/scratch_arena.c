@@ -0,0 +1,54 @@
+#include "scratch_arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Heap fallback block; the allocation follows the header */
+struct ScratchBlock {
+    ScratchBlock *next;
+    uint8_t pad[SCRATCH_ARENA_ALIGN - sizeof(ScratchBlock *)];
+};
+
+/* Offset of the first aligned address in the buffer */
+static size_t arena_start(const ScratchArena *a) {
+    size_t misalign = (uintptr_t)a->buffer & (SCRATCH_ARENA_ALIGN - 1);
+    size_t start = misalign ? SCRATCH_ARENA_ALIGN - misalign : 0;
+    return start < a->capacity ? start : a->capacity;
+}
+
+void scratch_arena_init(ScratchArena *a, uint8_t *buffer, size_t capacity) {
+    memset(a, 0, sizeof(*a));
+    a->buffer = buffer;
+    a->capacity = capacity;
+    a->used = arena_start(a);
+}
+
+void *scratch_arena_alloc(ScratchArena *a, size_t size) {
+    size_t aligned = SCRATCH_ARENA_SIZE(size);
+
+    if (aligned <= a->capacity - a->used) {
+        void *p = a->buffer + a->used;
+        a->used += aligned;
+        if (a->used > a->high_water) {
+            a->high_water = a->used;
+        }
+        return p;
+    }
+
+    ScratchBlock *block = malloc(sizeof(ScratchBlock) + aligned);
+    if (!block) {
+        return NULL;
+    }
+    block->next = a->overflow;
+    a->overflow = block;
+    a->allocations++;
+    return block + 1;
+}
+
+void scratch_arena_reset(ScratchArena *a) {
+    while (a->overflow) {
+        ScratchBlock *next = a->overflow->next;
+        free(a->overflow);
+        a->overflow = next;
+    }
+    a->used = arena_start(a);
+}
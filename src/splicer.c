@@ -0,0 +1,1553 @@
+#include "splicer.h"
+#include "bitreader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Kinds of MB */
+enum {
+    SPLICE_MB_SKIP = 0,     /* P_Skip */
+    SPLICE_MB_INTER,        /* P_L0_16x16 .. P_8x8ref0 */
+    SPLICE_MB_I4x4,
+    SPLICE_MB_I16x16,
+    SPLICE_MB_PCM
+};
+
+/* Residual block categories */
+enum {
+    BLOCK_LUMA = 0,         /* 4x4 luma, 16 coefficients */
+    BLOCK_LUMA_DC,          /* Intra16x16DCLevel */
+    BLOCK_LUMA_AC,          /* Intra16x16ACLevel, 15 coefficients */
+    BLOCK_CHROMA_DC,
+    BLOCK_CHROMA_AC
+};
+
+/* ref_idx of a 4x4 block for MV prediction */
+#define REF_UNAVAILABLE (-2)
+#define REF_INTRA       (-1)
+
+/* mb_type values */
+#define P_8x8               3
+#define P_8x8REF0           4
+#define P_MB_TYPE_INTRA     5   /* mb_type of I_NxN in P slices */
+#define I_MB_TYPE_PCM       25
+
+/* Bytes of I_PCM samples */
+#define PCM_BYTES 384
+
+/* Intra_4x4_DC, the predicted mode without usable neighbours */
+#define INTRA_4x4_DC 2
+
+struct SpliceMB {
+    int slice;              /* Slice of the MB, -1 while not coded */
+    int kind;
+    int mb_type;            /* P inter type, or I type without the P offset */
+    int sub_type[4];
+    int cbp;
+    int chroma_pred_mode;
+    int qp;                 /* QP_Y */
+    int ref[16];            /* Per 4x4 block in raster order */
+    int mv[16][2];
+    int intra_mode[16];
+    uint8_t nz[24];         /* total_coeff of the 16 luma blocks (raster),
+                               then Cb and Cr AC (2x2 each) */
+    int first_block;        /* Residual blocks in Splicer.blocks */
+    int num_blocks;
+    size_t pcm_bit;         /* I_PCM samples in Splicer.rbsp */
+};
+
+struct SpliceBlock {
+    uint8_t cat;
+    uint8_t idx;            /* nz index (chroma DC: component) */
+    uint8_t total_coeff;
+    uint8_t trailing_ones;
+    size_t start_bit;       /* Block after its coeff_token, in Splicer.rbsp */
+    size_t end_bit;
+};
+
+/* MBs of a picture or of the merged slice, raster order */
+typedef struct {
+    SpliceMB *mbs;
+    int width;
+    int height;
+    int cip;                /* constrained_intra_pred_flag */
+} MBGrid;
+
+/* Slice data being parsed */
+typedef struct {
+    BitReader br;
+    size_t base_bit;        /* Bit of the slice's RBSP in Splicer.rbsp */
+    int slice;
+    int qp;                 /* QP_Y,PRED */
+} SliceReader;
+
+/* 4x4 block raster index of each blkIdx (6.4.3) */
+static const uint8_t blk_raster[16] = {
+    0, 1, 4, 5, 2, 3, 6, 7, 8, 9, 12, 13, 10, 11, 14, 15
+};
+
+/* coded_block_pattern of each codeNum (Table 9-4) */
+static const uint8_t golomb_to_intra_cbp[48] = {
+    47, 31, 15,  0, 23, 27, 29, 30,  7, 11, 13, 14, 39, 43, 45, 46,
+    16,  3,  5, 10, 12, 19, 21, 26, 28, 35, 37, 42, 44,  1,  2,  4,
+     8, 17, 18, 20, 24,  6,  9, 22, 25, 32, 33, 34, 36, 40, 38, 41
+};
+
+static const uint8_t golomb_to_inter_cbp[48] = {
+     0, 16,  1,  2,  4,  8, 32,  3,  5, 10, 12, 15, 47,  7, 11, 13,
+    14,  6,  9, 31, 35, 37, 42, 44, 33, 34, 36, 40, 39, 43, 45, 46,
+    17, 18, 20, 24, 19, 21, 26, 28, 23, 27, 29, 30, 22, 25, 38, 41
+};
+
+/* coeff_token (Table 9-5) by nC class, [total_coeff][trailing_ones] */
+static const uint8_t coeff_token_len[4][17][4] = {
+    {   /* 0 <= nC < 2 */
+        { 1, 0, 0, 0}, { 6, 2, 0, 0}, { 8, 6, 3, 0}, { 9, 8, 7, 5},
+        {10, 9, 8, 6}, {11,10, 9, 7}, {13,11,10, 8}, {13,13,11, 9},
+        {13,13,13,10}, {14,14,13,11}, {14,14,14,13}, {15,15,14,14},
+        {15,15,15,14}, {16,15,15,15}, {16,16,16,15}, {16,16,16,16},
+        {16,16,16,16},
+    },
+    {   /* 2 <= nC < 4 */
+        { 2, 0, 0, 0}, { 6, 2, 0, 0}, { 6, 5, 3, 0}, { 7, 6, 6, 4},
+        { 8, 6, 6, 4}, { 8, 7, 7, 5}, { 9, 8, 8, 6}, {11, 9, 9, 6},
+        {11,11,11, 7}, {12,11,11, 9}, {12,12,12,11}, {12,12,12,11},
+        {13,13,13,12}, {13,13,13,13}, {13,14,13,13}, {14,14,14,13},
+        {14,14,14,14},
+    },
+    {   /* 4 <= nC < 8 */
+        { 4, 0, 0, 0}, { 6, 4, 0, 0}, { 6, 5, 4, 0}, { 6, 5, 5, 4},
+        { 7, 5, 5, 4}, { 7, 5, 5, 4}, { 7, 6, 6, 4}, { 7, 6, 6, 4},
+        { 8, 7, 7, 5}, { 8, 8, 7, 6}, { 9, 8, 8, 7}, { 9, 9, 8, 8},
+        { 9, 9, 9, 8}, {10, 9, 9, 9}, {10,10,10,10}, {10,10,10,10},
+        {10,10,10,10},
+    },
+    {   /* nC = -1 (chroma DC) */
+        { 2, 0, 0, 0}, { 6, 1, 0, 0}, { 6, 6, 3, 0}, { 6, 7, 7, 6},
+        { 6, 8, 8, 7},
+    },
+};
+
+static const uint8_t coeff_token_code[4][17][4] = {
+    {   /* 0 <= nC < 2 */
+        { 1, 0, 0, 0}, { 5, 1, 0, 0}, { 7, 4, 1, 0}, { 7, 6, 5, 3},
+        { 7, 6, 5, 3}, { 7, 6, 5, 4}, {15, 6, 5, 4}, {11,14, 5, 4},
+        { 8,10,13, 4}, {15,14, 9, 4}, {11,10,13,12}, {15,14, 9,12},
+        {11,10,13, 8}, {15, 1, 9,12}, {11,14,13, 8}, { 7,10, 9,12},
+        { 4, 6, 5, 8},
+    },
+    {   /* 2 <= nC < 4 */
+        { 3, 0, 0, 0}, {11, 2, 0, 0}, { 7, 7, 3, 0}, { 7,10, 9, 5},
+        { 7, 6, 5, 4}, { 4, 6, 5, 6}, { 7, 6, 5, 8}, {15, 6, 5, 4},
+        {11,14,13, 4}, {15,10, 9, 4}, {11,14,13,12}, { 8,10, 9, 8},
+        {15,14,13,12}, {11,10, 9,12}, { 7,11, 6, 8}, { 9, 8,10, 1},
+        { 7, 6, 5, 4},
+    },
+    {   /* 4 <= nC < 8 */
+        {15, 0, 0, 0}, {15,14, 0, 0}, {11,15,13, 0}, { 8,12,14,12},
+        {15,10,11,11}, {11, 8, 9,10}, { 9,14,13, 9}, { 8,10, 9, 8},
+        {15,14,13,13}, {11,14,10,12}, {15,10,13,12}, {11,14, 9,12},
+        { 8,10,13, 8}, {13, 7, 9,12}, { 9,12,11,10}, { 5, 8, 7, 6},
+        { 1, 4, 3, 2},
+    },
+    {   /* nC = -1 (chroma DC) */
+        { 1, 0, 0, 0}, { 7, 1, 0, 0}, { 4, 6, 1, 0}, { 3, 3, 2, 5},
+        { 2, 3, 2, 0},
+    },
+};
+
+
+/* total_zeros (Tables 9-7, 9-8), [total_coeff - 1][total_zeros] */
+static const uint8_t total_zeros_len[15][16] = {
+    {1, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 9},
+    {3, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 6, 6, 6, 6},
+    {4, 3, 3, 3, 4, 4, 3, 3, 4, 5, 5, 6, 5, 6},
+    {5, 3, 4, 4, 3, 3, 3, 4, 3, 4, 5, 5, 5},
+    {4, 4, 4, 3, 3, 3, 3, 3, 4, 5, 4, 5},
+    {6, 5, 3, 3, 3, 3, 3, 3, 4, 3, 6},
+    {6, 5, 3, 3, 3, 2, 3, 4, 3, 6},
+    {6, 4, 5, 3, 2, 2, 3, 3, 6},
+    {6, 6, 4, 2, 2, 3, 2, 5},
+    {5, 5, 3, 2, 2, 2, 4},
+    {4, 4, 3, 3, 1, 3},
+    {4, 4, 2, 1, 3},
+    {3, 3, 1, 2},
+    {2, 2, 1},
+    {1, 1},
+};
+
+static const uint8_t total_zeros_code[15][16] = {
+    {1, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 3, 2, 1},
+    {7, 6, 5, 4, 3, 5, 4, 3, 2, 3, 2, 3, 2, 1, 0},
+    {5, 7, 6, 5, 4, 3, 4, 3, 2, 3, 2, 1, 1, 0},
+    {3, 7, 5, 4, 6, 5, 4, 3, 3, 2, 2, 1, 0},
+    {5, 4, 3, 7, 6, 5, 4, 3, 2, 1, 1, 0},
+    {1, 1, 7, 6, 5, 4, 3, 2, 1, 1, 0},
+    {1, 1, 5, 4, 3, 3, 2, 1, 1, 0},
+    {1, 1, 1, 3, 3, 2, 2, 1, 0},
+    {1, 0, 1, 3, 2, 1, 1, 1},
+    {1, 0, 1, 3, 2, 1, 1},
+    {0, 1, 1, 2, 1, 3},
+    {0, 1, 1, 1, 1},
+    {0, 1, 1, 1},
+    {0, 1, 1},
+    {0, 1},
+};
+
+/* total_zeros of chroma DC (Table 9-9a) */
+static const uint8_t chroma_dc_total_zeros_len[3][16] = {
+    {1, 2, 3, 3},
+    {1, 2, 2},
+    {1, 1},
+};
+
+static const uint8_t chroma_dc_total_zeros_code[3][16] = {
+    {1, 1, 1, 0},
+    {1, 1, 0},
+    {1, 0},
+};
+
+/* run_before (Table 9-10), [min(zerosLeft, 7) - 1][run_before] */
+static const uint8_t run_before_len[7][16] = {
+    {1, 1},
+    {1, 2, 2},
+    {2, 2, 2, 2},
+    {2, 2, 2, 3, 3},
+    {2, 2, 3, 3, 3, 3},
+    {2, 3, 3, 3, 3, 3, 3},
+    {3, 3, 3, 3, 3, 3, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+};
+
+static const uint8_t run_before_code[7][16] = {
+    {1, 0},
+    {1, 1, 0},
+    {3, 2, 1, 0},
+    {3, 2, 1, 1, 0},
+    {3, 2, 3, 2, 1, 0},
+    {3, 0, 1, 3, 2, 5, 4},
+    {7, 6, 5, 4, 3, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1},
+};
+
+/* ---- Neighbours (6.4.11) ---- */
+
+static SpliceMB *grid_mb(const MBGrid *g, int mb_x, int mb_y) {
+    return &g->mbs[(size_t)mb_y * g->width + mb_x];
+}
+
+/*
+ * MB (dx, dy) from MB (mb_x, mb_y), dx and dy in -1..1, if it is
+ * available: inside the grid, coded before the current MB and in its slice
+ */
+static const SpliceMB *neighbour_mb(const MBGrid *g, int mb_x, int mb_y, int dx, int dy) {
+    const SpliceMB *cur = grid_mb(g, mb_x, mb_y);
+    int x = mb_x + dx;
+    int y = mb_y + dy;
+
+    if (dy == 0 && dx >= 0) {
+        return dx == 0 ? cur : NULL;
+    }
+    if (x < 0 || x >= g->width || y < 0) {
+        return NULL;
+    }
+
+    const SpliceMB *n = grid_mb(g, x, y);
+    return n->slice == cur->slice ? n : NULL;
+}
+
+/*
+ * MB holding luma 4x4 block (x4, y4) in the current MB's block
+ * coordinates, x4 in -1..4 and y4 in -1..3; *blk is its raster index
+ */
+static const SpliceMB *luma_block(const MBGrid *g, int mb_x, int mb_y, int x4, int y4,
+                                  int *blk) {
+    int dx = x4 < 0 ? -1 : (x4 > 3 ? 1 : 0);
+    int dy = y4 < 0 ? -1 : 0;
+
+    *blk = (y4 - 4 * dy) * 4 + x4 - 4 * dx;
+    return neighbour_mb(g, mb_x, mb_y, dx, dy);
+}
+
+static int is_intra(const SpliceMB *mb) {
+    return mb->kind >= SPLICE_MB_I4x4;
+}
+
+/* ---- MV prediction (8.4.1) ---- */
+
+/*
+ * ref_idx and MV of luma block (x4, y4) as a predictor: REF_UNAVAILABLE
+ * if it is not available, which inside the current MB means its
+ * partition is not in done yet
+ */
+static int block_motion(const MBGrid *g, int mb_x, int mb_y, unsigned done,
+                        int x4, int y4, int mv[2]) {
+    int blk;
+    const SpliceMB *n = luma_block(g, mb_x, mb_y, x4, y4, &blk);
+
+    mv[0] = 0;
+    mv[1] = 0;
+    if (!n || (n == grid_mb(g, mb_x, mb_y) && !(done & (1u << blk)))) {
+        return REF_UNAVAILABLE;
+    }
+    if (is_intra(n)) {
+        return REF_INTRA;
+    }
+    mv[0] = n->mv[blk][0];
+    mv[1] = n->mv[blk][1];
+    return n->ref[blk];
+}
+
+static int median3(int a, int b, int c) {
+    if (a > b) { int t = a; a = b; b = t; }
+    if (b > c) { b = c; }
+    return b > a ? b : a;
+}
+
+/* MV predictor of the w4 x h4 partition at luma block (x4, y4) on ref */
+static void predict_mv(const MBGrid *g, int mb_x, int mb_y, unsigned done,
+                       int x4, int y4, int w4, int h4, int ref, int mvp[2]) {
+    int mv_a[2], mv_b[2], mv_c[2];
+    int ref_a = block_motion(g, mb_x, mb_y, done, x4 - 1, y4, mv_a);
+    int ref_b = block_motion(g, mb_x, mb_y, done, x4, y4 - 1, mv_b);
+    int ref_c = block_motion(g, mb_x, mb_y, done, x4 + w4, y4 - 1, mv_c);
+    const int *pick = NULL;
+
+    if (ref_c == REF_UNAVAILABLE) {
+        ref_c = block_motion(g, mb_x, mb_y, done, x4 - 1, y4 - 1, mv_c);
+    }
+
+    /* 16x8 and 8x16 partitions predict from one side if its ref matches */
+    if (w4 == 4 && h4 == 2) {
+        if (y4 == 0 && ref_b == ref) pick = mv_b;
+        if (y4 != 0 && ref_a == ref) pick = mv_a;
+    } else if (w4 == 2 && h4 == 4) {
+        if (x4 == 0 && ref_a == ref) pick = mv_a;
+        if (x4 != 0 && ref_c == ref) pick = mv_c;
+    }
+
+    if (!pick) {
+        /* B and C take A's motion when only A is available */
+        if (ref_b == REF_UNAVAILABLE && ref_c == REF_UNAVAILABLE && ref_a != REF_UNAVAILABLE) {
+            mv_b[0] = mv_c[0] = mv_a[0];
+            mv_b[1] = mv_c[1] = mv_a[1];
+            ref_b = ref_c = ref_a;
+        }
+        if ((ref_a == ref) + (ref_b == ref) + (ref_c == ref) == 1) {
+            pick = ref_a == ref ? mv_a : (ref_b == ref ? mv_b : mv_c);
+        }
+    }
+
+    if (pick) {
+        mvp[0] = pick[0];
+        mvp[1] = pick[1];
+    } else {
+        mvp[0] = median3(mv_a[0], mv_b[0], mv_c[0]);
+        mvp[1] = median3(mv_a[1], mv_b[1], mv_c[1]);
+    }
+}
+
+/* P_Skip MV (8.4.1.1) */
+static void skip_mv(const MBGrid *g, int mb_x, int mb_y, int mv[2]) {
+    int mv_a[2], mv_b[2];
+    int ref_a = block_motion(g, mb_x, mb_y, 0, -1, 0, mv_a);
+    int ref_b = block_motion(g, mb_x, mb_y, 0, 0, -1, mv_b);
+
+    if (ref_a == REF_UNAVAILABLE || ref_b == REF_UNAVAILABLE ||
+        (ref_a == 0 && mv_a[0] == 0 && mv_a[1] == 0) ||
+        (ref_b == 0 && mv_b[0] == 0 && mv_b[1] == 0)) {
+        mv[0] = 0;
+        mv[1] = 0;
+        return;
+    }
+    predict_mv(g, mb_x, mb_y, 0, 0, 0, 4, 4, 0, mv);
+}
+
+/*
+ * Partitions of an inter MB in decoding order, as luma block rectangles
+ * {x4, y4, w4, h4}
+ *
+ * Returns the number of partitions
+ */
+static int mb_partitions(const SpliceMB *mb, int parts[16][4]) {
+    /* w4, h4 and count of each sub_mb_type */
+    static const int sub_shapes[4][3] = {{2, 2, 1}, {2, 1, 2}, {1, 2, 2}, {1, 1, 4}};
+    static const int mb_shapes[3][4] = {{4, 4, 0, 0}, {4, 2, 0, 2}, {2, 4, 2, 0}};
+    int n = 0;
+
+    if (mb->kind == SPLICE_MB_SKIP || mb->mb_type < P_8x8) {
+        const int *s = mb_shapes[mb->kind == SPLICE_MB_SKIP ? 0 : mb->mb_type];
+        for (int i = 0; i < (s[2] || s[3] ? 2 : 1); i++) {
+            parts[n][0] = i * s[2];
+            parts[n][1] = i * s[3];
+            parts[n][2] = s[0];
+            parts[n][3] = s[1];
+            n++;
+        }
+        return n;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        const int *s = sub_shapes[mb->sub_type[i]];
+        for (int j = 0; j < s[2]; j++) {
+            parts[n][0] = (i & 1) * 2 + (j * s[0]) % 2;
+            parts[n][1] = (i >> 1) * 2 + (j * s[0]) / 2 * s[1];
+            parts[n][2] = s[0];
+            parts[n][3] = s[1];
+            n++;
+        }
+    }
+    return n;
+}
+
+/* 4x4 blocks of a partition as a mask of raster indices */
+static unsigned partition_mask(const int part[4]) {
+    unsigned mask = 0;
+
+    for (int y = 0; y < part[3]; y++) {
+        for (int x = 0; x < part[2]; x++) {
+            mask |= 1u << ((part[1] + y) * 4 + part[0] + x);
+        }
+    }
+    return mask;
+}
+
+static void set_motion(SpliceMB *mb, unsigned mask, int ref, const int mv[2]) {
+    for (int i = 0; i < 16; i++) {
+        if (mask & (1u << i)) {
+            mb->ref[i] = ref;
+            mb->mv[i][0] = mv[0];
+            mb->mv[i][1] = mv[1];
+        }
+    }
+}
+
+/* ---- Intra 4x4 mode prediction (8.3.1.1) ---- */
+
+static int predicted_intra_mode(const MBGrid *g, int mb_x, int mb_y, int x4, int y4) {
+    int blk_a, blk_b;
+    const SpliceMB *a = luma_block(g, mb_x, mb_y, x4 - 1, y4, &blk_a);
+    const SpliceMB *b = luma_block(g, mb_x, mb_y, x4, y4 - 1, &blk_b);
+
+    if (!a || !b || (g->cip && (!is_intra(a) || !is_intra(b)))) {
+        return INTRA_4x4_DC;
+    }
+
+    int mode_a = a->kind == SPLICE_MB_I4x4 ? a->intra_mode[blk_a] : INTRA_4x4_DC;
+    int mode_b = b->kind == SPLICE_MB_I4x4 ? b->intra_mode[blk_b] : INTRA_4x4_DC;
+    return mode_a < mode_b ? mode_a : mode_b;
+}
+
+/* ---- nC (9.2.1) ---- */
+
+/* total_coeff of block idx of an available neighbour; I_PCM counts 16 */
+static int block_coeffs(const SpliceMB *n, int idx) {
+    return n->kind == SPLICE_MB_PCM ? 16 : n->nz[idx];
+}
+
+static int combine_nc(const SpliceMB *a, int blk_a, const SpliceMB *b, int blk_b) {
+    if (a && b) {
+        return (block_coeffs(a, blk_a) + block_coeffs(b, blk_b) + 1) >> 1;
+    }
+    if (a) {
+        return block_coeffs(a, blk_a);
+    }
+    return b ? block_coeffs(b, blk_b) : 0;
+}
+
+/* nC of the luma block at raster index blk */
+static int luma_nc(const MBGrid *g, int mb_x, int mb_y, int blk) {
+    int x4 = blk & 3, y4 = blk >> 2;
+    int blk_a, blk_b;
+    const SpliceMB *a = luma_block(g, mb_x, mb_y, x4 - 1, y4, &blk_a);
+    const SpliceMB *b = luma_block(g, mb_x, mb_y, x4, y4 - 1, &blk_b);
+
+    return combine_nc(a, blk_a, b, blk_b);
+}
+
+/* nC of chroma AC block idx (16..23) */
+static int chroma_nc(const MBGrid *g, int mb_x, int mb_y, int idx) {
+    int base = idx & ~3, x2 = idx & 1, y2 = (idx >> 1) & 1;
+    const SpliceMB *a = neighbour_mb(g, mb_x, mb_y, x2 ? 0 : -1, 0);
+    const SpliceMB *b = neighbour_mb(g, mb_x, mb_y, 0, y2 ? 0 : -1);
+
+    return combine_nc(a, base + y2 * 2 + (x2 ^ 1), b, base + (y2 ^ 1) * 2 + x2);
+}
+
+static int block_nc(const MBGrid *g, int mb_x, int mb_y, const SpliceBlock *b) {
+    switch (b->cat) {
+    case BLOCK_LUMA_DC:
+        return luma_nc(g, mb_x, mb_y, 0);
+    case BLOCK_CHROMA_DC:
+        return -1;
+    case BLOCK_CHROMA_AC:
+        return chroma_nc(g, mb_x, mb_y, b->idx);
+    default:
+        return luma_nc(g, mb_x, mb_y, b->idx);
+    }
+}
+
+/* ---- Residual blocks (9.2) ---- */
+
+/* Read a VLC from a table row of n codes; returns its index or -1 */
+static int read_vlc(BitReader *br, const uint8_t *len, const uint8_t *code, int n) {
+    uint32_t bits = bitreader_peek_bits(br, 16);
+
+    for (int i = 0; i < n; i++) {
+        if (len[i] && (bits >> (16 - len[i])) == code[i]) {
+            bitreader_skip_bits(br, len[i]);
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int coeff_token_table(int nc) {
+    return nc < 0 ? 3 : (nc < 2 ? 0 : (nc < 4 ? 1 : 2));
+}
+
+static int read_coeff_token(BitReader *br, int nc, int *total_coeff, int *trailing_ones) {
+    if (nc >= 8) {
+        int code = (int)bitreader_read_bits(br, 6);
+        *total_coeff = code == 3 ? 0 : (code >> 2) + 1;
+        *trailing_ones = code == 3 ? 0 : code & 3;
+        return *trailing_ones <= *total_coeff ? 0 : -1;
+    }
+
+    int t = coeff_token_table(nc);
+    int max_coeff = nc < 0 ? 4 : 16;
+    uint32_t bits = bitreader_peek_bits(br, 16);
+
+    for (int tc = 0; tc <= max_coeff; tc++) {
+        for (int t1 = 0; t1 < 4 && t1 <= tc; t1++) {
+            int len = coeff_token_len[t][tc][t1];
+            if (len && (bits >> (16 - len)) == coeff_token_code[t][tc][t1]) {
+                bitreader_skip_bits(br, len);
+                *total_coeff = tc;
+                *trailing_ones = t1;
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+static void write_coeff_token(BitWriter *bw, int nc, int total_coeff, int trailing_ones) {
+    if (nc >= 8) {
+        bitwriter_write_bits(bw, total_coeff ? ((total_coeff - 1) << 2) | trailing_ones : 3, 6);
+        return;
+    }
+
+    int t = coeff_token_table(nc);
+    bitwriter_write_bits(bw, coeff_token_code[t][total_coeff][trailing_ones],
+                         coeff_token_len[t][total_coeff][trailing_ones]);
+}
+
+/* Read the rest of a residual block after its coeff_token */
+static int read_block_body(BitReader *br, int max_coeff, int total_coeff, int trailing_ones) {
+    if (total_coeff == 0) {
+        return 0;
+    }
+    if (total_coeff > max_coeff) {
+        return -1;
+    }
+
+    int suffix_length = total_coeff > 10 && trailing_ones < 3;
+    bitreader_skip_bits(br, trailing_ones);
+
+    for (int i = trailing_ones; i < total_coeff; i++) {
+        int prefix = 0;
+        while (!bitreader_read_bit(br)) {
+            if (++prefix > 19) {
+                return -1;
+            }
+        }
+
+        int level_code = (prefix < 15 ? prefix : 15) << suffix_length;
+        int suffix_size = prefix == 14 && suffix_length == 0 ? 4 :
+                          (prefix >= 15 ? prefix - 3 : suffix_length);
+        level_code += (int)bitreader_read_bits(br, suffix_size);
+        if (prefix >= 15 && suffix_length == 0) {
+            level_code += 15;
+        }
+        if (prefix >= 16) {
+            level_code += (1 << (prefix - 3)) - 4096;
+        }
+        if (i == trailing_ones && trailing_ones < 3) {
+            level_code += 2;
+        }
+
+        if (suffix_length == 0) {
+            suffix_length = 1;
+        }
+        if ((level_code >> 1) + 1 > (3 << (suffix_length - 1)) && suffix_length < 6) {
+            suffix_length++;
+        }
+    }
+
+    if (total_coeff < max_coeff) {
+        int zeros = max_coeff == 4 ?
+            read_vlc(br, chroma_dc_total_zeros_len[total_coeff - 1],
+                     chroma_dc_total_zeros_code[total_coeff - 1], 5 - total_coeff) :
+            read_vlc(br, total_zeros_len[total_coeff - 1],
+                     total_zeros_code[total_coeff - 1], 17 - total_coeff);
+        if (zeros < 0 || zeros > max_coeff - total_coeff) {
+            return -1;
+        }
+
+        for (int i = 0; i < total_coeff - 1 && zeros > 0; i++) {
+            int t = zeros < 7 ? zeros - 1 : 6;
+            int run = read_vlc(br, run_before_len[t], run_before_code[t], zeros < 7 ? zeros + 1 : 15);
+            if (run < 0 || run > zeros) {
+                return -1;
+            }
+            zeros -= run;
+        }
+    }
+    return 0;
+}
+
+/* Parse one residual block; returns its total_coeff or -1 */
+static int parse_block(Splicer *sp, SliceReader *sr, int cat, int idx, int nc) {
+    static const int max_coeffs[] = {16, 16, 15, 4, 15};
+    SpliceBlock *b = &sp->blocks[sp->num_blocks++];
+    int total_coeff, trailing_ones;
+
+    if (read_coeff_token(&sr->br, nc, &total_coeff, &trailing_ones) < 0) {
+        return -1;
+    }
+    b->cat = (uint8_t)cat;
+    b->idx = (uint8_t)idx;
+    b->total_coeff = (uint8_t)total_coeff;
+    b->trailing_ones = (uint8_t)trailing_ones;
+    b->start_bit = sr->base_bit + bitreader_get_bit_position(&sr->br);
+    if (read_block_body(&sr->br, max_coeffs[cat], total_coeff, trailing_ones) < 0) {
+        return -1;
+    }
+    b->end_bit = sr->base_bit + bitreader_get_bit_position(&sr->br);
+    return total_coeff;
+}
+
+/* mb_qp_delta and residual() of an MB whose cbp and kind are set */
+static int parse_residual(Splicer *sp, const MBGrid *g, SliceReader *sr, SpliceMB *mb,
+                          int mb_x, int mb_y) {
+    int i16 = mb->kind == SPLICE_MB_I16x16;
+    int chroma = mb->cbp >> 4;
+
+    mb->first_block = (int)sp->num_blocks;
+    mb->qp = sr->qp;
+    if (mb->cbp == 0 && !i16) {
+        return 0;
+    }
+
+    int delta = bitreader_read_se(&sr->br);
+    if (delta < -26 || delta > 25) {
+        return -1;
+    }
+    sr->qp = (sr->qp + delta + 52) % 52;
+    mb->qp = sr->qp;
+
+    if (i16 && parse_block(sp, sr, BLOCK_LUMA_DC, 0, luma_nc(g, mb_x, mb_y, 0)) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < 16; i++) {
+        int blk = blk_raster[i];
+        if (!(mb->cbp & (1 << (i >> 2)))) {
+            continue;
+        }
+        int n = parse_block(sp, sr, i16 ? BLOCK_LUMA_AC : BLOCK_LUMA, blk,
+                            luma_nc(g, mb_x, mb_y, blk));
+        if (n < 0) {
+            return -1;
+        }
+        mb->nz[blk] = (uint8_t)n;
+    }
+    for (int c = 0; c < 2 && chroma; c++) {
+        if (parse_block(sp, sr, BLOCK_CHROMA_DC, c, -1) < 0) {
+            return -1;
+        }
+    }
+    for (int idx = 16; idx < 24 && chroma == 2; idx++) {
+        int n = parse_block(sp, sr, BLOCK_CHROMA_AC, idx, chroma_nc(g, mb_x, mb_y, idx));
+        if (n < 0) {
+            return -1;
+        }
+        mb->nz[idx] = (uint8_t)n;
+    }
+    mb->num_blocks = (int)sp->num_blocks - mb->first_block;
+    return 0;
+}
+
+/* ---- Macroblock layer (7.3.5) ---- */
+
+static int parse_inter_mb(Splicer *sp, const MBGrid *g, SliceReader *sr, SpliceMB *mb,
+                          int mb_x, int mb_y) {
+    int parts[16][4];
+    unsigned done = 0;
+
+    mb->kind = SPLICE_MB_INTER;
+    if (mb->mb_type >= P_8x8) {
+        for (int i = 0; i < 4; i++) {
+            uint32_t sub_type = bitreader_read_ue(&sr->br);
+            if (sub_type > 3) {
+                return -1;
+            }
+            mb->sub_type[i] = (int)sub_type;
+        }
+    }
+
+    /* One active reference: no ref_idx_l0 */
+    int n = mb_partitions(mb, parts);
+    for (int p = 0; p < n; p++) {
+        int mvp[2], mv[2];
+        unsigned mask = partition_mask(parts[p]);
+
+        predict_mv(g, mb_x, mb_y, done, parts[p][0], parts[p][1], parts[p][2], parts[p][3],
+                   0, mvp);
+        mv[0] = mvp[0] + bitreader_read_se(&sr->br);
+        mv[1] = mvp[1] + bitreader_read_se(&sr->br);
+        if (mv[0] < -8192 || mv[0] > 8191 || mv[1] < -8192 || mv[1] > 8191) {
+            return -1;
+        }
+        set_motion(mb, mask, 0, mv);
+        done |= mask;
+    }
+
+    uint32_t code = bitreader_read_ue(&sr->br);
+    if (code > 47) {
+        return -1;
+    }
+    mb->cbp = golomb_to_inter_cbp[code];
+    return parse_residual(sp, g, sr, mb, mb_x, mb_y);
+}
+
+static int parse_intra_mb(Splicer *sp, const MBGrid *g, SliceReader *sr, SpliceMB *mb,
+                          int mb_x, int mb_y) {
+    BitReader *br = &sr->br;
+
+    if (mb->mb_type > I_MB_TYPE_PCM) {
+        return -1;
+    }
+
+    if (mb->mb_type == I_MB_TYPE_PCM) {
+        mb->kind = SPLICE_MB_PCM;
+        mb->qp = sr->qp;
+        bitreader_skip_bits(br, (int)((8 - bitreader_get_bit_position(br) % 8) % 8));
+        mb->pcm_bit = sr->base_bit + bitreader_get_bit_position(br);
+        for (int i = 0; i < PCM_BYTES / 4; i++) {
+            bitreader_skip_bits(br, 32);
+        }
+        return 0;
+    }
+
+    if (mb->mb_type == 0) {
+        mb->kind = SPLICE_MB_I4x4;
+        for (int i = 0; i < 16; i++) {
+            int blk = blk_raster[i];
+            int pred = predicted_intra_mode(g, mb_x, mb_y, blk & 3, blk >> 2);
+            if (bitreader_read_bit(br)) {
+                mb->intra_mode[blk] = pred;
+            } else {
+                int rem = (int)bitreader_read_bits(br, 3);
+                mb->intra_mode[blk] = rem < pred ? rem : rem + 1;
+            }
+        }
+    } else {
+        mb->kind = SPLICE_MB_I16x16;
+    }
+
+    uint32_t chroma_pred_mode = bitreader_read_ue(br);
+    if (chroma_pred_mode > 3) {
+        return -1;
+    }
+    mb->chroma_pred_mode = (int)chroma_pred_mode;
+
+    if (mb->kind == SPLICE_MB_I4x4) {
+        uint32_t code = bitreader_read_ue(br);
+        if (code > 47) {
+            return -1;
+        }
+        mb->cbp = golomb_to_intra_cbp[code];
+    } else {
+        mb->cbp = (((mb->mb_type - 1) / 4) % 3) << 4 | (mb->mb_type >= 13 ? 15 : 0);
+    }
+    return parse_residual(sp, g, sr, mb, mb_x, mb_y);
+}
+
+/* Start MB (mb_x, mb_y) in the slice being read */
+static SpliceMB *begin_mb(const MBGrid *g, const SliceReader *sr, int mb_x, int mb_y) {
+    SpliceMB *mb = grid_mb(g, mb_x, mb_y);
+
+    if (mb->slice >= 0) {
+        return NULL;
+    }
+    memset(mb, 0, sizeof(*mb));
+    mb->slice = sr->slice;
+    mb->qp = sr->qp;
+    return mb;
+}
+
+static int parse_skip_mb(const MBGrid *g, const SliceReader *sr, int mb_x, int mb_y) {
+    SpliceMB *mb = begin_mb(g, sr, mb_x, mb_y);
+    int mv[2];
+
+    if (!mb) {
+        return -1;
+    }
+    mb->kind = SPLICE_MB_SKIP;
+    skip_mv(g, mb_x, mb_y, mv);
+    set_motion(mb, 0xffff, 0, mv);
+    return 0;
+}
+
+static int parse_mb(Splicer *sp, const MBGrid *g, SliceReader *sr, int slice_type,
+                    int mb_x, int mb_y) {
+    SpliceMB *mb = begin_mb(g, sr, mb_x, mb_y);
+    uint32_t mb_type = bitreader_read_ue(&sr->br);
+
+    if (!mb) {
+        return -1;
+    }
+    if (slice_type == SLICE_TYPE_P) {
+        if (mb_type < P_MB_TYPE_INTRA) {
+            mb->mb_type = (int)mb_type;
+            return parse_inter_mb(sp, g, sr, mb, mb_x, mb_y);
+        }
+        mb_type -= P_MB_TYPE_INTRA;
+    }
+    mb->mb_type = (int)mb_type;
+    return parse_intra_mb(sp, g, sr, mb, mb_x, mb_y);
+}
+
+/* Parse slice_data() of slice s into the grid (7.3.4) */
+static int parse_slice_data(Splicer *sp, const MBGrid *g, int s) {
+    const SpliceSlice *sl = &sp->slices[s];
+    int num_mbs = g->width * g->height;
+    int addr = sl->first_mb;
+    int more = 1;
+    SliceReader sr;
+
+    bitreader_init(&sr.br, sl->rbsp, sl->rbsp_size);
+    bitreader_skip_bits(&sr.br, (int)(sl->data_bit % 8));
+    for (size_t i = 0; i < sl->data_bit / 8; i++) {
+        bitreader_skip_bits(&sr.br, 8);
+    }
+    sr.base_bit = (size_t)(sl->rbsp - sp->rbsp) * 8;
+    sr.slice = s;
+    sr.qp = sl->qp;
+
+    while (more) {
+        if (sl->slice_type == SLICE_TYPE_P) {
+            uint32_t run = bitreader_read_ue(&sr.br);
+            if (run > (uint32_t)(num_mbs - addr)) {
+                goto corrupt;
+            }
+            for (; run > 0; run--, addr++) {
+                if (parse_skip_mb(g, &sr, addr % g->width, addr / g->width) < 0) {
+                    goto corrupt;
+                }
+            }
+            more = bitreader_get_bit_position(&sr.br) < sl->end_bit;
+        }
+        if (more) {
+            if (addr >= num_mbs ||
+                parse_mb(sp, g, &sr, sl->slice_type, addr % g->width, addr / g->width) < 0) {
+                goto corrupt;
+            }
+            addr++;
+        }
+        more = bitreader_get_bit_position(&sr.br) < sl->end_bit;
+    }
+
+    if (bitreader_get_bit_position(&sr.br) == sl->end_bit) {
+        return 0;
+    }
+
+corrupt:
+    fprintf(stderr, "Error: Dynamic slice %d is corrupt at MB %d\n", s, addr);
+    return -1;
+}
+
+/* ---- Parameter sets and slice headers ---- */
+
+/* Bit position of the rbsp_stop_one_bit, or 0 if there is none */
+static size_t rbsp_stop_bit(const uint8_t *rbsp, size_t size) {
+    while (size > 0 && rbsp[size - 1] == 0) {
+        size--;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    int trailing = 0;
+    while (!((rbsp[size - 1] >> trailing) & 1)) {
+        trailing++;
+    }
+    return (size - 1) * 8 + 7 - trailing;
+}
+
+static int parse_dynamic_sps(SpliceParams *p, const uint8_t *rbsp, size_t size) {
+    BitReader br;
+    bitreader_init(&br, rbsp, size);
+
+    int profile_idc = (int)bitreader_read_bits(&br, 8);
+    bitreader_read_bits(&br, 16);   /* constraint flags, level_idc */
+    bitreader_read_ue(&br);         /* seq_parameter_set_id */
+
+    if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 ||
+        profile_idc == 244 || profile_idc == 44 || profile_idc == 83 ||
+        profile_idc == 86 || profile_idc == 118 || profile_idc == 128 ||
+        profile_idc == 138 || profile_idc == 139 || profile_idc == 134) {
+        if (bitreader_read_ue(&br) != 1) {
+            fprintf(stderr, "Error: Dynamic stream is not 4:2:0\n");
+            return -1;
+        }
+        if (bitreader_read_ue(&br) != 0 || bitreader_read_ue(&br) != 0 ||
+            bitreader_read_bit(&br)) {
+            fprintf(stderr, "Error: Dynamic stream is not 8-bit\n");
+            return -1;
+        }
+        if (bitreader_read_bit(&br)) {
+            fprintf(stderr, "Error: Dynamic stream uses scaling matrices\n");
+            return -1;
+        }
+    }
+
+    p->log2_max_frame_num = (int)bitreader_read_ue(&br) + 4;
+    p->pic_order_cnt_type = (int)bitreader_read_ue(&br);
+    if (p->pic_order_cnt_type == 0) {
+        p->log2_max_pic_order_cnt_lsb = (int)bitreader_read_ue(&br) + 4;
+    } else if (p->pic_order_cnt_type != 2) {
+        fprintf(stderr, "Error: Dynamic stream uses pic_order_cnt_type %d\n",
+                p->pic_order_cnt_type);
+        return -1;
+    }
+
+    bitreader_read_ue(&br);         /* max_num_ref_frames */
+    bitreader_read_bit(&br);        /* gaps_in_frame_num_value_allowed_flag */
+    p->mb_width = (int)bitreader_read_ue(&br) + 1;
+    p->mb_height = (int)bitreader_read_ue(&br) + 1;
+    if (!bitreader_read_bit(&br)) {
+        fprintf(stderr, "Error: Dynamic stream is interlaced\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_dynamic_pps(SpliceParams *p, const uint8_t *rbsp, size_t size) {
+    BitReader br;
+    size_t stop_bit = rbsp_stop_bit(rbsp, size);
+
+    bitreader_init(&br, rbsp, size);
+    bitreader_read_ue(&br);         /* pic_parameter_set_id */
+    bitreader_read_ue(&br);         /* seq_parameter_set_id */
+    if (bitreader_read_bit(&br)) {
+        fprintf(stderr, "Error: Dynamic stream uses CABAC\n");
+        return -1;
+    }
+    p->bottom_field_pic_order_in_frame_present_flag = bitreader_read_bit(&br);
+    if (bitreader_read_ue(&br) != 0) {
+        fprintf(stderr, "Error: Dynamic stream uses slice groups\n");
+        return -1;
+    }
+    p->num_ref_idx_l0_default_minus1 = (int)bitreader_read_ue(&br);
+    bitreader_read_ue(&br);         /* num_ref_idx_l1_default_active_minus1 */
+    if (bitreader_read_bit(&br) || bitreader_read_bits(&br, 2)) {
+        fprintf(stderr, "Error: Dynamic stream uses weighted prediction\n");
+        return -1;
+    }
+    p->pic_init_qp = 26 + bitreader_read_se(&br);
+    bitreader_read_se(&br);         /* pic_init_qs_minus26 */
+    p->chroma_qp_index_offset = bitreader_read_se(&br);
+    p->deblocking_filter_control_present_flag = bitreader_read_bit(&br);
+    p->constrained_intra_pred_flag = bitreader_read_bit(&br);
+    if (bitreader_read_bit(&br)) {
+        fprintf(stderr, "Error: Dynamic stream uses redundant pictures\n");
+        return -1;
+    }
+
+    if (bitreader_get_bit_position(&br) < stop_bit) {
+        if (bitreader_read_bit(&br)) {
+            fprintf(stderr, "Error: Dynamic stream uses 8x8 transforms\n");
+            return -1;
+        }
+        if (bitreader_read_bit(&br)) {
+            fprintf(stderr, "Error: Dynamic stream uses scaling matrices\n");
+            return -1;
+        }
+        if (bitreader_read_se(&br) != p->chroma_qp_index_offset) {
+            fprintf(stderr, "Error: Dynamic stream has a second chroma QP offset\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int parse_slice_header(const SpliceParams *p, const NALUnit *unit, SpliceSlice *sl) {
+    BitReader br;
+    bitreader_init(&br, sl->rbsp, sl->rbsp_size);
+
+    sl->first_mb = (int)bitreader_read_ue(&br);
+    uint32_t slice_type = bitreader_read_ue(&br);
+    if (slice_type > 9 || (slice_type % 5 != SLICE_TYPE_P && slice_type % 5 != SLICE_TYPE_I)) {
+        fprintf(stderr, "Error: Dynamic slice type %u is not P or I\n", slice_type);
+        return -1;
+    }
+    sl->slice_type = (int)(slice_type % 5);
+    if (sl->first_mb >= p->mb_width * p->mb_height) {
+        fprintf(stderr, "Error: Dynamic slice starts at MB %d, past the picture\n", sl->first_mb);
+        return -1;
+    }
+
+    bitreader_read_ue(&br);         /* pic_parameter_set_id */
+    bitreader_read_bits(&br, p->log2_max_frame_num);
+    if (unit->nal_unit_type == NAL_TYPE_IDR) {
+        bitreader_read_ue(&br);     /* idr_pic_id */
+    }
+    if (p->pic_order_cnt_type == 0) {
+        bitreader_read_bits(&br, p->log2_max_pic_order_cnt_lsb);
+        if (p->bottom_field_pic_order_in_frame_present_flag) {
+            bitreader_read_se(&br); /* delta_pic_order_cnt_bottom */
+        }
+    }
+
+    if (sl->slice_type == SLICE_TYPE_P) {
+        int num_refs = p->num_ref_idx_l0_default_minus1 + 1;
+        if (bitreader_read_bit(&br)) {
+            num_refs = (int)bitreader_read_ue(&br) + 1;
+        }
+        if (num_refs != 1) {
+            fprintf(stderr, "Error: Dynamic P slice has %d references, not 1\n", num_refs);
+            return -1;
+        }
+        if (bitreader_read_bit(&br)) {
+            fprintf(stderr, "Error: Dynamic P slice modifies its reference list\n");
+            return -1;
+        }
+    }
+
+    /* dec_ref_pic_marking: the output does its own */
+    if (unit->nal_ref_idc) {
+        if (unit->nal_unit_type == NAL_TYPE_IDR) {
+            bitreader_read_bits(&br, 2);
+        } else if (bitreader_read_bit(&br)) {
+            for (int n = 0; ; n++) {
+                uint32_t op = bitreader_read_ue(&br);
+                if (op == 0) {
+                    break;
+                }
+                if (op > 6 || n >= 66) {
+                    fprintf(stderr, "Error: Dynamic slice has bad reference marking\n");
+                    return -1;
+                }
+                if (op != 5) {
+                    bitreader_read_ue(&br);
+                }
+                if (op == 3) {
+                    bitreader_read_ue(&br);
+                }
+            }
+        }
+    }
+
+    sl->qp = p->pic_init_qp + bitreader_read_se(&br);
+    if (sl->qp < 0 || sl->qp > 51) {
+        fprintf(stderr, "Error: Dynamic slice QP %d is out of range\n", sl->qp);
+        return -1;
+    }
+
+    sl->disable_deblocking_filter_idc = 0;
+    sl->slice_alpha_c0_offset_div2 = 0;
+    sl->slice_beta_offset_div2 = 0;
+    if (p->deblocking_filter_control_present_flag) {
+        sl->disable_deblocking_filter_idc = (int)bitreader_read_ue(&br);
+        if (sl->disable_deblocking_filter_idc > 2) {
+            fprintf(stderr, "Error: Dynamic slice has bad deblocking control\n");
+            return -1;
+        }
+        if (sl->disable_deblocking_filter_idc != 1) {
+            sl->slice_alpha_c0_offset_div2 = bitreader_read_se(&br);
+            sl->slice_beta_offset_div2 = bitreader_read_se(&br);
+        }
+    }
+
+    sl->data_bit = bitreader_get_bit_position(&br);
+    sl->end_bit = rbsp_stop_bit(sl->rbsp, sl->rbsp_size);
+    if (sl->data_bit > sl->end_bit) {
+        fprintf(stderr, "Error: Dynamic slice is truncated\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* ---- Public API ---- */
+
+int splicer_init(Splicer *sp, int mb_width, int mb_height) {
+    size_t num_mbs = (size_t)mb_width * mb_height;
+
+    memset(sp, 0, sizeof(*sp));
+    sp->mb_width = mb_width;
+    sp->mb_height = mb_height;
+    sp->rbsp_capacity = num_mbs * SPLICE_MAX_MB_BYTES + SPLICE_MAX_SLICES * 64;
+    sp->rbsp = malloc(sp->rbsp_capacity);
+    sp->mbs = malloc(num_mbs * sizeof(SpliceMB));
+    sp->out = malloc(num_mbs * sizeof(SpliceMB));
+    sp->blocks = malloc(num_mbs * 27 * sizeof(SpliceBlock));   /* Most blocks of an MB */
+    if (!sp->rbsp || !sp->mbs || !sp->out || !sp->blocks) {
+        splicer_free(sp);
+        return -1;
+    }
+    return 0;
+}
+
+void splicer_free(Splicer *sp) {
+    free(sp->rbsp);
+    free(sp->mbs);
+    free(sp->out);
+    free(sp->blocks);
+    memset(sp, 0, sizeof(*sp));
+}
+
+int splicer_set_parameter_set(Splicer *sp, const NALUnit *unit) {
+    SpliceParams p = sp->params;
+
+    if (unit->size > sp->rbsp_capacity) {
+        fprintf(stderr, "Error: Dynamic parameter set of %zu bytes\n", unit->size);
+        return -1;
+    }
+    size_t size = ebsp_to_rbsp(sp->rbsp, unit->data, unit->size);
+
+    /* Pictures are refused until a usable parameter set replaces a bad one */
+    if (unit->nal_unit_type == NAL_TYPE_SPS) {
+        sp->has_sps = parse_dynamic_sps(&p, sp->rbsp, size) == 0;
+        if (!sp->has_sps) {
+            return -1;
+        }
+    } else if (unit->nal_unit_type == NAL_TYPE_PPS) {
+        int had_pps = sp->has_pps;
+        sp->has_pps = parse_dynamic_pps(&p, sp->rbsp, size) == 0;
+        if (!sp->has_pps) {
+            return -1;
+        }
+        if (!had_pps || p.constrained_intra_pred_flag != sp->params.constrained_intra_pred_flag ||
+            p.chroma_qp_index_offset != sp->params.chroma_qp_index_offset) {
+            sp->pps_changed = 1;
+        }
+    }
+    sp->params = p;
+    return 0;
+}
+
+/* ---- Checks for an exact splice ---- */
+
+/*
+ * Whether the reference samples a 4x4 luma block at pos (and its 2x2
+ * chroma block) reads with MV component mv lie within [0, size) along
+ * one axis, or beyond an open side. Fractional positions add the 6-tap
+ * filter's 2 samples before and 3 after (8.4.2.2.1), or one chroma
+ * sample after (8.4.2.2.2).
+ */
+static int reach_inside(int pos, int mv, int size, int open_low, int open_high) {
+    int luma_lo = pos + (mv >> 2) - ((mv & 3) ? 2 : 0);
+    int luma_hi = pos + (mv >> 2) + 3 + ((mv & 3) ? 3 : 0);
+    int chroma_lo = pos / 2 + (mv >> 3);
+    int chroma_hi = chroma_lo + 1 + ((mv & 7) ? 1 : 0);
+
+    return (open_low || (luma_lo >= 0 && chroma_lo >= 0)) &&
+           (open_high || (luma_hi < size && chroma_hi < size / 2));
+}
+
+/*
+ * Outside the dynamic picture the dynamic encoder predicts from its edge
+ * extension, the output from the composer's MBs around the reference
+ * rectangle, except at the sides where that rectangle meets the frame's
+ * edge. MBs reaching out there would decode differently, and the
+ * difference would spread through later pictures.
+ */
+static int check_reach(const Splicer *sp, int i) {
+    const SpliceParams *p = &sp->params;
+    const SpliceMB *mb = &sp->mbs[i];
+    int mb_x = i % p->mb_width;
+    int mb_y = i / p->mb_width;
+
+    for (int b = 0; b < 16; b++) {
+        int x = mb_x * 16 + (b % 4) * 4;
+        int y = mb_y * 16 + (b / 4) * 4;
+        if (!reach_inside(x, mb->mv[b][0], p->mb_width * 16, sp->ref_x0 == 0,
+                          sp->ref_x0 + p->mb_width == sp->mb_width) ||
+            !reach_inside(y, mb->mv[b][1], p->mb_height * 16, sp->ref_y0 == 0,
+                          sp->ref_y0 + p->mb_height == sp->mb_height)) {
+            fprintf(stderr, "Error: Dynamic MB %d predicts from outside its picture; "
+                    "the dynamic encoder must keep MVs inside it\n", i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Without constrained intra prediction, intra MBs next to the composer's
+ * MBs in a merged slice would predict from them: from the left (and top
+ * left) in the first column, from the top right in 4x4 blocks of the
+ * last column. The error would spread through the picture.
+ */
+static int check_intra_edges(const Splicer *sp, int x1) {
+    const SpliceParams *p = &sp->params;
+
+    if (p->constrained_intra_pred_flag) {
+        return 0;
+    }
+
+    for (int mb_y = 0; mb_y < p->mb_height; mb_y++) {
+        const SpliceMB *first = &sp->mbs[mb_y * p->mb_width];
+        const SpliceMB *last = first + p->mb_width - 1;
+
+        if ((sp->x0 > 0 && (first->kind == SPLICE_MB_I4x4 || first->kind == SPLICE_MB_I16x16)) ||
+            (x1 < sp->mb_width && mb_y > 0 && last->kind == SPLICE_MB_I4x4)) {
+            fprintf(stderr, "Error: Dynamic intra MB in row %d would predict from the "
+                    "composer's MBs; merging needs constrained intra prediction\n", mb_y);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Parse every MB of the loaded picture and check it can be spliced */
+static int parse_picture(Splicer *sp) {
+    const SpliceParams *p = &sp->params;
+    MBGrid g = {sp->mbs, p->mb_width, p->mb_height, p->constrained_intra_pred_flag};
+    int num_mbs = p->mb_width * p->mb_height;
+
+    for (int i = 0; i < num_mbs; i++) {
+        sp->mbs[i].slice = -1;
+    }
+    sp->num_blocks = 0;
+    for (int s = 0; s < sp->num_slices; s++) {
+        if (parse_slice_data(sp, &g, s) < 0) {
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < num_mbs; i++) {
+        const SpliceMB *mb = &sp->mbs[i];
+        if (mb->slice < 0) {
+            fprintf(stderr, "Error: Dynamic picture lacks MB %d\n", i);
+            return -1;
+        }
+        if (is_intra(mb)) {
+            continue;
+        }
+        /* Displaced MVs must stay within the composer's limits */
+        for (int b = 0; b < 16; b++) {
+            int mv_x = mb->mv[b][0] + sp->mv_dx;
+            int mv_y = mb->mv[b][1] + sp->mv_dy;
+            if (mv_x < -4 * MV_LIMIT_X_PX || mv_x >= 4 * MV_LIMIT_X_PX ||
+                mv_y < -4 * MV_LIMIT_PX || mv_y > 4 * MV_LIMIT_PX) {
+                fprintf(stderr, "Error: Dynamic MB %d has MV (%d, %d) past the limits "
+                        "once moved with its rectangle\n", i, mv_x, mv_y);
+                return -1;
+            }
+        }
+        if (check_reach(sp, i) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int splicer_load_picture(Splicer *sp, const NALUnit *units, int num_units,
+                         int x0, int y0, int x1, int y1, int have_ref) {
+    const SpliceParams *p = &sp->params;
+    size_t used = 0;
+    int has_p = 0;
+
+    sp->num_slices = 0;
+    if (!sp->has_sps || !sp->has_pps) {
+        fprintf(stderr, "Error: No usable dynamic SPS and PPS yet\n");
+        return -1;
+    }
+    if (num_units < 1 || num_units > SPLICE_MAX_SLICES) {
+        fprintf(stderr, "Error: Dynamic picture has %d slices (1 to %d)\n",
+                num_units, SPLICE_MAX_SLICES);
+        return -1;
+    }
+    if (p->mb_width != x1 - x0 || p->mb_height != y1 - y0) {
+        fprintf(stderr, "Error: Dynamic picture is %dx%d MBs, its rectangle %dx%d\n",
+                p->mb_width, p->mb_height, x1 - x0, y1 - y0);
+        return -1;
+    }
+
+    for (int s = 0; s < num_units; s++) {
+        const NALUnit *unit = &units[s];
+        SpliceSlice *sl = &sp->slices[s];
+
+        if (unit->size > sp->rbsp_capacity - used) {
+            fprintf(stderr, "Error: Dynamic picture is over %zu bytes\n", sp->rbsp_capacity);
+            return -1;
+        }
+        sl->rbsp = sp->rbsp + used;
+        sl->rbsp_size = ebsp_to_rbsp(sp->rbsp + used, unit->data, unit->size);
+        used += sl->rbsp_size;
+        if (parse_slice_header(p, unit, sl) < 0) {
+            return -1;
+        }
+        if (s > 0 && (unit->nal_ref_idc != 0) != sp->is_reference) {
+            fprintf(stderr, "Error: Dynamic picture mixes reference and non-reference slices\n");
+            return -1;
+        }
+        sp->is_reference = unit->nal_ref_idc != 0;
+        has_p |= sl->slice_type == SLICE_TYPE_P;
+    }
+    sp->num_slices = num_units;
+
+    if (has_p && !have_ref) {
+        fprintf(stderr, "Error: Dynamic P picture without its reference; "
+                "the dynamic encoder must send an I picture\n");
+        sp->num_slices = 0;
+        return -1;
+    }
+
+    sp->x0 = x0;
+    sp->y0 = y0;
+    sp->mv_dx = has_p ? (sp->ref_x0 - x0) * 64 : 0;
+    sp->mv_dy = has_p ? (sp->ref_y0 - y0) * 64 : 0;
+    if (parse_picture(sp) < 0) {
+        sp->num_slices = 0;
+        return -1;
+    }
+
+    sp->passthrough = x0 == 0 && x1 == sp->mb_width && sp->mv_dx == 0 && sp->mv_dy == 0;
+    /* I_PCM samples are byte aligned: behind a new slice header they would shift */
+    for (int i = 0; i < p->mb_width * p->mb_height && sp->passthrough; i++) {
+        sp->passthrough = sp->mbs[i].kind != SPLICE_MB_PCM;
+    }
+
+    if (!sp->passthrough && check_intra_edges(sp, x1) < 0) {
+        sp->num_slices = 0;
+        return -1;
+    }
+
+    for (int s = 0; s < sp->num_slices && !sp->passthrough && !sp->warned_deblocking; s++) {
+        if (sp->slices[s].disable_deblocking_filter_idc != 1) {
+            fprintf(stderr, "Warning: Merged dynamic MBs are not deblocked; "
+                    "disable the dynamic encoder's deblocking filter\n");
+            sp->warned_deblocking = 1;
+        }
+    }
+
+    if (sp->passthrough) {
+        sp->frames_passthrough++;
+    } else {
+        sp->frames_merged++;
+    }
+    sp->mbs_spliced += (uint64_t)p->mb_width * p->mb_height;
+    return 0;
+}
+
+void splicer_write_slice_data(const Splicer *sp, BitWriter *bw, int s) {
+    const SpliceSlice *sl = &sp->slices[s];
+
+    bitwriter_copy_bits(bw, sl->rbsp, sl->rbsp_size, sl->data_bit, sl->end_bit - sl->data_bit);
+}
+
+/* ---- Merged slice ---- */
+
+/* te(v) ref_idx_l0 with num_refs active references */
+static void write_ref_idx(BitWriter *bw, int ref_idx, int num_refs) {
+    if (num_refs == 2) {
+        bitwriter_write_bit(bw, !ref_idx);
+    } else if (num_refs > 2) {
+        bitwriter_write_ue(bw, (uint32_t)ref_idx);
+    }
+}
+
+/* codeNum of a coded_block_pattern */
+static int cbp_code(const uint8_t *table, int cbp) {
+    int code = 0;
+
+    while (table[code] != cbp) {
+        code++;
+    }
+    return code;
+}
+
+static void flush_skip_run(BitWriter *bw, int *skip_run) {
+    bitwriter_write_ue(bw, (uint32_t)*skip_run);
+    *skip_run = 0;
+}
+
+/* One of the composer's MBs: P_Skip where it can be, else P_L0_16x16 */
+static void write_composer_mb(BitWriter *bw, const MBGrid *g, int mb_x, int mb_y,
+                              const MBMotion *m, int num_refs, int *skip_run) {
+    SpliceMB *mb = grid_mb(g, mb_x, mb_y);
+    int ref = m->ref_idx;
+    int mv[2] = {m->mv_x, m->mv_y};
+    int smv[2], mvp[2];
+
+    skip_mv(g, mb_x, mb_y, smv);
+    if (ref == MB_REF_SKIP) {
+        ref = 0;
+        mv[0] = smv[0];
+        mv[1] = smv[1];
+    }
+    set_motion(mb, 0xffff, ref, mv);
+
+    if (ref == 0 && mv[0] == smv[0] && mv[1] == smv[1]) {
+        mb->kind = SPLICE_MB_SKIP;
+        (*skip_run)++;
+        return;
+    }
+
+    mb->kind = SPLICE_MB_INTER;
+    predict_mv(g, mb_x, mb_y, 0, 0, 0, 4, 4, ref, mvp);
+    flush_skip_run(bw, skip_run);
+    bitwriter_write_ue(bw, 0);      /* P_L0_16x16 */
+    write_ref_idx(bw, ref, num_refs);
+    bitwriter_write_se(bw, mv[0] - mvp[0]);
+    bitwriter_write_se(bw, mv[1] - mvp[1]);
+    bitwriter_write_ue(bw, 0);      /* coded_block_pattern */
+}
+
+/* mb_qp_delta and the residual blocks, coeff_tokens for the new neighbours */
+static void write_residual(const Splicer *sp, BitWriter *bw, const MBGrid *g,
+                           int mb_x, int mb_y, SpliceMB *mb, int *qp) {
+    if (mb->cbp == 0 && mb->kind != SPLICE_MB_I16x16) {
+        mb->qp = *qp;
+        return;
+    }
+
+    int delta = mb->qp - *qp;
+    if (delta < -26) {
+        delta += 52;
+    } else if (delta > 25) {
+        delta -= 52;
+    }
+    bitwriter_write_se(bw, delta);
+    *qp = mb->qp;
+
+    for (int i = 0; i < mb->num_blocks; i++) {
+        const SpliceBlock *b = &sp->blocks[mb->first_block + i];
+        write_coeff_token(bw, block_nc(g, mb_x, mb_y, b), b->total_coeff, b->trailing_ones);
+        bitwriter_copy_bits(bw, sp->rbsp, sp->rbsp_capacity, b->start_bit,
+                            b->end_bit - b->start_bit);
+    }
+}
+
+/* A dynamic inter MB on dynamic_ref_idx, P_Skip as P_L0_16x16 */
+static void write_dynamic_inter(const Splicer *sp, BitWriter *bw, const MBGrid *g,
+                                int mb_x, int mb_y, SpliceMB *mb, int num_refs,
+                                int dynamic_ref_idx, int *qp) {
+    int parts[16][4];
+    unsigned done = 0;
+
+    if (mb->kind == SPLICE_MB_SKIP) {
+        mb->mb_type = 0;
+    } else if (mb->mb_type == P_8x8REF0) {
+        mb->mb_type = P_8x8;
+    }
+    mb->kind = SPLICE_MB_INTER;
+    for (int i = 0; i < 16; i++) {
+        mb->ref[i] = dynamic_ref_idx;
+        mb->mv[i][0] += sp->mv_dx;
+        mb->mv[i][1] += sp->mv_dy;
+    }
+
+    int n = mb_partitions(mb, parts);
+    bitwriter_write_ue(bw, (uint32_t)mb->mb_type);
+    if (mb->mb_type == P_8x8) {
+        for (int i = 0; i < 4; i++) {
+            bitwriter_write_ue(bw, (uint32_t)mb->sub_type[i]);
+        }
+        for (int i = 0; i < 4; i++) {
+            write_ref_idx(bw, dynamic_ref_idx, num_refs);
+        }
+    } else {
+        for (int p = 0; p < n; p++) {
+            write_ref_idx(bw, dynamic_ref_idx, num_refs);
+        }
+    }
+
+    for (int p = 0; p < n; p++) {
+        int mvp[2];
+        int blk = parts[p][1] * 4 + parts[p][0];
+
+        predict_mv(g, mb_x, mb_y, done, parts[p][0], parts[p][1], parts[p][2], parts[p][3],
+                   dynamic_ref_idx, mvp);
+        bitwriter_write_se(bw, mb->mv[blk][0] - mvp[0]);
+        bitwriter_write_se(bw, mb->mv[blk][1] - mvp[1]);
+        done |= partition_mask(parts[p]);
+    }
+
+    bitwriter_write_ue(bw, (uint32_t)cbp_code(golomb_to_inter_cbp, mb->cbp));
+    write_residual(sp, bw, g, mb_x, mb_y, mb, qp);
+}
+
+static void write_dynamic_intra(const Splicer *sp, BitWriter *bw, const MBGrid *g,
+                                int mb_x, int mb_y, SpliceMB *mb, int *qp) {
+    if (mb->kind == SPLICE_MB_PCM) {
+        bitwriter_write_ue(bw, P_MB_TYPE_INTRA + I_MB_TYPE_PCM);
+        while (!bitwriter_is_byte_aligned(bw)) {
+            bitwriter_write_bit(bw, 0);     /* pcm_alignment_zero_bit */
+        }
+        bitwriter_copy_bits(bw, sp->rbsp, sp->rbsp_capacity, mb->pcm_bit, PCM_BYTES * 8);
+        mb->qp = *qp;
+        return;
+    }
+
+    bitwriter_write_ue(bw, (uint32_t)(P_MB_TYPE_INTRA + mb->mb_type));
+    if (mb->kind == SPLICE_MB_I4x4) {
+        for (int i = 0; i < 16; i++) {
+            int blk = blk_raster[i];
+            int pred = predicted_intra_mode(g, mb_x, mb_y, blk & 3, blk >> 2);
+            int mode = mb->intra_mode[blk];
+            if (mode == pred) {
+                bitwriter_write_bit(bw, 1);
+            } else {
+                bitwriter_write_bit(bw, 0);
+                bitwriter_write_bits(bw, (uint32_t)(mode < pred ? mode : mode - 1), 3);
+            }
+        }
+    }
+    bitwriter_write_ue(bw, (uint32_t)mb->chroma_pred_mode);
+    if (mb->kind == SPLICE_MB_I4x4) {
+        bitwriter_write_ue(bw, (uint32_t)cbp_code(golomb_to_intra_cbp, mb->cbp));
+    }
+    write_residual(sp, bw, g, mb_x, mb_y, mb, qp);
+}
+
+void splicer_write_merged(Splicer *sp, BitWriter *bw, const MBMotion *field,
+                          int num_refs, int dynamic_ref_idx, int qp) {
+    const SpliceParams *p = &sp->params;
+    MBGrid g = {sp->out, sp->mb_width, p->mb_height, p->constrained_intra_pred_flag};
+    int skip_run = 0;
+
+    /*
+     * MBs are reset as they are written: one slice, and nothing later in
+     * raster order is ever a neighbour
+     */
+    for (int mb_y = 0; mb_y < g.height; mb_y++) {
+        for (int mb_x = 0; mb_x < g.width; mb_x++) {
+            SpliceMB *mb = grid_mb(&g, mb_x, mb_y);
+            int dyn_x = mb_x - sp->x0;
+
+            if (dyn_x < 0 || dyn_x >= p->mb_width) {
+                memset(mb, 0, sizeof(*mb));
+                write_composer_mb(bw, &g, mb_x, mb_y, &field[(size_t)mb_y * g.width + mb_x],
+                                  num_refs, &skip_run);
+                continue;
+            }
+
+            *mb = sp->mbs[(size_t)mb_y * p->mb_width + dyn_x];
+            mb->slice = 0;
+            flush_skip_run(bw, &skip_run);
+            if (is_intra(mb)) {
+                write_dynamic_intra(sp, bw, &g, mb_x, mb_y, mb, &qp);
+            } else {
+                write_dynamic_inter(sp, bw, &g, mb_x, mb_y, mb, num_refs, dynamic_ref_idx, &qp);
+            }
+        }
+    }
+
+    if (skip_run > 0) {
+        bitwriter_write_ue(bw, (uint32_t)skip_run);
+    }
+}
@@ -0,0 +1,109 @@
+#include "worker_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Take the next task of the current batch and run it
+ *
+ * Called with the lock held; returns with it held.
+ * Returns 0 if the batch has no tasks left to hand out.
+ */
+static int worker_pool_run_one(WorkerPool *pool) {
+    if (pool->next_task >= pool->num_tasks) {
+        return 0;
+    }
+
+    int task = pool->next_task++;
+    WorkerTaskFn fn = pool->fn;
+    void *arg = pool->arg;
+    pthread_mutex_unlock(&pool->lock);
+
+    fn(arg, task);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->tasks_done++;
+    if (pool->tasks_done == pool->num_tasks) {
+        pthread_cond_broadcast(&pool->done_cond);
+    }
+    return 1;
+}
+
+static void *worker_pool_thread(void *arg) {
+    WorkerPool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->shutdown) {
+        if (!worker_pool_run_one(pool)) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+int worker_pool_init(WorkerPool *pool, int num_threads) {
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    if (num_threads <= 0) {
+        return 0;
+    }
+
+    pool->threads = malloc((size_t)num_threads * sizeof(pthread_t));
+    if (!pool->threads) {
+        fprintf(stderr, "Error: Failed to allocate worker threads\n");
+        worker_pool_free(pool);
+        return -1;
+    }
+
+    while (pool->num_threads < num_threads) {
+        if (pthread_create(&pool->threads[pool->num_threads], NULL,
+                           worker_pool_thread, pool) != 0) {
+            fprintf(stderr, "Error: Failed to start worker threads\n");
+            worker_pool_free(pool);
+            return -1;
+        }
+        pool->num_threads++;
+    }
+    return 0;
+}
+
+void worker_pool_free(WorkerPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    memset(pool, 0, sizeof(*pool));
+}
+
+void worker_pool_run(WorkerPool *pool, WorkerTaskFn fn, void *arg, int num_tasks) {
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->num_tasks = num_tasks;
+    pool->next_task = 0;
+    pool->tasks_done = 0;
+    pthread_cond_broadcast(&pool->work_cond);
+
+    while (worker_pool_run_one(pool)) {
+        /* Caller works on the batch too */
+    }
+    while (pool->tasks_done < pool->num_tasks) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+
+    pool->num_tasks = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,85 @@
+#include "zeroscan.h"
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ZEROSCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static size_t find_pair_scalar(const uint8_t *data, size_t start, size_t end) {
+    for (size_t i = start; i + 1 < end; i++) {
+        if (data[i] == 0 && data[i + 1] == 0) {
+            return i;
+        }
+    }
+    return end;
+}
+
+#ifdef ZEROSCAN_X86
+
+__attribute__((target("sse2")))
+static size_t find_pair_sse2(const uint8_t *data, size_t start, size_t end) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = start;
+
+    /* Compare bytes i..i+15 with their successors i+1..i+16 */
+    while (i + 17 <= end) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(data + i + 1));
+        __m128i pair = _mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero));
+        unsigned mask = (unsigned)_mm_movemask_epi8(pair);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 16;
+    }
+    return find_pair_scalar(data, i, end);
+}
+
+__attribute__((target("avx2")))
+static size_t find_pair_avx2(const uint8_t *data, size_t start, size_t end) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = start;
+
+    while (i + 33 <= end) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+        __m256i pair = _mm256_and_si256(_mm256_cmpeq_epi8(a, zero), _mm256_cmpeq_epi8(b, zero));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(pair);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 32;
+    }
+    return find_pair_sse2(data, i, end);
+}
+
+#endif /* ZEROSCAN_X86 */
+
+typedef size_t (*FindPairFn)(const uint8_t *data, size_t start, size_t end);
+
+static FindPairFn select_find_pair(void) {
+#ifdef ZEROSCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return find_pair_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return find_pair_sse2;
+    }
+#endif
+    return find_pair_scalar;
+}
+
+static FindPairFn find_pair = find_pair_scalar;
+static pthread_once_t find_pair_once = PTHREAD_ONCE_INIT;
+
+static void init_find_pair(void) {
+    find_pair = select_find_pair();
+}
+
+size_t zeroscan_find_pair(const uint8_t *data, size_t start, size_t end) {
+    /* Frame and slice workers call this concurrently; select once */
+    pthread_once(&find_pair_once, init_find_pair);
+    return find_pair(data, start, end);
+}